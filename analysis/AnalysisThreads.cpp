@@ -0,0 +1,180 @@
+/*
+  Copyright 2013--2018 James E. McClure, Virginia Polytechnic & State University
+
+  This file is part of the Open Porous Media project (OPM).
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "analysis/AnalysisThreads.h"
+#include "common/Utilities.h"
+
+#include <algorithm>
+#include <stdio.h>
+#ifdef __linux__
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+
+/******************************************************************
+* Thread affinity (only supported on linux)                       *
+******************************************************************/
+static std::vector<int> getProcessCores()
+{
+    std::vector<int> cores;
+#ifdef __linux__
+    cpu_set_t mask;
+    CPU_ZERO( &mask );
+    if ( sched_getaffinity( 0, sizeof( mask ), &mask ) == 0 ) {
+        for ( int i = 0; i < CPU_SETSIZE; i++ ) {
+            if ( CPU_ISSET( i, &mask ) )
+                cores.push_back( i );
+        }
+    }
+#endif
+    return cores;
+}
+// Pin the workers to the cores of the process other than the first (left to the calling thread)
+static bool pinThreads( std::vector<std::thread> &threads, const std::vector<int> &cores )
+{
+    if ( cores.size() < 2 )
+        return false;
+#ifdef __linux__
+    cpu_set_t mask;
+    CPU_ZERO( &mask );
+    for ( size_t i = 1; i < cores.size(); i++ )
+        CPU_SET( cores[i], &mask );
+    for ( auto &thread : threads )
+        pthread_setaffinity_np( thread.native_handle(), sizeof( mask ), &mask );
+    return true;
+#else
+    NULL_USE( threads );
+    return false;
+#endif
+}
+
+
+/******************************************************************
+* Read the options from the Analysis database                     *
+******************************************************************/
+static void readOptions(
+    std::shared_ptr<Database> analysis_db, int &N_threads, int &max_queued, std::string &method )
+{
+    N_threads = 0;
+    method    = "default";
+    if ( analysis_db->keyExists( "N_threads" ) )
+        N_threads = analysis_db->getScalar<int>( "N_threads" );
+    if ( analysis_db->keyExists( "load_balance" ) )
+        method = analysis_db->getScalar<std::string>( "load_balance" );
+    if ( method != "none" && method != "default" && method != "independent" )
+        ERROR( "Unknown load_balance method (none, default, independent): " + method );
+    if ( method == "none" )
+        N_threads = 0;
+    max_queued = std::max( N_threads, 1 );
+    if ( analysis_db->keyExists( "max_queued" ) )
+        max_queued = std::max( analysis_db->getScalar<int>( "max_queued" ), 1 );
+}
+int AnalysisThreads::maxItems( std::shared_ptr<Database> analysis_db )
+{
+    int N_threads, max_queued;
+    std::string method;
+    readOptions( analysis_db, N_threads, max_queued, method );
+    return N_threads > 0 ? N_threads + max_queued + 1 : 0;
+}
+
+
+/******************************************************************
+* Constructor/destructor                                          *
+******************************************************************/
+AnalysisThreads::AnalysisThreads( std::shared_ptr<Database> analysis_db, MPI_Comm comm )
+    : d_max_queued( 0 ), d_running( 0 ), d_stop( false ), d_method( "default" )
+{
+    int rank      = comm_rank( comm );
+    int N_threads = 0;
+    readOptions( analysis_db, N_threads, d_max_queued, d_method );
+    // The work items use MPI from the worker threads
+    int provided = MPI_THREAD_MULTIPLE;
+#ifdef USE_MPI
+    MPI_Query_thread( &provided );
+#endif
+    if ( N_threads > 0 && provided < MPI_THREAD_MULTIPLE ) {
+        if ( rank == 0 )
+            printf( "WARNING: MPI does not support MPI_THREAD_MULTIPLE, the analysis will run on the main thread \n" );
+        N_threads = 0;
+    }
+    MPI_Comm_dup( comm, &d_comm );
+    // Start the threads
+    for ( int i = 0; i < N_threads; i++ )
+        d_threads.push_back( std::thread( &AnalysisThreads::run, this ) );
+    if ( N_threads > 0 && d_method == "independent" ) {
+        if ( !pinThreads( d_threads, getProcessCores() ) && rank == 0 )
+            printf( "WARNING: load_balance = independent needs more than one core per rank \n" );
+    }
+    if ( rank == 0 && N_threads > 0 )
+        printf( "Analysis: %i threads, load_balance = %s \n", N_threads, d_method.c_str() );
+}
+AnalysisThreads::~AnalysisThreads()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> lock( d_mutex );
+        d_stop = true;
+    }
+    d_work_cv.notify_all();
+    for ( auto &thread : d_threads )
+        thread.join();
+    MPI_Comm_free( &d_comm );
+}
+
+
+/******************************************************************
+* Add/run the work                                                *
+******************************************************************/
+void AnalysisThreads::add( std::function<void( MPI_Comm )> work )
+{
+    if ( d_threads.empty() ) {
+        work( d_comm );
+        return;
+    }
+    MPI_Comm comm;
+    MPI_Comm_dup( d_comm, &comm );
+    std::unique_lock<std::mutex> lock( d_mutex );
+    // Back-pressure: wait for the workers to catch up
+    d_done_cv.wait( lock, [this] { return (int) d_queue.size() < d_max_queued; } );
+    d_queue.push_back( std::make_pair( std::move( work ), comm ) );
+    lock.unlock();
+    d_work_cv.notify_one();
+}
+void AnalysisThreads::wait()
+{
+    std::unique_lock<std::mutex> lock( d_mutex );
+    d_done_cv.wait( lock, [this] { return d_queue.empty() && d_running == 0; } );
+}
+void AnalysisThreads::run()
+{
+    while ( true ) {
+        std::unique_lock<std::mutex> lock( d_mutex );
+        d_work_cv.wait( lock, [this] { return d_stop || !d_queue.empty(); } );
+        if ( d_queue.empty() )
+            return;
+        auto item = std::move( d_queue.front() );
+        d_queue.pop_front();
+        d_running++;
+        lock.unlock();
+        d_done_cv.notify_all();
+        item.first( item.second );
+        MPI_Comm_free( &item.second );
+        lock.lock();
+        d_running--;
+        lock.unlock();
+        d_done_cv.notify_all();
+    }
+}
@@ -0,0 +1,102 @@
+/*
+  Copyright 2013--2018 James E. McClure, Virginia Polytechnic & State University
+
+  This file is part of the Open Porous Media project (OPM).
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef AnalysisThreads_INC
+#define AnalysisThreads_INC
+
+#include "common/Database.h"
+#include "common/MPI_Helpers.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/*!
+ * @brief  Pool of threads that run the in-situ analysis
+ * @details  The simulation snapshots the fields it needs (on the main thread) and
+ *    hands the rest of the work to the pool, so that the main thread can keep
+ *    stepping while the analysis runs.  Each work item gets its own duplicate of
+ *    the communicator (created on the main thread, in the same order on every
+ *    rank), so items may use MPI concurrently with the simulation.
+ *    The pool is configured from the Analysis database:
+ *       N_threads      number of worker threads (0 runs everything on the main thread)
+ *       load_balance   "none"        run everything on the main thread
+ *                      "default"     worker threads are placed by the OS
+ *                      "independent" the workers are pinned to the cores of the process
+ *                                    other than the first, which is left to the main thread
+ *                                    (the affinity of the main thread is not changed)
+ *       max_queued     number of items that may wait for a thread (default N_threads);
+ *                      add() blocks while the queue is full
+ *    Threads are only used when MPI provides MPI_THREAD_MULTIPLE.
+ */
+class AnalysisThreads
+{
+public:
+    //! Create the pool (collective on comm)
+    AnalysisThreads( std::shared_ptr<Database> analysis_db, MPI_Comm comm );
+
+    //! Wait for the remaining work and stop the threads
+    ~AnalysisThreads();
+
+    //! Number of worker threads (0 if the work runs on the main thread)
+    inline int threads() const { return d_threads.size(); }
+
+    /*!
+     * @brief  Run a work item
+     * @details  Collective on the communicator used to create the pool: all ranks must
+     *    add the same items in the same order.  Blocks while max_queued items are
+     *    already waiting for a thread.
+     * @param[in] work      Work to run; it receives its own communicator, which
+     *                      is freed after the item finishes
+     */
+    void add( std::function<void( MPI_Comm )> work );
+
+    //! Wait until all work items have finished
+    void wait();
+
+    /*!
+     * @brief  Number of work items that may hold a copy of their data at once
+     * @details  The running items, the queued items and the one add() waits to queue
+     *    (0 if the work runs on the main thread).  Used to budget the memory of the snapshots.
+     * @param[in] analysis_db   Analysis database used to create the pool
+     */
+    static int maxItems( std::shared_ptr<Database> analysis_db );
+
+private:
+    AnalysisThreads( const AnalysisThreads & ) = delete;
+    AnalysisThreads &operator=( const AnalysisThreads & ) = delete;
+
+    void run();
+
+    MPI_Comm d_comm;
+    int d_max_queued;
+    int d_running;
+    bool d_stop;
+    std::string d_method;
+    std::vector<std::thread> d_threads;
+    std::deque<std::pair<std::function<void( MPI_Comm )>, MPI_Comm>> d_queue;
+    std::mutex d_mutex;
+    std::condition_variable d_work_cv; // signals the workers
+    std::condition_variable d_done_cv; // signals add() and wait()
+};
+
+
+#endif
@@ -0,0 +1,118 @@
+/*
+  Copyright 2013--2018 James E. McClure, Virginia Polytechnic & State University
+
+  This file is part of the Open Porous Media project (OPM).
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "analysis/Minkowski.h"
+#include "common/Utilities.h"
+
+#include <math.h>
+#include <stdio.h>
+
+
+Minkowski::Minkowski( MPI_Comm comm ) : Vi( 0 ), Ai( 0 ), Ji( 0 ), Xi( 0 ), d_comm( comm ) {}
+
+
+/******************************************************************
+* Compute the functionals                                         *
+******************************************************************/
+void Minkowski::ComputeScalar( const DoubleArray &Field, double isovalue, double width )
+{
+    compute( Field, isovalue, width, nullptr );
+}
+void Minkowski::ComputeScalar(
+    const DoubleArray &Field, double isovalue, double width, const DoubleArray &Mask )
+{
+    INSIST( Mask.size() == Field.size(), "Mask and Field must be the same size" );
+    compute( Field, isovalue, width, Mask.data() );
+}
+void Minkowski::compute( const DoubleArray &Field, double isovalue, double width, const double *mask )
+{
+    INSIST( width > 0, "width must be positive" );
+    const int Nx    = Field.size( 0 );
+    const int Ny    = Field.size( 1 );
+    const int Nz    = Field.size( 2 );
+    const size_t sx = 1;
+    const size_t sy = Nx;
+    const size_t sz = (size_t) Nx * Ny;
+    const double *f = Field.data();
+    const double pi = 3.14159265358979;
+    // Cells in the region (1/0)
+    auto in = [f, mask, isovalue]( size_t n ) {
+        return ( f[n] > isovalue && ( !mask || mask[n] > 0 ) ) ? 1.0 : 0.0;
+    };
+    double V = 0, A = 0, J = 0, X = 0;
+    // Each interior cell owns the cubical cells (vertex, edges, faces, cube) that
+    // start at it, so the ranks count every element once
+    #ifdef USE_OPENMP
+        #pragma omp parallel for collapse( 2 ) reduction( + : V, A, J, X )
+    #endif
+    for ( int k = 1; k < Nz - 1; k++ ) {
+        for ( int j = 1; j < Ny - 1; j++ ) {
+            #ifdef USE_OPENMP
+                #pragma omp simd reduction( + : V, A, J, X )
+            #endif
+            for ( int i = 1; i < Nx - 1; i++ ) {
+                size_t n = i + j * sy + k * sz;
+                // Euler characteristic from the 2x2x2 configuration
+                double b0 = in( n ), bx = in( n + sx ), by = in( n + sy ), bz = in( n + sz );
+                double bxy = in( n + sx + sy ), bxz = in( n + sx + sz ), byz = in( n + sy + sz );
+                double bxyz = in( n + sx + sy + sz );
+                double edges = b0 * ( bx + by + bz );
+                double faces = b0 * ( bx * by * bxy + bx * bz * bxz + by * bz * byz );
+                double cube  = b0 * bx * by * bz * bxy * bxz * byz * bxyz;
+                V += b0;
+                X += b0 - edges + faces - cube;
+                // Surface measures of the level sets near the isovalue
+                double fx  = 0.5 * ( f[n + sx] - f[n - sx] );
+                double fy  = 0.5 * ( f[n + sy] - f[n - sy] );
+                double fz  = 0.5 * ( f[n + sz] - f[n - sz] );
+                double fxx = f[n + sx] - 2 * f[n] + f[n - sx];
+                double fyy = f[n + sy] - 2 * f[n] + f[n - sy];
+                double fzz = f[n + sz] - 2 * f[n] + f[n - sz];
+                double fxy = 0.25 * ( f[n + sx + sy] - f[n + sx - sy] - f[n - sx + sy] + f[n - sx - sy] );
+                double fxz = 0.25 * ( f[n + sx + sz] - f[n + sx - sz] - f[n - sx + sz] + f[n - sx - sz] );
+                double fyz = 0.25 * ( f[n + sy + sz] - f[n + sy - sz] - f[n - sy + sz] + f[n - sy - sz] );
+                double g2  = fx * fx + fy * fy + fz * fz;
+                double g   = sqrt( g2 );
+                double d   = f[n] - isovalue;
+                double w   = fabs( d ) < width ? 0.5 * ( 1 + cos( pi * d / width ) ) / width : 0.0;
+                double dA  = ( !mask || mask[n] > 0 ) ? w * g : 0.0;
+                // mean curvature (positive for a convex region): -div(grad f/|grad f|)/2
+                double div = g2 * ( fxx + fyy + fzz ) -
+                             ( fx * fx * fxx + fy * fy * fyy + fz * fz * fzz +
+                                 2 * ( fx * fy * fxy + fx * fz * fxz + fy * fz * fyz ) );
+                double H = g2 > 1e-20 ? -0.5 * div / ( g2 * g ) : 0.0;
+                A += dA;
+                J += dA * H;
+            }
+        }
+    }
+    double local[4] = { V, A, J, X };
+    double global[4];
+    MPI_Allreduce( local, global, 4, MPI_DOUBLE, MPI_SUM, d_comm );
+    Vi = global[0];
+    Ai = global[1];
+    Ji = global[2];
+    Xi = global[3];
+}
+
+
+/******************************************************************
+* Print the functionals                                           *
+******************************************************************/
+void Minkowski::PrintAll() const
+{
+    if ( comm_rank( d_comm ) == 0 )
+        printf( "Minkowski functionals: V = %f, A = %f, J = %f, X = %f \n", Vi, Ai, Ji, Xi );
+}
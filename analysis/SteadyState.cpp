@@ -0,0 +1,175 @@
+/*
+  Copyright 2013--2018 James E. McClure, Virginia Polytechnic & State University
+
+  This file is part of the Open Porous Media project (OPM).
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "analysis/SteadyState.h"
+#include "common/Utilities.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+
+/******************************************************************
+* StreamingStats                                                  *
+******************************************************************/
+StreamingStats::StreamingStats( int N ) : d_y( std::max( N, 0 ), 0.0 )
+{
+    reset();
+}
+void StreamingStats::reset()
+{
+    d_first = 0;
+    d_N     = 0;
+    d_added = 0;
+    d_sum   = 0;
+    d_sum2  = 0;
+    d_sumt  = 0;
+}
+void StreamingStats::add( double y )
+{
+    int W = d_y.size();
+    if ( W == 0 )
+        return;
+    if ( d_N == W ) {
+        // Drop the oldest sample and shift the time of the others down by one
+        double y0 = d_y[d_first];
+        d_sum -= y0;
+        d_sum2 -= y0 * y0;
+        d_sumt -= d_sum;
+        d_first = ( d_first + 1 ) % W;
+        d_N--;
+    }
+    d_y[( d_first + d_N ) % W] = y;
+    d_sum += y;
+    d_sum2 += y * y;
+    d_sumt += d_N * y;
+    d_N++;
+    if ( ++d_added == W )
+        recompute();
+}
+void StreamingStats::recompute()
+{
+    int W   = d_y.size();
+    d_sum   = 0;
+    d_sum2  = 0;
+    d_sumt  = 0;
+    d_added = 0;
+    for ( int t = 0; t < d_N; t++ ) {
+        double y = d_y[( d_first + t ) % W];
+        d_sum += y;
+        d_sum2 += y * y;
+        d_sumt += t * y;
+    }
+}
+double StreamingStats::mean() const { return d_N > 0 ? d_sum / d_N : 0.0; }
+double StreamingStats::variance() const
+{
+    if ( d_N < 2 )
+        return 0.0;
+    double Syy = d_sum2 - d_sum * d_sum / d_N;
+    return std::max( Syy, 0.0 ) / ( d_N - 1 );
+}
+double StreamingStats::slope() const
+{
+    if ( d_N < 2 )
+        return 0.0;
+    double n   = d_N;
+    double Sxx = n * ( n * n - 1 ) / 12;
+    double Sxy = d_sumt - 0.5 * ( n - 1 ) * d_sum;
+    return Sxy / Sxx;
+}
+double StreamingStats::slopeError() const
+{
+    if ( d_N < 3 )
+        return 0.0;
+    double n   = d_N;
+    double Sxx = n * ( n * n - 1 ) / 12;
+    double Sxy = d_sumt - 0.5 * ( n - 1 ) * d_sum;
+    double Syy = d_sum2 - d_sum * d_sum / n;
+    double RSS = std::max( Syy - Sxy * Sxy / Sxx, 0.0 );
+    return sqrt( RSS / ( n - 2 ) / Sxx );
+}
+
+
+/******************************************************************
+* SteadyStateDetector                                             *
+******************************************************************/
+// Two-sided quantile of the normal distribution: P(|X|<z) = p
+static double normalQuantile( double p )
+{
+    if ( p <= 0 )
+        return 0;
+    double z = 2;
+    for ( int it = 0; it < 50; it++ ) {
+        double f  = erf( z / sqrt( 2.0 ) ) - p;
+        double df = sqrt( 2.0 / 3.14159265358979 ) * exp( -0.5 * z * z );
+        double dz = f / df;
+        z         = std::max( z - dz, 0.5 * z );
+        if ( fabs( dz ) < 1e-12 )
+            break;
+    }
+    return z;
+}
+SteadyStateDetector::SteadyStateDetector(
+    const std::vector<std::string> &names, int window, double tolerance, double confidence )
+    : d_window( window ), d_tolerance( tolerance ), d_z( 0 ), d_names( names )
+{
+    if ( confidence < 0 || confidence >= 1 )
+        ERROR( "steady_confidence must be in [0,1)" );
+    d_z = normalQuantile( confidence );
+    d_stats.resize( names.size(), StreamingStats( window ) );
+    d_scale.resize( names.size(), 0.0 );
+}
+void SteadyStateDetector::add( const std::vector<double> &values, const std::vector<double> &scales )
+{
+    INSIST( values.size() == d_stats.size() && scales.size() == d_stats.size(),
+        "Wrong number of values for the steady-state detector" );
+    for ( size_t i = 0; i < d_stats.size(); i++ ) {
+        d_stats[i].add( values[i] );
+        d_scale[i] = fabs( scales[i] );
+    }
+}
+void SteadyStateDetector::reset()
+{
+    for ( auto &stats : d_stats )
+        stats.reset();
+}
+double SteadyStateDetector::drift( int i ) const
+{
+    const auto &stats = d_stats[i];
+    return ( fabs( stats.slope() ) + d_z * stats.slopeError() ) * ( stats.count() - 1 );
+}
+bool SteadyStateDetector::steady() const
+{
+    if ( !enabled() )
+        return false;
+    for ( size_t i = 0; i < d_stats.size(); i++ ) {
+        if ( !d_stats[i].full() || drift( i ) > d_tolerance * d_scale[i] )
+            return false;
+    }
+    return true;
+}
+void SteadyStateDetector::print( int rank ) const
+{
+    if ( rank != 0 || !enabled() )
+        return;
+    printf( "Steady state (%i/%i samples): ", d_stats[0].count(), d_window );
+    for ( size_t i = 0; i < d_stats.size(); i++ ) {
+        double rel = d_scale[i] > 0 ? drift( i ) / d_scale[i] : 0.0;
+        printf( "%s = %e (sd %e, drift %e), ", d_names[i].c_str(), d_stats[i].mean(),
+            sqrt( d_stats[i].variance() ), rel );
+    }
+    printf( "tolerance = %e \n", d_tolerance );
+}
@@ -0,0 +1,131 @@
+/*
+  Copyright 2013--2018 James E. McClure, Virginia Polytechnic & State University
+
+  This file is part of the Open Porous Media project (OPM).
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SteadyState_INC
+#define SteadyState_INC
+
+#include <string>
+#include <vector>
+
+
+/*!
+ * @brief  Windowed statistics of a time series
+ * @details  Keeps the last N samples in a ring buffer together with running sums,
+ *    so that adding a sample and querying the mean, variance and least-squares
+ *    slope are O(1).  The sums are recomputed from the buffer once per window
+ *    to keep the round-off from accumulating.
+ */
+class StreamingStats
+{
+public:
+    //! Create the statistics for a window of N samples
+    explicit StreamingStats( int N = 0 );
+
+    //! Add a sample (the oldest one is dropped once the window is full)
+    void add( double y );
+
+    //! Drop all samples
+    void reset();
+
+    //! Number of samples in the window
+    inline int count() const { return d_N; }
+
+    //! True if the window is full
+    inline bool full() const { return d_N == (int) d_y.size(); }
+
+    //! Mean of the samples in the window
+    double mean() const;
+
+    //! Sample variance of the samples in the window
+    double variance() const;
+
+    //! Least-squares slope of the samples in the window (per sample)
+    double slope() const;
+
+    //! Standard error of the slope (from the residuals of the linear fit)
+    double slopeError() const;
+
+private:
+    void recompute();
+
+    std::vector<double> d_y; // ring buffer
+    int d_first;             // index of the oldest sample
+    int d_N;                 // number of samples
+    int d_added;             // samples added since the sums were recomputed
+    double d_sum;            // sum of y
+    double d_sum2;           // sum of y^2
+    double d_sumt;           // sum of t*y, with t = 0 for the oldest sample
+};
+
+
+/*!
+ * @brief  Streaming steady-state detector
+ * @details  Tracks a set of quantities (one sample each per analysis step) over a
+ *    sliding window.  A quantity is steady when the drift of its linear trend over
+ *    the window is below tolerance*scale with the given confidence:
+ *       ( |slope| + z*error(slope) ) * (window-1) <= tolerance * scale
+ *    where z is the two-sided normal quantile of the confidence and scale is the
+ *    reference magnitude passed with the latest sample.  The state is steady when
+ *    the window is full and all quantities are steady.
+ */
+class SteadyStateDetector
+{
+public:
+    /*!
+     * @brief  Create the detector
+     * @param[in] names         Names of the quantities
+     * @param[in] window        Number of samples in the window (0 disables the detector)
+     * @param[in] tolerance     Relative drift allowed over the window
+     * @param[in] confidence    Confidence that the drift is below the tolerance (0-1)
+     */
+    SteadyStateDetector( const std::vector<std::string> &names, int window, double tolerance,
+        double confidence );
+
+    //! True if the detector is used
+    inline bool enabled() const { return d_window > 1; }
+
+    /*!
+     * @brief  Add a sample of every quantity
+     * @param[in] values        Values of the quantities
+     * @param[in] scales        Reference magnitudes the drift is measured against
+     */
+    void add( const std::vector<double> &values, const std::vector<double> &scales );
+
+    //! Drop the history (call after the forcing or the geometry changes)
+    void reset();
+
+    //! True if all quantities are steady
+    bool steady() const;
+
+    //! Print the statistics (rank 0 only)
+    void print( int rank ) const;
+
+    //! Statistics of a quantity
+    inline const StreamingStats &stats( int i ) const { return d_stats[i]; }
+
+private:
+    // Drift of quantity i over the window (upper bound at the confidence level)
+    double drift( int i ) const;
+
+    int d_window;
+    double d_tolerance;
+    double d_z;
+    std::vector<std::string> d_names;
+    std::vector<StreamingStats> d_stats;
+    std::vector<double> d_scale;
+};
+
+
+#endif
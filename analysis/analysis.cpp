@@ -17,7 +17,12 @@
 //#include "ProfilerApp.h"
 
 #include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <memory>
+#ifdef USE_OPENMP
+    #include <omp.h>
+#endif
 
 
 template<class TYPE>
@@ -26,121 +31,208 @@ template<class TYPE>
 inline const TYPE* getPtr( const std::vector<TYPE>& x ) { return x.empty() ? NULL:&x[0]; }
 
 
+/******************************************************************
+* Lock-free union-find used to label the blobs                    *
+* Each set is rooted at its smallest index: links always point    *
+* from the larger root to the smaller one                         *
+******************************************************************/
+template<bool CONCURRENT>
+static inline int findRoot( std::atomic<int> *parent, int x )
+{
+    while ( true ) {
+        int p = parent[x].load( std::memory_order_relaxed );
+        if ( p == x )
+            return x;
+        int gp = parent[p].load( std::memory_order_relaxed );
+        if ( p != gp ) {
+            // path halving
+            if ( CONCURRENT )
+                parent[x].compare_exchange_weak( p, gp, std::memory_order_relaxed );
+            else
+                parent[x].store( gp, std::memory_order_relaxed );
+        }
+        x = gp;
+    }
+}
+// CONCURRENT=false may be used when no other thread touches the sets of a and b
+template<bool CONCURRENT>
+static inline void unite( std::atomic<int> *parent, int a, int b )
+{
+    while ( true ) {
+        a = findRoot<CONCURRENT>( parent, a );
+        b = findRoot<CONCURRENT>( parent, b );
+        if ( a == b )
+            return;
+        if ( a > b )
+            std::swap( a, b );
+        if ( !CONCURRENT ) {
+            parent[b].store( a, std::memory_order_relaxed );
+            return;
+        }
+        int expected = b;
+        if ( parent[b].compare_exchange_strong( expected, a, std::memory_order_relaxed ) )
+            return;
+    }
+}
+
+
 /******************************************************************
 * Compute the blobs                                               *
 ******************************************************************/
-int ComputeBlob( const Array<bool>& isPhase, BlobIDArray& LocalBlobID, bool periodic, int start_id )
+int ComputeBlob( const BitMask& isPhase, BlobIDArray& LocalBlobID, bool periodic, int start_id )
 {
     //PROFILE_START("ComputeBlob",1);
-    ASSERT(isPhase.size()==LocalBlobID.size());
+    ASSERT(isPhase.length()==LocalBlobID.length());
     const int Nx = isPhase.size(0);  // maxima for the meshes
     const int Ny = isPhase.size(1);
     const int Nz = isPhase.size(2);
-    std::vector<int> map;
-    map.reserve(128);
-    // Get the list of neighbors we need to check
-    int N_neighbors = 0;
-    int d[26][3];
-    bool include_corners = false;   // Do we need to include cells that only touch at a corder/edge
-    if ( include_corners ) {
-        // Include corners/edges as neighbors, check all cells
-        N_neighbors = 26;
-        const int tmp[26][3] = {{1,0,0},{-1,0,0},{0,1,0},{0,-1,0},{0,0,1},{0,0,-1},
-                                {1,1,0},{1,-1,0},{-1,1,0},{-1,-1,0},{1,0,1},{-1,0,1},
-                                {1,0,-1},{-1,0,-1},{0,1,1},{0,-1,1},{0,1,-1},{0,-1,-1},
-                                {1,1,1},{1,1,-1},{1,-1,1},{1,-1,-1},{-1,1,1},{-1,1,-1},
-                                {-1,-1,1},{-1,-1,-1}};   // directions to neighbors
-        memcpy(d,tmp,sizeof(tmp));
-    } else {
-        // Do not include corners/edges as neighbors
-        if ( periodic ) {
-            // Include all neighbors for periodic problems
-            N_neighbors = 6;
-            const int tmp[6][3] = {{1,0,0},{-1,0,0},{0,1,0},{0,-1,0},{0,0,1},{0,0,-1}};   // directions to neighbors
-            memcpy(d,tmp,sizeof(tmp));
-        } else {
-            // We only need to include the lower neighbors for non-periodic problems
-            N_neighbors = 3;
-            const int tmp[3][3] = {{-1,0,0},{0,-1,0},{0,0,-1}};   // directions to neighbors
-            memcpy(d,tmp,sizeof(tmp));
+    const int Nxy = Nx*Ny;
+    // Cells only touching at a corner/edge are not neighbors
+    // Split the domain into z-slabs that are labeled concurrently
+    int nthreads = 1;
+    #ifdef USE_OPENMP
+        nthreads = omp_get_max_threads();
+    #endif
+    const int N_slabs = std::max( 1, std::min( Nz, 4*nthreads ) );
+    std::vector<int> slab_start(N_slabs+1);
+    for (int s=0; s<=N_slabs; s++)
+        slab_start[s] = (int) ( ((long long) Nz*s) / N_slabs );
+    std::unique_ptr<std::atomic<int>[]> parent( new std::atomic<int>[(size_t) Nxy*Nz] );
+    std::atomic<int> *P = parent.get();
+    // Label each slab with its lower neighbors in x, y and z.  The mask is read one x-row at a
+    // time (BitMask::row) and the cells are addressed by their linear index
+    #ifdef USE_OPENMP
+        #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int s=0; s<N_slabs; s++) {
+        for (int z=slab_start[s]; z<slab_start[s+1]; z++) {
+            for (int y=0; y<Ny; y++) {
+                const uint64_t *row = isPhase.row(y,z);
+                const uint64_t *row_y = y>0 ? isPhase.row(y-1,z) : nullptr;
+                const uint64_t *row_z = z>slab_start[s] ? isPhase.row(y,z-1) : nullptr;
+                int index = y*Nx + z*Nxy;
+                for (int x=0; x<Nx; x++, index++) {
+                    P[index].store( index, std::memory_order_relaxed );
+                    if ( !BitMask::bit(row,x) )
+                        continue;
+                    // Skip a neighbor already joined to the -x neighbor through a shared face
+                    bool xm = x>0 && BitMask::bit(row,x-1);
+                    if ( xm )
+                        unite<false>( P, index, index-1 );
+                    if ( row_y && BitMask::bit(row_y,x) && !( xm && BitMask::bit(row_y,x-1) ) )
+                        unite<false>( P, index, index-Nx );
+                    if ( row_z && BitMask::bit(row_z,x) && !( xm && BitMask::bit(row_z,x-1) ) )
+                        unite<false>( P, index, index-Nxy );
+                }
+            }
         }
     }
-    // Loop through all the points
-    int last = start_id-1;
-    std::vector<int> neighbor_ids;
-    neighbor_ids.reserve(N_neighbors);
-    const bool *isPhasePtr = isPhase.data();
-    BlobIDType *LocalBlobIDPtr = LocalBlobID.data();
-    for (int z=0; z<Nz; z++) {
+    // Merge across the slab boundaries
+    #ifdef USE_OPENMP
+        #pragma omp parallel for
+    #endif
+    for (int s=1; s<N_slabs; s++) {
+        int z = slab_start[s];
         for (int y=0; y<Ny; y++) {
+            const uint64_t *row = isPhase.row(y,z);
+            const uint64_t *row_z = isPhase.row(y,z-1);
+            int index = y*Nx + z*Nxy;
+            for (int x=0; x<Nx; x++, index++) {
+                if ( BitMask::bit(row,x) && BitMask::bit(row_z,x) )
+                    unite<true>( P, index, index-Nxy );
+            }
+        }
+    }
+    // Merge across the periodic boundaries
+    if ( periodic ) {
+        #ifdef USE_OPENMP
+            #pragma omp parallel for
+        #endif
+        for (int z=0; z<Nz; z++) {
+            for (int y=0; y<Ny; y++) {
+                const uint64_t *row = isPhase.row(y,z);
+                int i0 = y*Nx + z*Nxy;
+                if ( Nx>1 && BitMask::bit(row,0) && BitMask::bit(row,Nx-1) )
+                    unite<true>( P, i0, i0+Nx-1 );
+            }
+            const uint64_t *row0 = isPhase.row(0,z);
+            const uint64_t *row1 = isPhase.row(Ny-1,z);
             for (int x=0; x<Nx; x++) {
-                int index = x + y*Nx + z*Nx*Ny;
-                if ( !isPhasePtr[index] )
-                    continue;
-                // Get all neighbor indicies
-                int N_list=0, neighbor_ids[26];
-                for (int p=0; p<N_neighbors; p++) {
-                    // Get the neighbor index
-                    int x2 = x+d[p][0];
-                    int y2 = y+d[p][1];
-                    int z2 = z+d[p][2];
-                    if ( periodic ) {
-                        x2 = x2<0 ? Nx-1:x2;         // Periodic BC for x
-                        x2 = x2>Nx-1 ? 0:x2;
-                        y2 = y2<0 ? Ny-1:y2;         // Periodic BC for x
-                        y2 = y2>Ny-1 ? 0:y2;
-                        z2 = z2<0 ? Nz-1:z2;         // Periodic BC for x
-                        z2 = z2>Nz-1 ? 0:z2;
-                    } else {
-                        if ( x2<0 || x2>=Nx || y2<0 || y2>=Ny || z2<0 || z2>=Nz )
-                            continue;
-                    }
-                    // Check if a neighbor has a known blob id
-                    size_t index2 = x2 + y2*Nx + z2*Nx*Ny;
-                    int id = LocalBlobIDPtr[index2];
-                    if ( !isPhasePtr[index2] || id<0 )
-                        continue;
-                    neighbor_ids[N_list] = id;
-                    N_list++;
-                }
-                if ( N_list==0 ) {
-                    // No neighbors with a blob id, create a new one
-                    LocalBlobIDPtr[index] = last+1;
-                    map.push_back(last+1);
-                    last++;
-                } else if ( N_list==1 ) {
-                    // We have one neighbor
-                    LocalBlobIDPtr[index] = neighbor_ids[0];
-                } else {
-                    // We have multiple neighbors
-                    int id = neighbor_ids[0];
-                    for (int i=1; i<N_list; i++)
-                        id = std::min(id,neighbor_ids[i]);
-                    LocalBlobIDPtr[index] = id;
-                    for (int i=0; i<N_list; i++)
-                        map[neighbor_ids[i]-start_id] = std::min(map[neighbor_ids[i]-start_id],id);
+                int i0 = x + z*Nxy;
+                if ( Ny>1 && BitMask::bit(row0,x) && BitMask::bit(row1,x) )
+                    unite<true>( P, i0, i0+(Ny-1)*Nx );
+            }
+        }
+        #ifdef USE_OPENMP
+            #pragma omp parallel for
+        #endif
+        for (int y=0; y<Ny; y++) {
+            const uint64_t *row0 = isPhase.row(y,0);
+            const uint64_t *row1 = isPhase.row(y,Nz-1);
+            for (int x=0; x<Nx; x++) {
+                int i0 = x + y*Nx;
+                if ( Nz>1 && BitMask::bit(row0,x) && BitMask::bit(row1,x) )
+                    unite<true>( P, i0, i0+(Nz-1)*Nxy );
+            }
+        }
+    }
+    // Number the roots in the order they are first reached (the root is the first cell of each blob)
+    BlobIDType *LocalBlobIDPtr = LocalBlobID.data();
+    std::vector<int> slab_count(N_slabs+1,0);
+    #ifdef USE_OPENMP
+        #pragma omp parallel for
+    #endif
+    for (int s=0; s<N_slabs; s++) {
+        int count = 0;
+        for (int z=slab_start[s]; z<slab_start[s+1]; z++) {
+            for (int y=0; y<Ny; y++) {
+                const uint64_t *row = isPhase.row(y,z);
+                int index = y*Nx + z*Nxy;
+                for (int x=0; x<Nx; x++, index++) {
+                    if ( BitMask::bit(row,x) && P[index].load( std::memory_order_relaxed ) == index )
+                        count++;
                 }
             }
         }
+        slab_count[s+1] = count;
     }
-    // Collapse the ids that map to another id
-    last = start_id-1;
-    for (int i=0; i<(int)map.size(); i++) {
-        if ( map[i] == i+start_id ) {
-            map[i] = last+1;
-            last++;
-        } else {
-            ASSERT(map[i]<i+start_id);
-            map[i] = map[map[i]-start_id];
+    for (int s=0; s<N_slabs; s++)
+        slab_count[s+1] += slab_count[s];
+    #ifdef USE_OPENMP
+        #pragma omp parallel for
+    #endif
+    for (int s=0; s<N_slabs; s++) {
+        int id = start_id + slab_count[s];
+        for (int z=slab_start[s]; z<slab_start[s+1]; z++) {
+            for (int y=0; y<Ny; y++) {
+                const uint64_t *row = isPhase.row(y,z);
+                int index = y*Nx + z*Nxy;
+                for (int x=0; x<Nx; x++, index++) {
+                    if ( BitMask::bit(row,x) && P[index].load( std::memory_order_relaxed ) == index )
+                        LocalBlobIDPtr[index] = id++;
+                }
+            }
         }
     }
-    for (int i=0; i<Nx*Ny*Nz; i++) {
-        if ( isPhasePtr[i] ) {
-            LocalBlobIDPtr[i] = map[LocalBlobIDPtr[i]-start_id];
+    // Copy the root ids to the rest of the blob
+    #ifdef USE_OPENMP
+        #pragma omp parallel for
+    #endif
+    for (int z=0; z<Nz; z++) {
+        for (int y=0; y<Ny; y++) {
+            const uint64_t *row = isPhase.row(y,z);
+            int index = y*Nx + z*Nxy;
+            for (int x=0; x<Nx; x++, index++) {
+                if ( !BitMask::bit(row,x) )
+                    continue;
+                int root = findRoot<false>( P, index );
+                if ( root != index )
+                    LocalBlobIDPtr[index] = LocalBlobIDPtr[root];
+            }
         }
     }
     //PROFILE_STOP("ComputeBlob",1);
-    return last-start_id+1;
+    return slab_count[N_slabs];
 }
 
 
@@ -159,16 +251,18 @@ int ComputeLocalBlobIDs( const DoubleArray& Phase, const DoubleArray& SignDist,
     LocalBlobID.resize(Nx,Ny,Nz);
     // Compute the local blob ids
     size_t N = Nx*Ny*Nz;
-    Array<bool> isPhase(Nx,Ny,Nz);
-    memset(isPhase.data(),0,Nx*Ny*Nz*sizeof(bool));
-    for (size_t i=0; i<N; i++) {
-        if ( SignDist(i) <= vS) {
-            // Solid phase 
-            LocalBlobID(i) = -2;
-        } else {
-            LocalBlobID(i) = -1;
-            if ( Phase(i)>vF && SignDist(i)>vS )
-                isPhase(i) = true;
+    BitMask isPhase(Nx,Ny,Nz);
+    for (size_t i=0; i<N; i++)
+        LocalBlobID(i) = SignDist(i) <= vS ? -2:-1;     // solid phase is -2
+    const double *PhasePtr = Phase.data();
+    const double *DistPtr = SignDist.data();
+    for (size_t k=0; k<Nz; k++) {
+        for (size_t j=0; j<Ny; j++) {
+            for (size_t i=0; i<Nx; i++) {
+                size_t n = i + j*Nx + k*Nx*Ny;
+                if ( PhasePtr[n]>vF && DistPtr[n]>vS )
+                    isPhase.set(i,j,k);
+            }
         }
     }
     int nblobs = ComputeBlob( isPhase, LocalBlobID, periodic, 0 );
@@ -184,16 +278,10 @@ int ComputeLocalPhaseComponent(const IntArray &PhaseID, int &VALUE, BlobIDArray
     size_t N = Nx*Ny*Nz;
     // Compute the local blob ids
     ComponentLabel.resize(Nx,Ny,Nz);
-    Array<bool> isPhase(Nx,Ny,Nz);
-    for (size_t i=0; i<N; i++) {
-        if ( PhaseID(i) == VALUE) {
-            ComponentLabel(i) = -1;
-            isPhase(i) = true;
-        } else{
-            ComponentLabel(i) = -2;
-            isPhase(i) = false;
-        }
-    }
+    BitMask isPhase(Nx,Ny,Nz);
+    isPhase.assign( PhaseID.data(), [VALUE]( int id ) { return id == VALUE; } );
+    for (size_t i=0; i<N; i++)
+        ComponentLabel(i) = PhaseID(i) == VALUE ? -1:-2;
     int ncomponents = ComputeBlob( isPhase, ComponentLabel, periodic, 0 );
     //PROFILE_STOP("ComputeLocalPhaseComponent");
     return ncomponents;
@@ -264,65 +352,81 @@ void ReorderBlobIDs( BlobIDArray& ID, MPI_Comm comm )
 /******************************************************************
 * Compute the global blob ids                                     *
 ******************************************************************/
-struct global_id_info_struct {
-    int64_t new_id;
-    std::set<int64_t> remote_ids;
-};
-// Send the local ids and their new value to all neighbors
-static void updateRemoteIds( 
-    const std::map<int64_t,global_id_info_struct>& map,
-    const std::vector<int>& neighbors,
-    int N_send, const std::vector<int>& N_recv,
-    int64_t *send_buf, std::vector<int64_t*>& recv_buf,
-    std::map<int64_t,int64_t>& remote_map,
-    MPI_Comm comm )
+// Union-find over the global ids: only non-root ids are stored, each set is rooted at its smallest id
+typedef std::map<int64_t,int64_t> global_id_map;
+static inline int64_t findGlobalRoot( global_id_map& parent, int64_t id )
 {
-    std::vector<MPI_Request> send_req(neighbors.size());
-    std::vector<MPI_Request> recv_req(neighbors.size());
-    std::vector<MPI_Status> status(neighbors.size());
-    std::map<int64_t,global_id_info_struct>::const_iterator it = map.begin();
-    ASSERT(N_send==(int)map.size());
-    for (size_t i=0; i<map.size(); i++, ++it) {
-        send_buf[2*i+0] = it->first;
-        send_buf[2*i+1] = it->second.new_id;
-    }
-    for (size_t i=0; i<neighbors.size(); i++) {
-        MPI_Isend( send_buf,    2*N_send,    MPI_LONG_LONG, neighbors[i], 0, comm, &send_req[i] );
-        MPI_Irecv( recv_buf[i], 2*N_recv[i], MPI_LONG_LONG, neighbors[i], 0, comm, &recv_req[i] );
-    }
-    for (it=map.begin(); it!=map.end(); ++it) {
-        remote_map[it->first] = it->second.new_id;
-    }
-    for (size_t i=0; i<neighbors.size(); i++) {
-        MPI_Wait(&recv_req[i],&status[i]);
-        for (int j=0; j<N_recv[i]; j++)
-            remote_map[recv_buf[i][2*j+0]] = recv_buf[i][2*j+1];
-    }
-    MPI_Waitall(neighbors.size(),getPtr(send_req),getPtr(status));
-}
-// Compute a new local id for each local id
-static bool updateLocalIds( const std::map<int64_t,int64_t>& remote_map, 
-    std::map<int64_t,global_id_info_struct>& map )
+    global_id_map::iterator it = parent.find(id);
+    if ( it == parent.end() )
+        return id;
+    int64_t root = findGlobalRoot( parent, it->second );
+    it->second = root;
+    return root;
+}
+static inline void uniteGlobal( global_id_map& parent, int64_t id1, int64_t id2 )
 {
-    bool changed = false;
-    std::map<int64_t,global_id_info_struct>::iterator it;
-    for (it=map.begin(); it!=map.end(); ++it) {
-        int64_t id = it->second.new_id;
-        std::set<int64_t>::const_iterator it2;
-        for (it2=it->second.remote_ids.begin(); it2!=it->second.remote_ids.end(); ++it2) {
-            int64_t id2 = remote_map.find(*it2)->second;
-            id = std::min(id,id2);
-        }
-        changed = changed || it->second.new_id!=id;
-        it->second.new_id = id;
+    int64_t root1 = findGlobalRoot( parent, id1 );
+    int64_t root2 = findGlobalRoot( parent, id2 );
+    if ( root1 < root2 )
+        parent[root2] = root1;
+    else if ( root2 < root1 )
+        parent[root1] = root2;
+}
+// Send the (id,root) pairs with an id in [id0,id1)
+static void sendGlobalIds( global_id_map& parent, int64_t id0, int64_t id1, int dest, MPI_Comm comm )
+{
+    std::vector<int64_t> buf;
+    for (global_id_map::iterator it=parent.lower_bound(id0); it!=parent.end() && it->first<id1; ++it) {
+        buf.push_back( it->first );
+        buf.push_back( findGlobalRoot( parent, it->first ) );
+    }
+    MPI_Send( getPtr(buf), buf.size(), MPI_LONG_LONG, dest, 0, comm );
+}
+static std::vector<int64_t> recvGlobalIds( int source, MPI_Comm comm )
+{
+    MPI_Status status;
+    MPI_Probe( source, 0, comm, &status );
+    int count = 0;
+    MPI_Get_count( &status, MPI_LONG_LONG, &count );
+    std::vector<int64_t> buf(count);
+    MPI_Recv( getPtr(buf), count, MPI_LONG_LONG, source, 0, comm, &status );
+    return buf;
+}
+// Resolve the id equivalences with a binomial tree: merge the children's equivalences
+// up to rank 0, then send each subtree only the final roots for its own (contiguous) id range
+static void resolveGlobalIds( global_id_map& parent, const std::vector<int64_t>& id_offset, MPI_Comm comm )
+{
+    const int rank = comm_rank(comm);
+    const int nprocs = comm_size(comm);
+    int level = 1;
+    while ( level < nprocs && !( rank & level ) )
+        level <<= 1;
+    // Reduce
+    for (int step=1; step<level; step<<=1) {
+        if ( rank+step >= nprocs )
+            continue;
+        std::vector<int64_t> buf = recvGlobalIds( rank+step, comm );
+        for (size_t i=0; i<buf.size(); i+=2)
+            uniteGlobal( parent, buf[i], buf[i+1] );
+    }
+    if ( rank != 0 ) {
+        sendGlobalIds( parent, 0, id_offset[nprocs], rank-level, comm );
+        parent.clear();
+        std::vector<int64_t> buf = recvGlobalIds( rank-level, comm );
+        for (size_t i=0; i<buf.size(); i+=2)
+            parent[buf[i]] = buf[i+1];
+    }
+    // Broadcast the relabel table back down the tree
+    for (int step=level>>1; step>0; step>>=1) {
+        if ( rank+step < nprocs )
+            sendGlobalIds( parent, id_offset[rank+step], id_offset[std::min(rank+2*step,nprocs)], rank+step, comm );
     }
-    return changed;
 }
 static int LocalToGlobalIDs( int nx, int ny, int nz, const RankInfoStruct& rank_info, 
     int nblobs, BlobIDArray& IDs, MPI_Comm comm )
 {
     //PROFILE_START("LocalToGlobalIDs",1);
-    const int rank = rank_info.rank[1][1][1];
+    const int rank = comm_rank(comm);
     int nprocs = comm_size(comm);
     const int ngx = (IDs.size(0)-nx)/2;
     const int ngy = (IDs.size(1)-ny)/2;
@@ -332,12 +436,11 @@ static int LocalToGlobalIDs( int nx, int ny, int nz, const RankInfoStruct& rank_
     //PROFILE_START("LocalToGlobalIDs-Allgather",1);
     MPI_Allgather(&nblobs,1,MPI_INT,getPtr(N_blobs),1,MPI_INT,comm);
     //PROFILE_STOP("LocalToGlobalIDs-Allgather",1);
-    int64_t N_blobs_tot = 0;
-    int offset = 0;
-    for (int i=0; i<rank; i++)
-        offset += N_blobs[i];
+    std::vector<int64_t> id_offset(nprocs+1,0);
     for (int i=0; i<nprocs; i++)
-        N_blobs_tot += N_blobs[i];
+        id_offset[i+1] = id_offset[i] + N_blobs[i];
+    int64_t N_blobs_tot = id_offset[nprocs];
+    int offset = id_offset[rank];
     INSIST(N_blobs_tot<0x80000000,"Maximum number of blobs exceeded");
     // Compute temporary global ids
     for (size_t i=0; i<IDs.length(); i++) {
@@ -348,85 +451,27 @@ static int LocalToGlobalIDs( int nx, int ny, int nz, const RankInfoStruct& rank_
     // Copy the ids and get the neighbors through the halos
     fillHalo<BlobIDType> fillData(comm,rank_info,{nx,ny,nz},{1,1,1},0,1,{true,true,true});
     fillData.fill(IDs);
-    // Create a list of all neighbor ranks (excluding self)
-    std::vector<int> neighbors;
-    neighbors.push_back( rank_info.rank[0][1][1] );
-    neighbors.push_back( rank_info.rank[2][1][1] );
-    neighbors.push_back( rank_info.rank[1][0][1] );
-    neighbors.push_back( rank_info.rank[1][2][1] );
-    neighbors.push_back( rank_info.rank[1][1][0] );
-    neighbors.push_back( rank_info.rank[1][1][2] );
-    std::sort( neighbors.begin(), neighbors.end() );
-    neighbors.erase( std::unique( neighbors.begin(), neighbors.end() ), neighbors.end() );
-    // Create a map of all local ids to the neighbor ids
-    std::map<int64_t,global_id_info_struct> map;
-    std::set<int64_t> local;
+    // Collect the equivalences between the local ids and the neighbor ids
+    std::vector<std::pair<int64_t,int64_t> > pairs;
     for (size_t i=0; i<LocalIDs.length(); i++) {
-        if ( LocalIDs(i)>=0 ) {
-            local.insert(LocalIDs(i));
-            if ( LocalIDs(i)!=IDs(i) && IDs(i)>=0 )
-                map[LocalIDs(i)].remote_ids.insert(IDs(i));
-        }
-    }
-    std::map<int64_t,global_id_info_struct>::iterator it;
-    for (it=map.begin(); it!=map.end(); ++it) {
-        it->second.new_id = it->first;
-        local.erase(it->first);
-    }
-    // Get the number of ids we will recieve from each rank
-    int N_send = map.size();
-    std::vector<int> N_recv(neighbors.size(),0);
-    std::vector<MPI_Request> send_req(neighbors.size());
-    std::vector<MPI_Request> recv_req(neighbors.size());
-    std::vector<MPI_Status> status(neighbors.size());
-    for (size_t i=0; i<neighbors.size(); i++) {
-        MPI_Isend( &N_send,    1, MPI_INT, neighbors[i], 0, comm, &send_req[i] );
-        MPI_Irecv( &N_recv[i], 1, MPI_INT, neighbors[i], 0, comm, &recv_req[i] );
-    }
-    MPI_Waitall(neighbors.size(),getPtr(send_req),getPtr(status));
-    MPI_Waitall(neighbors.size(),getPtr(recv_req),getPtr(status));
-    // Allocate memory for communication
-    int64_t *send_buf = new int64_t[2*N_send];
-    std::vector<int64_t*> recv_buf(neighbors.size());
-    for (size_t i=0; i<neighbors.size(); i++)
-        recv_buf[i] = new int64_t[2*N_recv[i]];
-    // Compute a map for the remote ids, and new local id for each id
-    std::map<int64_t,int64_t> remote_map;
-    for (it=map.begin(); it!=map.end(); ++it) {
-        int64_t id = it->first;
-        std::set<int64_t>::const_iterator it2;
-        for (it2=it->second.remote_ids.begin(); it2!=it->second.remote_ids.end(); ++it2) {
-            int64_t id2 = *it2;
-            id = std::min(id,id2);
-            remote_map.insert(std::pair<int64_t,int64_t>(id2,id2));
-        }
-        it->second.new_id = id;
-    }
-    // Iterate until we are done
-    int iteration = 1;
-    //PROFILE_START("LocalToGlobalIDs-loop",1);
-    while ( 1 ) {
-        iteration++;
-        // Send the local ids and their new value to all neighbors
-        updateRemoteIds( map, neighbors, N_send, N_recv,send_buf, recv_buf, remote_map, comm );
-        // Compute a new local id for each local id
-        bool changed = updateLocalIds( remote_map, map );
-        // Check if we are finished
-        int test = changed ? 1:0;
-        int result = 0;
-        MPI_Allreduce(&test,&result,1,MPI_INT,MPI_SUM,comm);
-        if ( result==0 )
-            break;
-    }
-    //PROFILE_STOP("LocalToGlobalIDs-loop",1);
+        if ( LocalIDs(i)>=0 && IDs(i)>=0 && LocalIDs(i)!=IDs(i) )
+            pairs.push_back( std::pair<int64_t,int64_t>(LocalIDs(i),IDs(i)) );
+    }
+    std::sort( pairs.begin(), pairs.end() );
+    pairs.erase( std::unique( pairs.begin(), pairs.end() ), pairs.end() );
+    global_id_map parent;
+    for (size_t i=0; i<pairs.size(); i++)
+        uniteGlobal( parent, pairs[i].first, pairs[i].second );
+    // Resolve the equivalences across all ranks (each blob takes the smallest id it touches)
+    //PROFILE_START("LocalToGlobalIDs-resolve",1);
+    resolveGlobalIds( parent, id_offset, comm );
+    //PROFILE_STOP("LocalToGlobalIDs-resolve",1);
     // Relabel the ids
-    std::vector<int> final_map(nblobs,-1);
-    for (it=map.begin(); it!=map.end(); ++it)
-        final_map[it->first-offset] = it->second.new_id;
-    for (std::set<int64_t>::const_iterator it2=local.begin(); it2!=local.end(); ++it2)
-        final_map[*it2-offset] = *it2;
-    for (size_t i=0; i<final_map.size(); i++)
-        ASSERT(final_map[i]>=0);
+    std::vector<int> final_map(nblobs);
+    for (int i=0; i<nblobs; i++)
+        final_map[i] = offset+i;
+    for (global_id_map::iterator it=parent.lower_bound(offset); it!=parent.end() && it->first<offset+nblobs; ++it)
+        final_map[it->first-offset] = findGlobalRoot( parent, it->first );
     for (size_t k=ngz; k<IDs.size(2)-ngz; k++) {
         for (size_t j=ngy; j<IDs.size(1)-ngy; j++) {
             for (size_t i=ngx; i<IDs.size(0)-ngx; i++) {
@@ -442,9 +487,6 @@ static int LocalToGlobalIDs( int nx, int ny, int nz, const RankInfoStruct& rank_
     // Reorder based on size (and compress the id space
     int N_blobs_global = ReorderBlobIDs2(IDs,N_blobs_tot,ngx,ngy,ngz,comm);
     // Finished
-    delete [] send_buf;
-    for (size_t i=0; i<neighbors.size(); i++)
-        delete [] recv_buf[i];
     //PROFILE_STOP("LocalToGlobalIDs",1);
     return N_blobs_global;
 }
@@ -552,43 +594,10 @@ void addSrcDstIDs( BlobIDType src_id, map_type& src_map, map_type& dst_map,
             addSrcDstIDs(it->first,dst_map,src_map,dst,src);
     }
 }
-ID_map_struct computeIDMap( int nx, int ny, int nz, 
-    const BlobIDArray& ID1, const BlobIDArray& ID2, MPI_Comm comm )
+// Classify the mapping from the global src/dst ids and the overlaps (src_map is consumed)
+static ID_map_struct buildIDMap( const std::set<BlobIDType>& src_set,
+    const std::set<BlobIDType>& dst_set, map_type& src_map )
 {
-    ASSERT(ID1.size()==ID2.size());
-    //PROFILE_START("computeIDMap");
-    const int ngx = (ID1.size(0)-nx)/2;
-    const int ngy = (ID1.size(1)-ny)/2;
-    const int ngz = (ID1.size(2)-nz)/2;
-
-    // Get a global list of all src/dst ids and the src map for each local blob
-    std::set<BlobIDType> src_set, dst_set;
-    map_type src_map;   // Map of the src ids for each dst id
-    for (int k=ngz; k<ngz+nz; k++) {
-        for (int j=ngy; j<ngy+ny; j++) {
-            for (int i=ngx; i<ngx+nx; i++) {
-                int id1 = ID1(i,j,k);
-                int id2 = ID2(i,j,k);
-                if ( id1>=0 )
-                    src_set.insert(id1);
-                if ( id2>=0 )
-                    dst_set.insert(id2);
-                if ( id1>=0 && id2>=0 ) {
-                    std::map<BlobIDType,int64_t>& src_ids = src_map[id2];
-                    std::map<BlobIDType,int64_t>::iterator it = src_ids.find(id1);
-                    if ( it == src_ids.end() ) {
-                        src_ids.insert(std::pair<BlobIDType,int64_t>(id1,0));
-                        it = src_ids.find(id1);
-                    }
-                    it->second++;
-                }
-            }
-        }
-    }
-    // Communicate the src/dst ids and src id map to all processors and reduce
-    gatherSet( src_set, comm );
-    gatherSet( dst_set, comm );
-    gatherSrcIDMap( src_map, comm );
     // Compute the dst id map
     map_type dst_map;   // Map of the dst ids for each src id
     for (map_type::const_iterator it=src_map.begin(); it!=src_map.end(); ++it) {
@@ -665,7 +674,57 @@ ID_map_struct computeIDMap( int nx, int ny, int nz,
             src_map.erase(*it);
     }
     ASSERT(src_map.empty());
+    return id_map;
+}
+ID_map_struct computeIDMap( int nx, int ny, int nz, 
+    const BlobIDArray& ID1, const BlobIDArray& ID2, MPI_Comm comm )
+{
+    ASSERT(ID1.size()==ID2.size());
+    //PROFILE_START("computeIDMap");
+    const int ngx = (ID1.size(0)-nx)/2;
+    const int ngy = (ID1.size(1)-ny)/2;
+    const int ngz = (ID1.size(2)-nz)/2;
 
+    // Get a global list of all src/dst ids and the src map for each local blob
+    std::set<BlobIDType> src_set, dst_set;
+    map_type src_map;   // Map of the src ids for each dst id
+    // Neighboring cells usually share their ids: count runs of the same (id1,id2)
+    // and only update the sets/maps when the pair changes
+    int last_id1 = -1, last_id2 = -1;
+    int64_t run = 0;
+    auto flush = [&]() {
+        if ( run == 0 )
+            return;
+        if ( last_id1>=0 )
+            src_set.insert(last_id1);
+        if ( last_id2>=0 )
+            dst_set.insert(last_id2);
+        if ( last_id1>=0 && last_id2>=0 )
+            src_map[last_id2][last_id1] += run;
+        run = 0;
+    };
+    for (int k=ngz; k<ngz+nz; k++) {
+        for (int j=ngy; j<ngy+ny; j++) {
+            for (int i=ngx; i<ngx+nx; i++) {
+                int id1 = ID1(i,j,k);
+                int id2 = ID2(i,j,k);
+                if ( id1<0 && id2<0 )
+                    continue;
+                if ( id1!=last_id1 || id2!=last_id2 ) {
+                    flush();
+                    last_id1 = id1;
+                    last_id2 = id2;
+                }
+                run++;
+            }
+        }
+    }
+    flush();
+    // Communicate the src/dst ids and src id map to all processors and reduce
+    gatherSet( src_set, comm );
+    gatherSet( dst_set, comm );
+    gatherSrcIDMap( src_map, comm );
+    ID_map_struct id_map = buildIDMap( src_set, dst_set, src_map );
     //PROFILE_STOP("computeIDMap");
     return id_map;
 }
@@ -848,3 +907,387 @@ void writeIDMap( const ID_map_struct& map, long long int timestep, const std::st
     fclose(fid);
 }
 
+
+
+/******************************************************************
+* Track the blobs between analysis steps                          *
+******************************************************************/
+// Concatenate the values of all ranks (in rank order)
+static std::vector<int64_t> gatherValues( const std::vector<int64_t>& send_data, MPI_Comm comm )
+{
+    int nprocs = comm_size(comm);
+    MPI_Datatype type = getMPIType<int64_t>();
+    int send_count = send_data.size();
+    std::vector<int> recv_count(nprocs,0), recv_disp(nprocs,0);
+    MPI_Allgather(&send_count,1,MPI_INT,getPtr(recv_count),1,MPI_INT,comm);
+    for (int i=1; i<nprocs; i++)
+        recv_disp[i] = recv_disp[i-1] + recv_count[i-1];
+    std::vector<int64_t> recv_data(recv_disp[nprocs-1]+recv_count[nprocs-1]);
+    MPI_Allgatherv(getPtr(send_data),send_count,type,
+        getPtr(recv_data),getPtr(recv_count),getPtr(recv_disp),type,comm);
+    return recv_data;
+}
+// Box of cells [lo,hi) of the local array (ghosts included)
+struct BlobBox {
+    int lo[3] = { 0, 0, 0 };
+    int hi[3] = { 0, 0, 0 };
+    inline bool empty() const { return hi[0] <= lo[0]; }
+    inline int size( int d ) const { return hi[d] - lo[d]; }
+    // Add an interior cell together with its neighbors
+    inline void add( int i, int j, int k ) {
+        const int x[3] = { i, j, k };
+        bool first = empty();
+        for (int d=0; d<3; d++) {
+            lo[d] = first ? x[d]-1 : std::min( lo[d], x[d]-1 );
+            hi[d] = first ? x[d]+2 : std::max( hi[d], x[d]+2 );
+        }
+    }
+};
+// Label the phase cells of the box with provisional ids (id0 + the blobs of the lower ranks)
+// Returns the first provisional id of this rank and the links between the provisional ids of
+// the ranks that both labeled a ghost cell (work is -1 outside the boxes and is left that way)
+static int64_t labelBox( const BitMask& mask, const BlobBox& box, int64_t id0, const int n[3],
+    const RankInfoStruct& rank_info, BlobIDArray& work, BlobIDArray& ids, int& nblobs,
+    std::vector<int64_t>& links, MPI_Comm comm )
+{
+    const int rank = comm_rank(comm);
+    const int nprocs = comm_size(comm);
+    const int Nx = mask.size(0);
+    const int Ny = mask.size(1);
+    const int Nz = mask.size(2);
+    nblobs = 0;
+    if ( !box.empty() ) {
+        BitMask boxMask(box.size(0),box.size(1),box.size(2));
+        for (int k=box.lo[2]; k<box.hi[2]; k++) {
+            for (int j=box.lo[1]; j<box.hi[1]; j++) {
+                for (int i=box.lo[0]; i<box.hi[0]; i++)
+                    boxMask.set(i-box.lo[0],j-box.lo[1],k-box.lo[2],mask(i,j,k));
+            }
+        }
+        ids.resize(box.size(0),box.size(1),box.size(2));
+        ids.fill(-1);
+        nblobs = ComputeBlob( boxMask, ids, false, 0 );
+    }
+    std::vector<int> N_blobs(nprocs,0);
+    MPI_Allgather(&nblobs,1,MPI_INT,getPtr(N_blobs),1,MPI_INT,comm);
+    int64_t offset = id0;
+    int64_t N_blobs_tot = id0;
+    for (int i=0; i<nprocs; i++) {
+        offset += i<rank ? N_blobs[i]:0;
+        N_blobs_tot += N_blobs[i];
+    }
+    INSIST(N_blobs_tot<0x80000000,"Maximum number of blobs exceeded");
+    for (size_t i=0; i<ids.length() && !box.empty(); i++) {
+        if ( ids(i) >= 0 )
+            ids(i) += offset;
+    }
+    // Exchange the provisional ids of the interior cells through the ghost cells (an empty box loops over nothing)
+    for (int k=box.lo[2]; k<box.hi[2]; k++) {
+        for (int j=box.lo[1]; j<box.hi[1]; j++) {
+            for (int i=box.lo[0]; i<box.hi[0]; i++) {
+                bool interior = i>0 && i<Nx-1 && j>0 && j<Ny-1 && k>0 && k<Nz-1;
+                work(i,j,k) = interior ? ids(i-box.lo[0],j-box.lo[1],k-box.lo[2]) : -1;
+            }
+        }
+    }
+    fillHalo<BlobIDType> fillData(comm,rank_info,{n[0],n[1],n[2]},{1,1,1},0,1,{true,true,true});
+    fillData.fill(work);
+    std::set<std::pair<int64_t,int64_t> > pairs;
+    links.clear();
+    for (int k=box.lo[2]; k<box.hi[2]; k++) {
+        for (int j=box.lo[1]; j<box.hi[1]; j++) {
+            for (int i=box.lo[0]; i<box.hi[0]; i++) {
+                bool interior = i>0 && i<Nx-1 && j>0 && j<Ny-1 && k>0 && k<Nz-1;
+                BlobIDType id = ids(i-box.lo[0],j-box.lo[1],k-box.lo[2]);
+                if ( !interior && id>=0 && work(i,j,k)>=0 && work(i,j,k)!=id )
+                    pairs.insert( std::pair<int64_t,int64_t>(id,work(i,j,k)) );
+                work(i,j,k) = -1;
+            }
+        }
+    }
+    for (std::set<std::pair<int64_t,int64_t> >::const_iterator it=pairs.begin(); it!=pairs.end(); ++it) {
+        links.push_back( it->first );
+        links.push_back( it->second );
+    }
+    return offset;
+}
+BlobTracker::BlobTracker( int nx, int ny, int nz, const RankInfoStruct& rank_info, MPI_Comm comm ):
+    d_rank_info(rank_info), d_comm(comm), d_id_max(-1), d_relabeled(0)
+{
+    d_n[0] = nx;
+    d_n[1] = ny;
+    d_n[2] = nz;
+}
+BlobIDType BlobTracker::largest() const
+{
+    BlobIDType id = -1;
+    int64_t size = -1;
+    for (std::map<BlobIDType,int64_t>::const_iterator it=d_size.begin(); it!=d_size.end(); ++it) {
+        if ( it->second > size ) {
+            id = it->first;
+            size = it->second;
+        }
+    }
+    return id;
+}
+const ID_map_struct& BlobTracker::update( const DoubleArray& Phase, const DoubleArray& SignDist, double vF, double vS )
+{
+    //PROFILE_START("BlobTracker::update");
+    ASSERT(SignDist.size()==Phase.size());
+    const int Nx = Phase.size(0);
+    const int Ny = Phase.size(1);
+    const int Nz = Phase.size(2);
+    const int ngx = (Nx-d_n[0])/2;
+    const int ngy = (Ny-d_n[1])/2;
+    const int ngz = (Nz-d_n[2])/2;
+    BitMask mask(Nx,Ny,Nz);
+    for (int k=0; k<Nz; k++) {
+        for (int j=0; j<Ny; j++) {
+            for (int i=0; i<Nx; i++) {
+                if ( Phase(i,j,k)>vF && SignDist(i,j,k)>vS )
+                    mask.set(i,j,k);
+            }
+        }
+    }
+    if ( d_ids.empty() ) {
+        // First update: label everything
+        int nblobs = ComputeLocalBlobIDs(Phase,SignDist,vF,vS,d_ids,false);
+        int N = LocalToGlobalIDs( d_n[0], d_n[1], d_n[2], d_rank_info, nblobs, d_ids, d_comm );
+        std::vector<double> local_size(N,0), global_size(N,0);
+        for (int k=ngz; k<Nz-ngz; k++) {
+            for (int j=ngy; j<Ny-ngy; j++) {
+                for (int i=ngx; i<Nx-ngx; i++) {
+                    if ( d_ids(i,j,k) >= 0 )
+                        local_size[d_ids(i,j,k)]++;
+                }
+            }
+        }
+        MPI_Allreduce(getPtr(local_size),getPtr(global_size),N,MPI_DOUBLE,MPI_SUM,d_comm);
+        d_size.clear();
+        d_relabeled = 0;
+        for (int i=0; i<N; i++) {
+            d_size[i] = global_size[i];
+            d_relabeled += global_size[i];
+        }
+        d_id_max = N-1;
+        d_mask = mask;
+        d_map = ID_map_struct(N);
+        d_work.resize(Nx,Ny,Nz);
+        d_work.fill(-1);
+        //PROFILE_STOP("BlobTracker::update");
+        return d_map;
+    }
+    ASSERT(d_ids.size()==Phase.size());
+    // Find the changed cells (and the box around them) and the blobs that lost a cell
+    BlobBox box;
+    std::set<BlobIDType> lost_set;
+    long long int changed = 0;
+    for (int k=ngz; k<Nz-ngz; k++) {
+        for (int j=ngy; j<Ny-ngy; j++) {
+            for (int i=ngx; i<Nx-ngx; i++) {
+                bool b0 = d_mask(i,j,k);
+                if ( b0 == mask(i,j,k) )
+                    continue;
+                changed++;
+                box.add(i,j,k);
+                if ( b0 )
+                    lost_set.insert(d_ids(i,j,k));
+            }
+        }
+    }
+    long long int changed_global = 0;
+    MPI_Allreduce(&changed,&changed_global,1,MPI_LONG_LONG,MPI_SUM,d_comm);
+    d_map = ID_map_struct();
+    d_relabeled = 0;
+    if ( changed_global == 0 ) {
+        //PROFILE_STOP("BlobTracker::update");
+        return d_map;
+    }
+    gatherSet( lost_set, d_comm );
+    // Label the boxes.  A blob that lost cells is still connected if its remaining cells in the
+    // boxes are connected within the boxes: a path through a removed cell can be rerouted through
+    // the neighbors of the removed cells, which are all in a box.  Otherwise the blob may have
+    // split, and the box grows to cover the whole blob.
+    const BlobIDType id_max = d_id_max;
+    BlobIDArray ids;
+    int nblobs = 0;
+    std::vector<int64_t> links;
+    int64_t offset = labelBox( mask, box, id_max+1, d_n, d_rank_info, d_work, ids, nblobs, links, d_comm );
+    links = gatherValues( links, d_comm );
+    std::set<BlobIDType> split_set;
+    if ( !lost_set.empty() ) {
+        global_id_map parent;
+        for (size_t i=0; i<links.size(); i+=2)
+            uniteGlobal( parent, links[i], links[i+1] );
+        std::set<std::pair<int64_t,int64_t> > lost_pairs;
+        for (int k=box.lo[2]; k<box.hi[2]; k++) {
+            for (int j=box.lo[1]; j<box.hi[1]; j++) {
+                for (int i=box.lo[0]; i<box.hi[0]; i++) {
+                    BlobIDType id = ids(i-box.lo[0],j-box.lo[1],k-box.lo[2]);
+                    if ( id>=0 && d_mask(i,j,k) && lost_set.find(d_ids(i,j,k))!=lost_set.end() )
+                        lost_pairs.insert( std::pair<int64_t,int64_t>(d_ids(i,j,k),id) );
+                }
+            }
+        }
+        std::vector<int64_t> send;
+        for (std::set<std::pair<int64_t,int64_t> >::const_iterator it=lost_pairs.begin(); it!=lost_pairs.end(); ++it) {
+            send.push_back( it->first );
+            send.push_back( it->second );
+        }
+        std::vector<int64_t> recv = gatherValues( send, d_comm );
+        std::map<BlobIDType,std::set<int64_t> > roots;
+        for (size_t i=0; i<recv.size(); i+=2)
+            roots[recv[i]].insert( findGlobalRoot( parent, recv[i+1] ) );
+        for (std::map<BlobIDType,std::set<int64_t> >::const_iterator it=roots.begin(); it!=roots.end(); ++it) {
+            if ( it->second.size() > 1 )
+                split_set.insert( it->first );
+        }
+    }
+    if ( !split_set.empty() ) {
+        std::vector<char> split(id_max+1,0);
+        for (std::set<BlobIDType>::const_iterator it=split_set.begin(); it!=split_set.end(); ++it)
+            split[*it] = 1;
+        for (int k=ngz; k<Nz-ngz; k++) {
+            for (int j=ngy; j<Ny-ngy; j++) {
+                for (int i=ngx; i<Nx-ngx; i++) {
+                    BlobIDType id = d_ids(i,j,k);
+                    if ( d_mask(i,j,k) && split[id] )
+                        box.add(i,j,k);
+                }
+            }
+        }
+        offset = labelBox( mask, box, id_max+1, d_n, d_rank_info, d_work, ids, nblobs, links, d_comm );
+        links = gatherValues( links, d_comm );
+    }
+    // Count the cells of each provisional id by the old id they had (-1 for new cells), and the
+    // cells of the old ids in the boxes (interior cells only, so each cell is counted once)
+    std::map<std::pair<int64_t,int64_t>,int64_t> overlap_local;
+    std::map<BlobIDType,int64_t> inbox_local;
+    for (int k=box.lo[2]; k<box.hi[2]; k++) {
+        for (int j=box.lo[1]; j<box.hi[1]; j++) {
+            for (int i=box.lo[0]; i<box.hi[0]; i++) {
+                bool interior = i>=ngx && i<Nx-ngx && j>=ngy && j<Ny-ngy && k>=ngz && k<Nz-ngz;
+                BlobIDType id = ids(i-box.lo[0],j-box.lo[1],k-box.lo[2]);
+                BlobIDType old_id = d_mask(i,j,k) ? d_ids(i,j,k):-1;
+                if ( id >= 0 )
+                    overlap_local[std::pair<int64_t,int64_t>(id,old_id)] += interior ? 1:0;
+                if ( interior && old_id >= 0 )
+                    inbox_local[old_id]++;
+            }
+        }
+    }
+    std::vector<int64_t> send;
+    for (std::map<std::pair<int64_t,int64_t>,int64_t>::const_iterator it=overlap_local.begin(); it!=overlap_local.end(); ++it) {
+        send.push_back( it->first.first );
+        send.push_back( it->first.second );
+        send.push_back( it->second );
+    }
+    std::vector<int64_t> overlap = gatherValues( send, d_comm );
+    send.clear();
+    for (std::map<BlobIDType,int64_t>::const_iterator it=inbox_local.begin(); it!=inbox_local.end(); ++it) {
+        send.push_back( it->first );
+        send.push_back( it->second );
+    }
+    std::vector<int64_t> recv = gatherValues( send, d_comm );
+    std::map<BlobIDType,int64_t> inbox;
+    for (size_t i=0; i<recv.size(); i+=2)
+        inbox[recv[i]] += recv[i+1];
+    // Resolve the new blobs: the provisional ids connected across the ranks, joined with the old
+    // ids of the cells they contain (the remaining cells of a blob that did not split are connected)
+    global_id_map parent;
+    std::set<BlobIDType> joined;
+    for (size_t i=0; i<links.size(); i+=2)
+        uniteGlobal( parent, links[i], links[i+1] );
+    for (size_t i=0; i<overlap.size(); i+=3) {
+        if ( overlap[i+1] >= 0 && split_set.find(overlap[i+1])==split_set.end() ) {
+            uniteGlobal( parent, overlap[i], overlap[i+1] );
+            joined.insert(overlap[i+1]);
+        }
+    }
+    std::map<int64_t,BlobIDType> dst_index;    // root -> new blob (0:N-1)
+    std::vector<int64_t> new_size;
+    std::set<BlobIDType> src_set, dst_set;
+    map_type src_map;
+    auto getIndex = [&dst_index,&new_size,&parent]( int64_t id ) {
+        int64_t root = findGlobalRoot( parent, id );
+        std::map<int64_t,BlobIDType>::iterator it = dst_index.find(root);
+        if ( it != dst_index.end() )
+            return it->second;
+        BlobIDType index = new_size.size();
+        dst_index.insert( std::pair<int64_t,BlobIDType>(root,index) );
+        new_size.push_back(0);
+        return index;
+    };
+    for (size_t i=0; i<overlap.size(); i+=3) {
+        BlobIDType index = getIndex( overlap[i] );
+        new_size[index] += overlap[i+2];
+        d_relabeled += overlap[i+2];
+        dst_set.insert(index);
+        if ( overlap[i+1] >= 0 ) {
+            src_set.insert(overlap[i+1]);
+            if ( overlap[i+2] > 0 )
+                src_map[index][overlap[i+1]] += overlap[i+2];
+        }
+    }
+    for (std::map<BlobIDType,int64_t>::const_iterator it=inbox.begin(); it!=inbox.end(); ++it)
+        src_set.insert(it->first);
+    // The cells outside the boxes keep their blob
+    std::map<BlobIDType,BlobIDType> outside_index;
+    for (std::set<BlobIDType>::const_iterator it=src_set.begin(); it!=src_set.end(); ++it) {
+        int64_t outside = d_size[*it] - inbox[*it];
+        if ( outside == 0 )
+            continue;
+        INSIST(joined.find(*it)!=joined.end(),"Blob cells outside the labeled boxes were lost");
+        BlobIDType index = getIndex( *it );
+        new_size[index] += outside;
+        src_map[index][*it] += outside;
+        outside_index[*it] = index;
+    }
+    // Assign the persistent ids
+    d_map = buildIDMap( src_set, dst_set, src_map );
+    std::vector<BlobIDType> id_list;
+    getNewIDs( d_map, d_id_max, id_list );
+    // Rename the cells outside the boxes of the old ids that did not keep their id
+    std::vector<BlobIDType> rename;
+    for (std::map<BlobIDType,BlobIDType>::const_iterator it=outside_index.begin(); it!=outside_index.end(); ++it) {
+        if ( id_list[it->second] == it->first )
+            continue;
+        if ( rename.empty() ) {
+            rename.resize(id_max+1);
+            for (BlobIDType i=0; i<=id_max; i++)
+                rename[i] = i;
+        }
+        rename[it->first] = id_list[it->second];
+    }
+    if ( !rename.empty() ) {
+        for (size_t n=0; n<d_ids.length(); n++) {
+            if ( d_ids(n) >= 0 )
+                d_ids(n) = rename[d_ids(n)];
+        }
+    }
+    // Patch the ids in the box and the sizes
+    std::vector<BlobIDType> final_id(nblobs);
+    for (int i=0; i<nblobs; i++)
+        final_id[i] = id_list[getIndex( offset+i )];
+    for (int k=box.lo[2]; k<box.hi[2]; k++) {
+        for (int j=box.lo[1]; j<box.hi[1]; j++) {
+            for (int i=box.lo[0]; i<box.hi[0]; i++) {
+                BlobIDType id = ids(i-box.lo[0],j-box.lo[1],k-box.lo[2]);
+                if ( id >= 0 )
+                    d_ids(i,j,k) = final_id[id-offset];
+                else
+                    d_ids(i,j,k) = SignDist(i,j,k) <= vS ? -2:-1;
+            }
+        }
+    }
+    for (std::set<BlobIDType>::const_iterator it=src_set.begin(); it!=src_set.end(); ++it)
+        d_size.erase(*it);
+    for (size_t i=0; i<new_size.size(); i++)
+        d_size[id_list[i]] = new_size[i];
+    // Fill the ghosts (the boxes of the neighbors)
+    fillHalo<BlobIDType> fillData(d_comm,d_rank_info,{d_n[0],d_n[1],d_n[2]},{1,1,1},0,1,{true,true,true});
+    fillData.fill(d_ids);
+    d_mask = mask;
+    //PROFILE_STOP("BlobTracker::update");
+    return d_map;
+}
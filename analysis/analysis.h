@@ -17,6 +17,7 @@
 #define Analysis_H_INC
 
 #include "common/Array.h"
+#include "common/BitMask.h"
 #include "common/Communication.h"
 
 #include <set>
@@ -29,6 +30,18 @@ typedef int32_t BlobIDType;
 typedef Array<BlobIDType> BlobIDArray;
 
 
+/*!
+ * @brief  Label the connected components of a mask
+ * @details  Compute the face-connected components of the set bits in isPhase.
+ *    Cells in the mask are labeled start_id, start_id+1, ...; other cells are not modified.
+ * @param[in] isPhase       Mask of the cells to label
+ * @param[in/out] LocalBlobID  The ids of the blobs
+ * @param[in] periodic      Is the domain periodic
+ * @param[in] start_id      The first id to assign
+ * @return  Returns the number of blobs
+ */
+int ComputeBlob( const BitMask& isPhase, BlobIDArray& LocalBlobID, bool periodic, int start_id );
+
 /*!
  * @brief  Compute the blob
  * @details  Compute the blob (F>vf|S>vs) starting from (i,j,k) - oil blob
@@ -171,5 +184,67 @@ void renumberIDs( const std::vector<BlobIDType>& new_id_list, BlobIDArray& IDs )
 void writeIDMap( const ID_map_struct& map, long long int timestep, const std::string& filename );
 
 
+/*!
+ * @brief  Track the blobs between analysis steps
+ * @details  Keeps the global blob ids (F>vf|S>vs) and the phase mask of the last update.
+ *    An update only labels the bounding box of the changed cells on each rank (grown by one
+ *    cell).  The labels in the boxes are joined across the ranks and with the ids of the
+ *    unchanged cells they contain, and only the ids and sizes of the blobs that touch a box
+ *    are patched.  A blob that lost cells whose remaining cells are not connected within the
+ *    boxes may have split: its cells are added to the boxes and it is labeled whole.  The ids
+ *    are persistent: a blob keeps its id while it exists (the largest part keeps the id
+ *    after a split or merge) and new blobs get new ids, so ids are not ordered by size.
+ *    The first update labels everything (ids ordered by size, largest first).
+ *    All functions are collective on the communicator.
+ */
+class BlobTracker
+{
+public:
+    /*!
+     * @brief  Create the tracker
+     * @param[in] nx            Number of interior cells in the x-direction
+     * @param[in] ny            Number of interior cells in the y-direction
+     * @param[in] nz            Number of interior cells in the z-direction
+     * @param[in] rank_info     MPI communication info
+     * @param[in] comm          Communicator
+     */
+    BlobTracker( int nx, int ny, int nz, const RankInfoStruct& rank_info, MPI_Comm comm );
+
+    /*!
+     * @brief  Update the blob ids
+     * @return  Returns the map from the ids of the last update to the new ids
+     *    (only the blobs that changed appear in the map)
+     * @param[in] Phase         Phase
+     * @param[in] SignDist      SignDist
+     * @param[in] vF            vF
+     * @param[in] vS            vS
+     */
+    const ID_map_struct& update( const DoubleArray& Phase, const DoubleArray& SignDist, double vF, double vS );
+
+    //! The blob ids (with the ghost cells filled)
+    inline const BlobIDArray& IDs() const { return d_ids; }
+
+    //! Number of blobs
+    inline int count() const { return d_size.size(); }
+
+    //! Id of the largest blob (-1 if there are no blobs)
+    BlobIDType largest() const;
+
+    //! Number of cells (global) that were relabeled by the last update
+    inline int64_t relabeled() const { return d_relabeled; }
+
+private:
+    int d_n[3];
+    RankInfoStruct d_rank_info;
+    MPI_Comm d_comm;
+    BitMask d_mask;                         // phase mask of the last update
+    BlobIDArray d_ids;                      // blob ids of the last update
+    BlobIDArray d_work;                     // provisional ids exchanged with the neighbors (-1 outside the boxes)
+    BlobIDType d_id_max;                    // largest id used so far
+    std::map<BlobIDType,int64_t> d_size;    // global number of cells in each blob
+    ID_map_struct d_map;                    // map of the last update
+    int64_t d_relabeled;
+};
+
 
 #endif
@@ -15,26 +15,524 @@
 */
 #include "analysis/distance.h"
 
+#include <algorithm>
+#include <limits>
+
+
+
+/******************************************************************
+* Fill the ghosts with the nearest interior cell                  *
+******************************************************************/
+template<class TYPE>
+static void fillNearest( Array<TYPE> &A )
+{
+    int Nx = A.size(0);
+    int Ny = A.size(1);
+    int Nz = A.size(2);
+    for (int k=1; k<Nz-1; k++) {
+        for (int j=1; j<Ny-1; j++) {
+            A(0,j,k) = A(1,j,k);
+            A(Nx-1,j,k) = A(Nx-2,j,k);
+        }
+    }
+    for (int k=1; k<Nz-1; k++) {
+        for (int i=0; i<Nx; i++) {
+            A(i,0,k) = A(i,1,k);
+            A(i,Ny-1,k) = A(i,Ny-2,k);
+        }
+    }
+    for (int j=0; j<Ny; j++) {
+        for (int i=0; i<Nx; i++) {
+            A(i,j,0) = A(i,j,1);
+            A(i,j,Nz-1) = A(i,j,Nz-2);
+        }
+    }
+}
+
+
+// Set the ghost faces that border a block without a rank (RankMap) to 0: the skipped
+// blocks are solid, and fillHalo leaves these ghosts unchanged (MPI_PROC_NULL)
+static void fillSkipped( Array<char> &A, const RankInfoStruct &info, const std::array<bool,3>& periodic )
+{
+    std::array<int,3> N = { (int) A.size(0), (int) A.size(1), (int) A.size(2) };
+    std::array<int,3> proc = { info.ix, info.jy, info.kz };
+    std::array<int,3> nproc = { info.nx, info.ny, info.nz };
+    for (int a=0; a<3; a++) {
+        for (int side=0; side<2; side++) {
+            int d[3] = { 1, 1, 1 };
+            d[a] = side==0 ? 0:2;
+            if ( info.rank[d[0]][d[1]][d[2]] != MPI_PROC_NULL )
+                continue;
+            // The outer boundary of a non-periodic direction keeps the nearest cell
+            bool boundary = side==0 ? proc[a]==0 : proc[a]==nproc[a]-1;
+            if ( boundary && !periodic[a] )
+                continue;
+            std::array<int,3> first = { 0, 0, 0 }, last = N;
+            first[a] = side==0 ? 0 : N[a]-1;
+            last[a] = first[a]+1;
+            for (int k=first[2]; k<last[2]; k++) {
+                for (int j=first[1]; j<last[1]; j++) {
+                    for (int i=first[0]; i<last[0]; i++)
+                        A(i,j,k) = 0;
+                }
+            }
+        }
+    }
+}
+
+
+/******************************************************************
+* Exact Euclidean distance transform                              *
+* 1D pass: lower envelope of parabolas (Felzenszwalb/Huttenlocher)*
+* The features of f are located at q+shift                        *
+******************************************************************/
+static void calcExactDist1D( const double *f, double *d, int n, double w2, double shift, int *v, double *z )
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    int k = -1;
+    for (int q=0; q<n; q++) {
+        if ( f[q] == inf )
+            continue;
+        double s = -inf;
+        while ( k >= 0 ) {
+            int p = v[k];
+            s = ( (f[q]+w2*q*q) - (f[p]+w2*p*p) ) / ( 2*w2*(q-p) );
+            if ( s > z[k] )
+                break;
+            k--;
+        }
+        if ( k < 0 )
+            s = -inf;
+        k++;
+        v[k] = q;
+        z[k] = s;
+    }
+    if ( k < 0 ) {
+        for (int q=0; q<n; q++)
+            d[q] = inf;
+        return;
+    }
+    z[k+1] = inf;
+    for (int q=0, j=0; q<n; q++) {
+        double x = q - shift;
+        while ( z[j+1] < x )
+            j++;
+        d[q] = w2*(x-v[j])*(x-v[j]) + f[v[j]];
+    }
+}
+// First pass, where f is 0 on the features and infinity elsewhere
+static void calcExactDist1DBinary( const double *f, double *d, int n, double w2, double shift )
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    double last = -inf;
+    for (int q=0; q<n; q++) {
+        if ( f[q] == 0 )
+            last = q + shift;
+        d[q] = w2*(q-last)*(q-last);
+    }
+    last = inf;
+    for (int q=n-1; q>=0; q--) {
+        if ( f[q] == 0 )
+            last = q + shift;
+        d[q] = std::min( d[q], w2*(last-q)*(last-q) );
+    }
+}
+
+
+/******************************************************************
+* Exact Euclidean distance transform                              *
+* Transform the lines along one axis                              *
+* lower (if given) holds one value per line for the cell below the *
+* first cell; it is used where that cell is in a block without a   *
+* rank, which otherwise only holds gap                             *
+******************************************************************/
+static void calcExactDistAxis( Array<double> &F, int axis, const Domain &Dm, MPI_Comm line_comm,
+    bool periodic, double dx, double gap, double shift, bool binary, double cutoff,
+    const double *lower )
+{
+    // Lines are numbered with the fastest remaining dimension first, so that neighboring
+    // lines are adjacent in memory and are copied in batches
+    const int a = axis;
+    const int b = axis==0 ? 1:0;
+    const int c = axis==2 ? 1:2;
+    const int W = 16;
+    std::array<int,3> n = { (int) F.size(0), (int) F.size(1), (int) F.size(2) };
+    std::array<size_t,3> stride = { 1, (size_t) n[0], (size_t) n[0]*n[1] };
+    std::array<int,3> proc = { Dm.iproc(), Dm.jproc(), Dm.kproc() };
+    std::array<int,3> nproc = { Dm.nprocx(), Dm.nprocy(), Dm.nprocz() };
+    const std::vector<int> &block = a==0 ? Dm.BlockSizeX : ( a==1 ? Dm.BlockSizeY : Dm.BlockSizeZ );
+    const int L = n[a];
+    const int M = n[b]*n[c];
+    auto start = [&]( int line ) { return (line%n[b])*stride[b] + (line/n[b])*stride[c]; };
+    // Copy lines [l0,l1) to or from buf (line l starts at buf[(l-l0)*ld])
+    auto copyLines = [&]( int l0, int l1, double *buf, size_t ld, bool to_buf ) {
+        if ( a == 0 ) {
+            for (int l=l0; l<l1; l++) {
+                double *x = &F(start(l));
+                double *y = &buf[(l-l0)*ld];
+                if ( to_buf ) std::copy( x, x+L, y );
+                else          std::copy( y, y+L, x );
+            }
+            return;
+        }
+        for (int t=0; t<L; t++) {
+            for (int l=l0; l<l1; l++) {
+                double &x = F(start(l)+t*stride[a]);
+                double &y = buf[(l-l0)*ld+t];
+                if ( to_buf ) y = x;
+                else          x = y;
+            }
+        }
+    };
+    std::vector<int> offset(nproc[a]+1,0);
+    for (int p=0; p<nproc[a]; p++)
+        offset[p+1] = offset[p] + block[p];
+    const int Lg = offset[nproc[a]];
+    // Periodic lines are padded by half a period on each side
+    const int pad = periodic ? Lg/2+1 : 0;
+    const int Le = Lg + 2*pad;
+    const double w2 = dx*dx;
+    auto transform = [&]( double *f, double *d, int *v, double *z ) {
+        for (int t=0; t<pad; t++) {
+            f[t] = f[Lg+t];
+            f[pad+Lg+t] = f[pad+t];
+        }
+        if ( binary )
+            calcExactDist1DBinary( f, d, Le, w2, shift );
+        else
+            calcExactDist1D( f, d, Le, w2, shift, v, z );
+        // The distances beyond the cutoff are dropped (fewer parabolas in the next pass)
+        if ( cutoff < std::numeric_limits<double>::infinity() ) {
+            for (int t=0; t<Le; t++)
+                d[t] = d[t] > cutoff ? std::numeric_limits<double>::infinity() : d[t];
+        }
+    };
+    if ( nproc[a] == 1 ) {
+        // The lines are local
+        #ifdef USE_OPENMP
+            #pragma omp parallel
+        #endif
+        {
+            std::vector<double> f((size_t) W*Le), d(Le), z(Le+1);
+            std::vector<int> v(Le);
+            #ifdef USE_OPENMP
+                #pragma omp for
+            #endif
+            for (int l0=0; l0<M; l0+=W) {
+                int l1 = std::min( l0+W, M );
+                copyLines( l0, l1, &f[pad], Le, true );
+                for (int l=l0; l<l1; l++) {
+                    double *x = &f[(l-l0)*Le];
+                    transform( x, d.data(), v.data(), z.data() );
+                    std::copy( &d[pad], &d[pad+L], &x[pad] );
+                }
+                copyLines( l0, l1, &f[pad], Le, false );
+            }
+        }
+        return;
+    }
+    // The ranks that share our lines
+    int Q = 1, me = 0;
+    MPI_Comm_size( line_comm, &Q );
+    MPI_Comm_rank( line_comm, &me );
+    std::vector<int> member_block(Q,proc[a]);
+    MPI_Allgather( &proc[a], 1, MPI_INT, member_block.data(), 1, MPI_INT, line_comm );
+    std::vector<bool> member(nproc[a],false);
+    for (int r=0; r<Q; r++)
+        member[member_block[r]] = true;
+    // Each member transforms the full length of M/Q of the lines.  A segment is the lower
+    // value (if any) followed by the line
+    const int e = lower ? 1:0;
+    const int S = L + e;
+    std::vector<int> first(Q+1);
+    for (int r=0; r<=Q; r++)
+        first[r] = (int) ( ((long long) M*r) / Q );
+    const int m = first[me+1] - first[me];
+    std::vector<int> send_count(Q), send_disp(Q+1,0), recv_count(Q), recv_disp(Q+1,0);
+    for (int r=0; r<Q; r++) {
+        send_count[r] = (first[r+1]-first[r])*S;
+        recv_count[r] = m*(block[member_block[r]]+e);
+        send_disp[r+1] = send_disp[r] + send_count[r];
+        recv_disp[r+1] = recv_disp[r] + recv_count[r];
+    }
+    std::vector<double> send_buf(send_disp[Q]), recv_buf(recv_disp[Q]);
+    #ifdef USE_OPENMP
+        #pragma omp parallel for
+    #endif
+    for (int l0=0; l0<M; l0+=W)
+        copyLines( l0, std::min(l0+W,M), &send_buf[(size_t) l0*S+e], S, true );
+    if ( lower ) {
+        for (int l=0; l<M; l++)
+            send_buf[(size_t) l*S] = lower[l];
+    }
+    MPI_Alltoallv( send_buf.data(), send_count.data(), send_disp.data(), MPI_DOUBLE,
+        recv_buf.data(), recv_count.data(), recv_disp.data(), MPI_DOUBLE, line_comm );
+    #ifdef USE_OPENMP
+        #pragma omp parallel
+    #endif
+    {
+        std::vector<double> f(Le), d(Le), z(Le+1);
+        std::vector<int> v(Le);
+        #ifdef USE_OPENMP
+            #pragma omp for
+        #endif
+        for (int l=0; l<m; l++) {
+            // Blocks without a rank are filled with gap
+            std::fill( f.begin()+pad, f.begin()+pad+Lg, gap );
+            for (int r=0; r<Q; r++) {
+                int len = block[member_block[r]];
+                const double *src = &recv_buf[recv_disp[r]+(size_t) l*(len+e)+e];
+                std::copy( src, src+len, &f[pad+offset[member_block[r]]] );
+            }
+            // The last cell of a block without a rank takes the lower value of the next block
+            for (int r=0; r<Q && lower; r++) {
+                int p = member_block[r];
+                int q = p>0 ? p-1 : ( periodic ? nproc[a]-1 : -1 );
+                if ( q >= 0 && !member[q] ) {
+                    int len = block[p];
+                    double &x = f[pad+offset[q+1]-1];
+                    x = std::min( x, recv_buf[recv_disp[r]+(size_t) l*(len+e)] );
+                }
+            }
+            transform( f.data(), d.data(), v.data(), z.data() );
+            for (int r=0; r<Q; r++) {
+                int len = block[member_block[r]];
+                const double *src = &d[pad+offset[member_block[r]]];
+                std::copy( src, src+len, &recv_buf[recv_disp[r]+(size_t) l*(len+e)+e] );
+            }
+        }
+    }
+    MPI_Alltoallv( recv_buf.data(), recv_count.data(), recv_disp.data(), MPI_DOUBLE,
+        send_buf.data(), send_count.data(), send_disp.data(), MPI_DOUBLE, line_comm );
+    #ifdef USE_OPENMP
+        #pragma omp parallel for
+    #endif
+    for (int l0=0; l0<M; l0+=W)
+        copyLines( l0, std::min(l0+W,M), &send_buf[(size_t) l0*S+e], S, false );
+}
+
+
+/******************************************************************
+* Exact Euclidean distance transform                              *
+******************************************************************/
+static std::array<MPI_Comm,3> createLineComms( const Domain &Dm )
+{
+    // The ranks that share the lines along each axis
+    std::array<MPI_Comm,3> comm = { MPI_COMM_NULL, MPI_COMM_NULL, MPI_COMM_NULL };
+    std::array<int,3> proc = { Dm.iproc(), Dm.jproc(), Dm.kproc() };
+    std::array<int,3> nproc = { Dm.nprocx(), Dm.nprocy(), Dm.nprocz() };
+    for (int a=0; a<3; a++) {
+        int b = a==0 ? 1:0;
+        int c = a==2 ? 1:2;
+        if ( nproc[a] > 1 )
+            MPI_Comm_split( Dm.Comm, proc[b] + proc[c]*nproc[b], proc[a], &comm[a] );
+    }
+    return comm;
+}
+static void freeLineComms( std::array<MPI_Comm,3> &comm )
+{
+    for (int a=0; a<3; a++) {
+        if ( comm[a] != MPI_COMM_NULL )
+            MPI_Comm_free( &comm[a] );
+    }
+}
+// The face axis (if any) is transformed first, so that the lower face values are single features
+static void calcExactDist( Array<double> &F, const Domain &Dm, const std::array<MPI_Comm,3> &line_comm,
+    const std::array<bool,3>& periodic, const std::array<double,3>& dx, double gap, int face,
+    double cutoff = std::numeric_limits<double>::infinity(), const Array<double> *lower = nullptr )
+{
+    std::array<int,3> order = { 0, 1, 2 };
+    if ( face > 0 )
+        std::rotate( order.begin(), order.begin()+face, order.begin()+face+1 );
+    for (int pass=0; pass<3; pass++) {
+        int axis = order[pass];
+        calcExactDistAxis( F, axis, Dm, line_comm[axis], periodic[axis], dx[axis], gap,
+            axis==face ? 0.5:0.0, pass==0, cutoff, axis==face && lower ? lower->data() : nullptr );
+    }
+}
+void calcExactDist( Array<double> &F, const Domain &Dm, const std::array<bool,3>& periodic,
+    const std::array<double,3>& dx, double gap, int face )
+{
+    auto line_comm = createLineComms( Dm );
+    calcExactDist( F, Dm, line_comm, periodic, dx, gap, face );
+    freeLineComms( line_comm );
+}
 
 
 /******************************************************************
-* A fast distance calculation                                     *
+* Signed distance from the exact distance transform              *
 ******************************************************************/
+// id holds the phase (0/1) of the interior cells; the ghosts are filled here
+template<class TYPE>
+static void calcSignedDist( Array<TYPE> &Distance, Array<char> &id, const Domain &Dm,
+    const std::array<bool,3>& periodic, const std::array<double,3>& dx )
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    std::array<int,3> n = { Dm.Nx-2, Dm.Ny-2, Dm.Nz-2 };
+    // Fill the ghosts with the nearest neighbor before communicating them (solid next to
+    // the blocks without a rank)
+    fillNearest( id );
+    fillSkipped( id, Dm.rank_info, periodic );
+    fillHalo<char> fillID( Dm.Comm, Dm.rank_info, n, {1,1,1}, 50, 1, {true,false,false}, periodic );
+    fillID.fill( id );
+    // The interface is made of the faces between cells of different phases.  For each face
+    // orientation transform the distance to the face centers and keep the smallest
+    Array<double> F(n[0],n[1],n[2]), G(n[0],n[1],n[2]);
+    G.fill( inf );
+    auto line_comm = createLineComms( Dm );
+    for (int axis=0; axis<3; axis++) {
+        int di = axis==0 ? 1:0;
+        int dj = axis==1 ? 1:0;
+        int dk = axis==2 ? 1:0;
+        for (int k=0; k<n[2]; k++) {
+            for (int j=0; j<n[1]; j++) {
+                for (int i=0; i<n[0]; i++)
+                    F(i,j,k) = id(i+1,j+1,k+1) != id(i+1+di,j+1+dj,k+1+dk) ? 0:inf;
+            }
+        }
+        // The face below the first cell of each line, which only this rank sees if the
+        // block below has no rank.  Lines are numbered with the fastest remaining dimension first
+        int b = axis==0 ? 1:0;
+        int c = axis==2 ? 1:2;
+        Array<double> lower(n[b],n[c]);
+        for (int ic=0; ic<n[c]; ic++) {
+            for (int ib=0; ib<n[b]; ib++) {
+                std::array<int,3> x;
+                x[axis] = 0;
+                x[b] = ib+1;
+                x[c] = ic+1;
+                char ghost = id(x[0],x[1],x[2]);
+                x[axis] = 1;
+                lower(ib,ic) = ghost != id(x[0],x[1],x[2]) ? 0:inf;
+            }
+        }
+        calcExactDist( F, Dm, line_comm, periodic, dx, inf, axis, inf, &lower );
+        for (size_t i=0; i<F.length(); i++)
+            G(i) = std::min( G(i), F(i) );
+    }
+    freeLineComms( line_comm );
+    for (int k=0; k<n[2]; k++) {
+        for (int j=0; j<n[1]; j++) {
+            for (int i=0; i<n[0]; i++) {
+                double d = std::min( sqrt(G(i,j,k)), 1e50 );
+                Distance(i+1,j+1,k+1) = id(i+1,j+1,k+1) ? d:-d;
+            }
+        }
+    }
+    fillNearest( Distance );
+    fillHalo<TYPE> fillData( Dm.Comm, Dm.rank_info, n, {1,1,1}, 50, 1, {true,true,true}, periodic );
+    fillData.fill( Distance );
+}
 template<class TYPE>
 void CalcDist( Array<TYPE> &Distance, const Array<char> &ID, const Domain &Dm,
     const std::array<bool,3>& periodic, const std::array<double,3>& dx )
 {
     ASSERT( Distance.size() == ID.size() );
+    Array<char> id(Dm.Nx,Dm.Ny,Dm.Nz);
+    for (int k=1; k<Dm.Nz-1; k++) {
+        for (int j=1; j<Dm.Ny-1; j++) {
+            for (int i=1; i<Dm.Nx-1; i++)
+                id(i,j,k) = ID(i,j,k) != 0 ? 1:0;
+        }
+    }
+    calcSignedDist( Distance, id, Dm, periodic, dx );
+}
+template<class TYPE>
+void CalcDist( Array<TYPE> &Distance, const BitMask &ID, const Domain &Dm,
+    const std::array<bool,3>& periodic, const std::array<double,3>& dx )
+{
+    ASSERT( Distance.size(0) == ID.size(0) && Distance.size(1) == ID.size(1) && Distance.size(2) == ID.size(2) );
+    Array<char> id(Dm.Nx,Dm.Ny,Dm.Nz);
+    for (int k=1; k<Dm.Nz-1; k++) {
+        for (int j=1; j<Dm.Ny-1; j++) {
+            for (int i=1; i<Dm.Nx-1; i++)
+                id(i,j,k) = ID(i,j,k) ? 1:0;
+        }
+    }
+    calcSignedDist( Distance, id, Dm, periodic, dx );
+}
+
+
+/******************************************************************
+* Morphological opening from the exact distance transform         *
+******************************************************************/
+std::vector<double> MorphOpen( Array<double> &Radius, const Array<double> &Distance,
+    const std::vector<double> &radii, const Domain &Dm, const std::array<bool,3>& periodic,
+    const std::array<double,3>& dx )
+{
+    ASSERT( Radius.size() == Distance.size() );
+    const double inf = std::numeric_limits<double>::infinity();
     std::array<int,3> n = { Dm.Nx-2, Dm.Ny-2, Dm.Nz-2 };
-    fillHalo<int> fillData(  Dm.Comm, Dm.rank_info, n, {1,1,1}, 50, 1, {true,false,false}, periodic );
-    Array<int> id(ID.size());
-    Array<Vec> vecDist(Distance.size());
-    for (size_t i=0; i<ID.length(); i++)
-        id(i) = ID(i) == 0 ? -1:1;
-    fillData.fill( id );
-    CalcVecDist( vecDist, id, Dm, periodic, dx );
-    for (size_t i=0; i<Distance.length(); i++)
-        Distance(i) = id(i)*vecDist(i).norm();
+    Array<double> F(n[0],n[1],n[2]);
+    Radius.fill( 0 );
+    std::vector<double> volume( radii.size(), 0 );
+    // Largest radius first, so that the cells with Radius > 0 are the drainage volume
+    std::vector<size_t> order( radii.size() );
+    for (size_t r=0; r<radii.size(); r++)
+        order[r] = r;
+    std::sort( order.begin(), order.end(), [&radii]( size_t a, size_t b ) { return radii[a] > radii[b]; } );
+    // Number of pore cells (global) that are not in the drainage volume yet
+    double pore = 0;
+    #pragma omp parallel for reduction(+:pore)
+    for (int k=0; k<n[2]; k++) {
+        for (int j=0; j<n[1]; j++) {
+            for (int i=0; i<n[0]; i++)
+                pore += Distance(i+1,j+1,k+1) >= 0 ? 1:0;
+        }
+    }
+    double remaining = 0;
+    MPI_Allreduce( &pore, &remaining, 1, MPI_DOUBLE, MPI_SUM, Dm.Comm );
+    double total = 0;
+    double R_last = inf;
+    auto line_comm = createLineComms( Dm );
+    for (size_t r : order) {
+        const double R = radii[r];
+        // Erosion: the centers of the balls of radius R that fit in the pore space.  The
+        // centers of the larger radii are already covered by larger balls, so if there are
+        // no new centers the opening adds nothing to the drainage volume
+        double centers = 0;
+        if ( remaining > 0 ) {
+            #pragma omp parallel for reduction(+:centers)
+            for (int k=0; k<n[2]; k++) {
+                for (int j=0; j<n[1]; j++) {
+                    for (int i=0; i<n[0]; i++) {
+                        double d = Distance(i+1,j+1,k+1);
+                        F(i,j,k) = d > R ? 0:inf;
+                        centers += ( d > R && d <= R_last ) ? 1:0;
+                    }
+                }
+            }
+            double local = centers;
+            MPI_Allreduce( &local, &centers, 1, MPI_DOUBLE, MPI_SUM, Dm.Comm );
+        }
+        R_last = R;
+        if ( centers > 0 ) {
+            // Dilation: the pore cells within R of a center (farther cells are not needed)
+            calcExactDist( F, Dm, line_comm, periodic, dx, inf, -1, R*R );
+            double count = 0;
+            #pragma omp parallel for reduction(+:count)
+            for (int k=0; k<n[2]; k++) {
+                for (int j=0; j<n[1]; j++) {
+                    for (int i=0; i<n[0]; i++) {
+                        if ( Radius(i+1,j+1,k+1) == 0 && Distance(i+1,j+1,k+1) >= 0 && F(i,j,k) <= R*R ) {
+                            count += 1;
+                            Radius(i+1,j+1,k+1) = R;
+                        }
+                    }
+                }
+            }
+            double added = 0;
+            MPI_Allreduce( &count, &added, 1, MPI_DOUBLE, MPI_SUM, Dm.Comm );
+            total += added;
+            remaining -= added;
+        }
+        volume[r] = total;
+    }
+    freeLineComms( line_comm );
+    fillNearest( Radius );
+    fillHalo<double> fillData( Dm.Comm, Dm.rank_info, n, {1,1,1}, 50, 1, {true,true,true}, periodic );
+    fillData.fill( Radius );
+    return volume;
 }
 
 
@@ -154,24 +652,7 @@ void CalcVecDist( Array<Vec> &d, const Array<int> &ID0, const Domain &Dm,
     fillHalo<int> fillDataID(  Dm.Comm, Dm.rank_info, n, {1,1,1}, 50, 1, {true,true,true}, periodic );
     fillDataID.copy( ID0, ID );
     // Fill ghosts with nearest neighbor
-    for (int k=1; k<N[2]-1; k++) {
-        for (int j=1; j<N[1]-1; j++) {
-            ID(0,j,k) = ID(1,j,k);
-            ID(N[0]-1,j,k) = ID(N[0]-2,j,k);
-        }
-    }
-    for (int k=1; k<N[2]-1; k++) {
-        for (int i=0; i<N[0]; i++) {
-            ID(i,0,k) = ID(i,1,k);
-            ID(i,N[1]-1,k) = ID(i,N[1]-2,k);
-        }
-    }
-    for (int i=0; i<N[0]; i++) {
-        for (int j=0; j<N[1]; j++) {
-            ID(i,j,0) = ID(i,j,1);
-            ID(i,j,N[2]-1) = ID(i,j,N[2]-2);
-        }
-    }
+    fillNearest( ID );
     // Communicate ghosts
     fillDataID.fill( ID );
     // Create communicator for distance
@@ -201,5 +682,7 @@ void CalcVecDist( Array<Vec> &d, const Array<int> &ID0, const Domain &Dm,
 // Explicit instantiations
 template void CalcDist<float>( Array<float>&, const Array<char>&, const Domain&, const std::array<bool,3>&, const std::array<double,3>& );
 template void CalcDist<double>( Array<double>&, const Array<char>&, const Domain&, const std::array<bool,3>&, const std::array<double,3>& );
+template void CalcDist<float>( Array<float>&, const BitMask&, const Domain&, const std::array<bool,3>&, const std::array<double,3>& );
+template void CalcDist<double>( Array<double>&, const BitMask&, const Domain&, const std::array<bool,3>&, const std::array<double,3>& );
 
 
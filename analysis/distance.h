@@ -18,6 +18,7 @@
 
 #include "common/Domain.h"
 #include "common/Array.hpp"
+#include "common/BitMask.h"
 
 
 struct Vec {
@@ -33,8 +34,11 @@ inline bool operator<(const Vec& l, const Vec& r){ return l.x*l.x+l.y*l.y+l.z*l.
 
 
 /*!
- * @brief  Calculate the distance using a simple method
- * @details  This routine calculates the vector distance to the nearest domain surface.
+ * @brief  Calculate the signed distance
+ * @details  This routine calculates the signed distance to the nearest domain surface
+ *    with the exact distance transform (calcExactDist).  Cells with ID != 0 are positive.
+ *    The surface is made of the faces between cells of different phases, and the
+ *    distance is measured to the nearest face center.
  * @param[out] Distance     Distance function
  * @param[in] ID            Segmentation id
  * @param[in] Dm            Domain information
@@ -44,6 +48,60 @@ template<class TYPE>
 void CalcDist( Array<TYPE> &Distance, const Array<char> &ID, const Domain &Dm,
     const std::array<bool,3>& periodic = {true,true,true}, const std::array<double,3>& dx = {1,1,1} );
 
+/*!
+ * @brief  Calculate the signed distance
+ * @details  This routine calculates the signed distance to the nearest domain surface
+ *    from a bit-packed mask (set bits are positive, cleared bits negative).
+ * @param[out] Distance     Distance function
+ * @param[in] ID            Segmentation mask
+ * @param[in] Dm            Domain information
+ * @param[in] periodic      Directions that are periodic
+ */
+template<class TYPE>
+void CalcDist( Array<TYPE> &Distance, const BitMask &ID, const Domain &Dm,
+    const std::array<bool,3>& periodic = {true,true,true}, const std::array<double,3>& dx = {1,1,1} );
+
+/*!
+ * @brief  Exact squared Euclidean distance transform
+ * @details  Separable transform (Felzenszwalb & Huttenlocher) applied along x, y and z
+ *    (the face axis first, if any).
+ *    On input F is 0 on the feature cells and infinity elsewhere; on output it holds the
+ *    squared distance from each cell center to the nearest feature cell center.  F covers
+ *    the interior of the local block (no ghosts).  For each axis the ranks that share a
+ *    line exchange their segments so that each rank transforms complete global lines,
+ *    so the result is exact and takes a fixed number of passes.
+ * @param[in,out] F         Squared distance
+ * @param[in] Dm            Domain information
+ * @param[in] periodic      Directions that are periodic
+ * @param[in] dx            Cell size
+ * @param[in] gap           Value used for the blocks that have no rank (RankMap)
+ * @param[in] face          If 0-2, the features are the centers of the upper faces of the
+ *                          feature cells along this axis instead of the cell centers
+ */
+void calcExactDist( Array<double> &F, const Domain &Dm, const std::array<bool,3>& periodic,
+    const std::array<double,3>& dx, double gap, int face = -1 );
+
+/*!
+ * @brief  Morphological opening of the pore space
+ * @details  For each radius R the opening is the union of the balls of radius R that fit
+ *    in the pore space (Distance >= 0).  The centers of the balls (Distance > R) are the
+ *    erosion, and the pore cells within R of a center (exact distance transform of the
+ *    erosion) are the dilation.  The drainage volume for R is the union of the openings with
+ *    radius >= R: the cells with Radius >= R.  All the radii are computed in one pass from
+ *    the largest to the smallest, and each radius costs at most one distance transform
+ *    (independent of R): the radii that add no new centers are skipped.
+ * @return  Returns the drainage volume (global number of pore cells) for each radius
+ * @param[out] Radius       Largest radius whose opening contains the cell (0 if none)
+ * @param[in] Distance      Signed distance to the solid (positive in the pore space)
+ * @param[in] radii         Radii of the openings
+ * @param[in] Dm            Domain information
+ * @param[in] periodic      Directions that are periodic
+ * @param[in] dx            Cell size
+ */
+std::vector<double> MorphOpen( Array<double> &Radius, const Array<double> &Distance,
+    const std::vector<double> &radii, const Domain &Dm,
+    const std::array<bool,3>& periodic = {true,true,true}, const std::array<double,3>& dx = {1,1,1} );
+
 /*!
  * @brief  Calculate the distance using a simple method
  * @details  This routine calculates the vector distance to the nearest domain surface.
@@ -0,0 +1,129 @@
+/*
+  Copyright 2013--2018 James E. McClure, Virginia Polytechnic & State University
+
+  This file is part of the Open Porous Media project (OPM).
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef included_BitMask
+#define included_BitMask
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/*!
+ * @brief  Bit-packed 3D voxel mask
+ * @details  Stores one bit per voxel in x-fastest order (the same ordering as
+ *    Domain::id and Array).  Every x-row starts on a new 64-bit word so that
+ *    a row can be read one word at a time (row/bit) and counted with popcounts.
+ */
+class BitMask
+{
+public:
+    //! Empty constructor
+    BitMask() : d_N( { 0, 0, 0 } ), d_words( 0 ) {}
+
+    //! Create a mask of the given size with all bits cleared
+    BitMask( size_t nx, size_t ny, size_t nz ) { resize( nx, ny, nz ); }
+
+    //! Resize the mask and clear all bits
+    inline void resize( size_t nx, size_t ny, size_t nz )
+    {
+        d_N     = { nx, ny, nz };
+        d_words = ( nx + 63 ) / 64;
+        d_data.assign( d_words * ny * nz, 0 );
+    }
+
+    //! Set the mask from a full x-fastest array: bit = pred( data[n] )
+    template<class TYPE, class PRED>
+    inline void assign( const TYPE *data, PRED pred )
+    {
+        for ( size_t row = 0; row < d_N[1] * d_N[2]; row++ ) {
+            const TYPE *x = &data[row * d_N[0]];
+            uint64_t *w   = &d_data[row * d_words];
+            for ( size_t i0 = 0; i0 < d_N[0]; i0 += 64 ) {
+                size_t i1     = std::min<size_t>( i0 + 64, d_N[0] );
+                uint64_t word = 0;
+                for ( size_t i = i0; i < i1; i++ )
+                    word |= uint64_t( pred( x[i] ) ? 1 : 0 ) << ( i - i0 );
+                w[i0 / 64] = word;
+            }
+        }
+    }
+
+    //! Return the size along the given dimension
+    inline size_t size( int d ) const { return d_N[d]; }
+
+    //! Return the number of voxels
+    inline size_t length() const { return d_N[0] * d_N[1] * d_N[2]; }
+
+    //! Return the storage used by the mask (bytes)
+    inline size_t bytes() const { return d_data.size() * sizeof( uint64_t ); }
+
+    //! Get the bit at (i,j,k)
+    inline bool operator()( size_t i, size_t j, size_t k ) const
+    {
+        return ( d_data[( j + k * d_N[1] ) * d_words + ( i >> 6 )] >> ( i & 63 ) ) & 1;
+    }
+
+    //! Return the words of the x-row (j,k), for reading with bit()
+    inline const uint64_t *row( size_t j, size_t k ) const
+    {
+        return &d_data[( j + k * d_N[1] ) * d_words];
+    }
+
+    //! Get bit i of a row returned by row()
+    static inline bool bit( const uint64_t *row, size_t i ) { return ( row[i >> 6] >> ( i & 63 ) ) & 1; }
+
+    //! Set the bit at (i,j,k)
+    inline void set( size_t i, size_t j, size_t k, bool value = true )
+    {
+        uint64_t &w = d_data[( j + k * d_N[1] ) * d_words + ( i >> 6 )];
+        uint64_t b  = uint64_t( 1 ) << ( i & 63 );
+        w           = value ? ( w | b ) : ( w & ~b );
+    }
+
+    //! Clear all bits
+    inline void clear() { std::fill( d_data.begin(), d_data.end(), 0 ); }
+
+    //! Count the set bits in the whole mask
+    inline size_t count() const
+    {
+        size_t N = 0;
+        for ( auto w : d_data )
+            N += popcount( w );
+        return N;
+    }
+
+private:
+    static inline int popcount( uint64_t x )
+    {
+#if defined( __GNUC__ ) || defined( __clang__ )
+        return __builtin_popcountll( x );
+#else
+        x = x - ( ( x >> 1 ) & 0x5555555555555555ULL );
+        x = ( x & 0x3333333333333333ULL ) + ( ( x >> 2 ) & 0x3333333333333333ULL );
+        x = ( x + ( x >> 4 ) ) & 0x0F0F0F0F0F0F0F0FULL;
+        return static_cast<int>( ( x * 0x0101010101010101ULL ) >> 56 );
+#endif
+    }
+
+    std::array<size_t, 3> d_N;
+    size_t d_words; // 64-bit words per x-row
+    std::vector<uint64_t> d_data;
+};
+
+
+#endif
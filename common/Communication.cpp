@@ -48,6 +48,32 @@ RankInfoStruct::RankInfoStruct( int rank0, int nprocx, int nprocy, int nprocz )
     }
     ASSERT(rank[1][1][1]==rank0);
 }
+RankInfoStruct::RankInfoStruct( int rank0, int nprocx, int nprocy, int nprocz, const std::vector<int>& rank_map )
+{
+    memset(this,0,sizeof(RankInfoStruct));
+    INSIST((int)rank_map.size()==nprocx*nprocy*nprocz,"rank map does not match the process grid");
+    nx = nprocx;
+    ny = nprocy;
+    nz = nprocz;
+    int block = -1;
+    for (size_t b=0; b<rank_map.size(); b++) {
+        if ( rank_map[b] == rank0 )
+            block = b;
+    }
+    INSIST(block>=0,"rank is not assigned a block in the rank map");
+	ix = block%nprocx;
+	jy = (block/nprocx)%nprocy;
+	kz = block/(nprocx*nprocy);
+    for (int i=-1; i<=1; i++) {
+        for (int j=-1; j<=1; j++) {
+            for (int k=-1; k<=1; k++) {
+                int r = rank_map[getRankForBlock(nprocx,nprocy,nprocz,ix+i,jy+j,kz+k)];
+                rank[i+1][j+1][k+1] = r<0 ? MPI_PROC_NULL : r;
+            }
+        }
+    }
+    ASSERT(rank[1][1][1]==rank0);
+}
 
 
 /********************************************************
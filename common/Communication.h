@@ -46,6 +46,17 @@ struct RankInfoStruct {
     int rank[3][3][3];      //!<  The rank for the neighbor [i][j][k]
     RankInfoStruct();
     RankInfoStruct( int rank, int nprocx, int nprocy, int nprocz );
+    /*!
+     * @brief  Construct the rank info from a rank map
+     * @details  Used when some blocks of the process grid are not assigned to a rank
+     *    (e.g. all-solid subdomains).  Neighbors that are not assigned are MPI_PROC_NULL.
+     * @param[in] rank          Rank of the current process
+     * @param[in] nprocx        Number of blocks in the x direction
+     * @param[in] nprocy        Number of blocks in the y direction
+     * @param[in] nprocz        Number of blocks in the z direction
+     * @param[in] rank_map      Rank owning block i+j*nprocx+k*nprocx*nprocy, or -1 if skipped
+     */
+    RankInfoStruct( int rank, int nprocx, int nprocy, int nprocz, const std::vector<int>& rank_map );
 };
 
 
@@ -111,6 +122,61 @@ private:
 };
 
 
+/*!
+ * @brief  Write a distributed array to a single file
+ * @details  Collectively write the local arrays from all ranks into one raw file
+ *    using an MPI-IO subarray view.  The ghost cells are excluded, so the file holds
+ *    the global (nx-2*ng)*info.nx x (ny-2*ng)*info.ny x (nz-2*ng)*info.nz volume
+ *    (x fastest) and can be loaded directly by visualization tools.
+ * @param[in] comm          Communicator (all ranks in info must call)
+ * @param[in] info          Rank info used to place the local block
+ * @param[in] data          Local array including the ghost cells
+ * @param[in] ng            Number of ghost cells on each side
+ * @param[in] filename      Name of the file to write
+ */
+template<class TYPE>
+void writeGlobalArray( MPI_Comm comm, const RankInfoStruct& info,
+    const Array<TYPE>& data, int ng, const std::string& filename );
+
+
+/*!
+ * @brief  Write a distributed array with non-uniform blocks to a single file
+ * @details  Same as above, but the placement of the local block is given explicitly
+ *    (e.g. from Domain::GlobalSize and Domain::GlobalStart).
+ * @param[in] comm          Communicator (all ranks must call)
+ * @param[in] size          Size of the global array (x,y,z) without ghost cells
+ * @param[in] start         Global coordinates (x,y,z) of the first interior cell of data
+ * @param[in] data          Local array including the ghost cells
+ * @param[in] ng            Number of ghost cells on each side
+ * @param[in] filename      Name of the file to write
+ */
+template<class TYPE>
+void writeGlobalArray( MPI_Comm comm, const std::array<int,3>& size,
+    const std::array<int,3>& start, const Array<TYPE>& data, int ng,
+    const std::string& filename );
+
+
+/*!
+ * @brief  Move a distributed array to a new block layout
+ * @details  Redistribute an array between two rectilinear decompositions of the same
+ *    process grid (block i+j*nx+k*nx*ny belongs to rank i+j*nx+k*nx*ny in both).
+ *    Both arrays carry one ghost cell on each side.  Ghost cells inside the domain are
+ *    taken from the neighbor that owns them, and ghost cells on the global boundary
+ *    are taken from the boundary block, so the result matches a direct decomposition
+ *    with the new block sizes.
+ * @param[in] comm          Communicator (all ranks must call)
+ * @param[in] info          Rank info (the process grid)
+ * @param[in] src_size      Interior size of every block along x, y and z for src
+ * @param[in] src           Local array in the current layout
+ * @param[in] dst_size      Interior size of every block along x, y and z for dst
+ * @param[out] dst          Local array in the new layout (resized)
+ */
+template<class TYPE>
+void redistributeBlocks( MPI_Comm comm, const RankInfoStruct& info,
+    const std::array<std::vector<int>,3>& src_size, const Array<TYPE>& src,
+    const std::array<std::vector<int>,3>& dst_size, Array<TYPE>& dst );
+
+
 //***************************************************************************************
 inline void PackMeshData(int *list, int count, double *sendbuf, double *data){
 	// Fill in the phase ID values from neighboring processors
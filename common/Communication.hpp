@@ -133,6 +133,15 @@ fillHalo<TYPE>::fillHalo( MPI_Comm comm_, const RankInfoStruct& info_,
                 fill_pattern[i][j][2] = false;
         }
     }
+    // Remove communication with skipped (unassigned) blocks
+    for (int i=0; i<3; i++) {
+        for (int j=0; j<3; j++) {
+            for (int k=0; k<3; k++) {
+                if ( info.rank[i][j][k] == MPI_PROC_NULL )
+                    fill_pattern[i][j][k] = false;
+            }
+        }
+    }
     // Determine the number of elements for each send/recv
     for (int i=0; i<3; i++) {
         int ni = (i-1)==0 ? n[0]:ng[0];
@@ -339,4 +348,141 @@ void fillHalo<TYPE>::copy( const Array<TYPE1>& src, Array<TYPE2>& dst )
 }
 
 
+/********************************************************
+*  Collective write of the global array                 *
+********************************************************/
+template<class TYPE>
+void writeGlobalArray( MPI_Comm comm, const RankInfoStruct& info,
+    const Array<TYPE>& data, int ng, const std::string& filename )
+{
+    int nx = data.size(0)-2*ng;
+    int ny = data.size(1)-2*ng;
+    int nz = data.size(2)-2*ng;
+    writeGlobalArray( comm, { nx*info.nx, ny*info.ny, nz*info.nz },
+        { nx*info.ix, ny*info.jy, nz*info.kz }, data, ng, filename );
+}
+template<class TYPE>
+void writeGlobalArray( MPI_Comm comm, const std::array<int,3>& size,
+    const std::array<int,3>& start, const Array<TYPE>& data, int ng,
+    const std::string& filename )
+{
+    // Sizes are listed slowest index first for MPI_ORDER_C
+    int Nx = data.size(0);
+    int Ny = data.size(1);
+    int Nz = data.size(2);
+    int nx = Nx-2*ng;
+    int ny = Ny-2*ng;
+    int nz = Nz-2*ng;
+    int global_size[3] = { size[2], size[1], size[0] };
+    int local_size[3]  = { nz, ny, nx };
+    int global_start[3] = { start[2], start[1], start[0] };
+    int memory_size[3] = { Nz, Ny, Nx };
+    int memory_start[3] = { ng, ng, ng };
+    MPI_Datatype type = getMPItype<TYPE>();
+    MPI_Datatype filetype, memtype;
+    MPI_Type_create_subarray(3,global_size,local_size,global_start,MPI_ORDER_C,type,&filetype);
+    MPI_Type_create_subarray(3,memory_size,local_size,memory_start,MPI_ORDER_C,type,&memtype);
+    MPI_Type_commit(&filetype);
+    MPI_Type_commit(&memtype);
+    MPI_File fh;
+    int err = MPI_File_open(comm,filename.c_str(),MPI_MODE_CREATE|MPI_MODE_WRONLY,MPI_INFO_NULL,&fh);
+    if ( err != MPI_SUCCESS )
+        ERROR("writeGlobalArray: unable to open "+filename);
+    MPI_File_set_size(fh,0);
+    MPI_File_set_view(fh,0,type,filetype,"native",MPI_INFO_NULL);
+    MPI_File_write_all(fh,data.data(),1,memtype,MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+    MPI_Type_free(&filetype);
+    MPI_Type_free(&memtype);
+}
+
+
+/********************************************************
+*  Redistribute blocks                                  *
+********************************************************/
+// Global box [lo,hi) held by (owned) or needed by a block, including the ghost cells
+static inline void getBlockBox( const std::array<std::vector<int>,3>& size,
+    const int index[3], bool owned, int lo[3], int hi[3] )
+{
+    for (int d=0; d<3; d++) {
+        int start = 0;
+        for (int b=0; b<index[d]; b++)
+            start += size[d][b];
+        int last = (int) size[d].size()-1;
+        lo[d] = start-1;
+        hi[d] = start+size[d][index[d]]+1;
+        if ( owned && index[d] > 0 )
+            lo[d] = start;
+        if ( owned && index[d] < last )
+            hi[d] = start+size[d][index[d]];
+    }
+}
+template<class TYPE>
+void redistributeBlocks( MPI_Comm comm, const RankInfoStruct& info,
+    const std::array<std::vector<int>,3>& src_size, const Array<TYPE>& src,
+    const std::array<std::vector<int>,3>& dst_size, Array<TYPE>& dst )
+{
+    int nprocs = info.nx*info.ny*info.nz;
+    int me[3] = { info.ix, info.jy, info.kz };
+    int src_lo[3], src_hi[3], dst_lo[3], dst_hi[3];
+    getBlockBox( src_size, me, false, src_lo, src_hi );
+    getBlockBox( dst_size, me, false, dst_lo, dst_hi );
+    dst.resize( dst_hi[0]-dst_lo[0], dst_hi[1]-dst_lo[1], dst_hi[2]-dst_lo[2] );
+    // Intersection of the box owned by one rank with the box needed by another
+    std::vector<int> send_count(nprocs,0), recv_count(nprocs,0);
+    std::vector<std::array<int,6>> send_box(nprocs), recv_box(nprocs);
+    int owned_lo[3], owned_hi[3], need_lo[3], need_hi[3];
+    getBlockBox( src_size, me, true, owned_lo, owned_hi );
+    getBlockBox( dst_size, me, false, need_lo, need_hi );
+    for (int r=0; r<nprocs; r++) {
+        int other[3] = { r%info.nx, (r/info.nx)%info.ny, r/(info.nx*info.ny) };
+        int lo[3], hi[3];
+        // what I send to r
+        getBlockBox( dst_size, other, false, lo, hi );
+        int count = 1;
+        for (int d=0; d<3; d++) {
+            send_box[r][d]   = std::max(owned_lo[d],lo[d]);
+            send_box[r][d+3] = std::min(owned_hi[d],hi[d]);
+            count *= std::max(send_box[r][d+3]-send_box[r][d],0);
+        }
+        send_count[r] = count;
+        // what I receive from r
+        getBlockBox( src_size, other, true, lo, hi );
+        count = 1;
+        for (int d=0; d<3; d++) {
+            recv_box[r][d]   = std::max(need_lo[d],lo[d]);
+            recv_box[r][d+3] = std::min(need_hi[d],hi[d]);
+            count *= std::max(recv_box[r][d+3]-recv_box[r][d],0);
+        }
+        recv_count[r] = count;
+    }
+    std::vector<int> send_disp(nprocs,0), recv_disp(nprocs,0);
+    for (int r=1; r<nprocs; r++) {
+        send_disp[r] = send_disp[r-1] + send_count[r-1];
+        recv_disp[r] = recv_disp[r-1] + recv_count[r-1];
+    }
+    std::vector<TYPE> send_buf( send_disp[nprocs-1]+send_count[nprocs-1] );
+    std::vector<TYPE> recv_buf( recv_disp[nprocs-1]+recv_count[nprocs-1] );
+    for (int r=0; r<nprocs; r++) {
+        const auto& b = send_box[r];
+        size_t m = send_disp[r];
+        for (int k=b[2]; k<b[5]; k++)
+            for (int j=b[1]; j<b[4]; j++)
+                for (int i=b[0]; i<b[3]; i++)
+                    send_buf[m++] = src(i-src_lo[0],j-src_lo[1],k-src_lo[2]);
+    }
+    MPI_Datatype type = getMPItype<TYPE>();
+    MPI_Alltoallv(send_buf.data(),send_count.data(),send_disp.data(),type,
+        recv_buf.data(),recv_count.data(),recv_disp.data(),type,comm);
+    for (int r=0; r<nprocs; r++) {
+        const auto& b = recv_box[r];
+        size_t m = recv_disp[r];
+        for (int k=b[2]; k<b[5]; k++)
+            for (int j=b[1]; j<b[4]; j++)
+                for (int i=b[0]; i<b[3]; i++)
+                    dst(i-dst_lo[0],j-dst_lo[1],k-dst_lo[2]) = recv_buf[m++];
+    }
+}
+
+
 #endif
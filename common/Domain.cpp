@@ -23,6 +23,7 @@
 #include <time.h>
 #include <exception>      // std::exception
 #include <stdexcept>
+#include <algorithm>
 
 #include "common/Domain.h"
 #include "common/Array.h"
@@ -122,7 +123,6 @@ Domain::Domain( std::shared_ptr<Database> db, MPI_Comm Communicator):
     int myrank;
     MPI_Comm_rank( Comm, &myrank );
     initialize( db );
-	rank_info = RankInfoStruct( myrank, rank_info.nx, rank_info.ny, rank_info.nz );
 	MPI_Barrier(Comm);
 }
 void Domain::initialize( std::shared_ptr<Database> db )
@@ -147,7 +147,48 @@ void Domain::initialize( std::shared_ptr<Database> db )
     // Initialize ranks
     int myrank;
     MPI_Comm_rank( Comm, &myrank );
-	rank_info = RankInfoStruct(myrank,nproc[0],nproc[1],nproc[2]);
+    int nblocks = nproc[0]*nproc[1]*nproc[2];
+    if (d_db->keyExists( "RankMap" )){
+        // Skipped (all-solid) blocks have no rank; their neighbors treat them as solid
+        auto RankMapFile = d_db->getScalar<std::string>( "RankMap" );
+        std::vector<int> rank_map(nblocks,-1);
+        FILE *MAPFILE = fopen(RankMapFile.c_str(),"r");
+        if (MAPFILE==NULL) ERROR("Domain::initialize -- Error opening rank map "+RankMapFile);
+        for (int b=0; b<nblocks; b++){
+            if (fscanf(MAPFILE,"%i",&rank_map[b]) != 1)
+                ERROR("Domain::initialize -- Error reading rank map "+RankMapFile);
+        }
+        fclose(MAPFILE);
+        nblocks = 0;
+        for (int b=0; b<(int)rank_map.size(); b++){
+            if (rank_map[b] >= 0) nblocks++;
+        }
+        rank_info = RankInfoStruct(myrank,nproc[0],nproc[1],nproc[2],rank_map);
+    }
+    else {
+        rank_info = RankInfoStruct(myrank,nproc[0],nproc[1],nproc[2]);
+    }
+    // Non-uniform (e.g. porosity weighted) decomposition from lbpm_serial_decomp
+    BlockSizeX.assign(nproc[0],nx);
+    BlockSizeY.assign(nproc[1],ny);
+    BlockSizeZ.assign(nproc[2],nz);
+    if (d_db->keyExists( "BlockSizeX" )) BlockSizeX = d_db->getVector<int>( "BlockSizeX" );
+    if (d_db->keyExists( "BlockSizeY" )) BlockSizeY = d_db->getVector<int>( "BlockSizeY" );
+    if (d_db->keyExists( "BlockSizeZ" )) BlockSizeZ = d_db->getVector<int>( "BlockSizeZ" );
+    INSIST(BlockSizeX.size()==size_t(nproc[0]),"BlockSizeX must have nproc[0] entries");
+    INSIST(BlockSizeY.size()==size_t(nproc[1]),"BlockSizeY must have nproc[1] entries");
+    INSIST(BlockSizeZ.size()==size_t(nproc[2]),"BlockSizeZ must have nproc[2] entries");
+    Nx = BlockSizeX[rank_info.ix]+2;
+    Ny = BlockSizeY[rank_info.jy]+2;
+    Nz = BlockSizeZ[rank_info.kz]+2;
+    // Over-decomposition of the local block into cache-sized sub-blocks
+    SubBlockSize = { Nx-2, Ny-2, Nz-2 };
+    if (d_db->keyExists( "SubBlockSize" )){
+        auto sub = d_db->getVector<int>( "SubBlockSize" );
+        INSIST(sub.size()==3,"SubBlockSize must have 3 entries");
+        INSIST(sub[0]>0 && sub[1]>0 && sub[2]>0,"SubBlockSize entries must be positive");
+        SubBlockSize = { sub[0], sub[1], sub[2] };
+    }
     // Fill remaining variables
 	N = Nx*Ny*Nz;
 	Volume = nx*ny*nx*nproc[0]*nproc[1]*nproc[2]*1.0;
@@ -156,7 +197,7 @@ void Domain::initialize( std::shared_ptr<Database> db )
 	BoundaryCondition = d_db->getScalar<int>("BC");
     int nprocs;
     MPI_Comm_size( Comm, &nprocs );
-	INSIST(nprocs == nproc[0]*nproc[1]*nproc[2],"Fatal error in processor count!");
+	INSIST(nprocs == nblocks,"Fatal error in processor count!");
 }
 Domain::~Domain()
 {
@@ -216,100 +257,31 @@ Domain::~Domain()
  ********************************************************/
 void Domain::CommInit()
 {
-	int i,j,k,n;
 	int sendtag = 21;
 	int recvtag = 21;
 	//......................................................................................
-	sendCount_x = sendCount_y = sendCount_z = sendCount_X = sendCount_Y = sendCount_Z = 0;
-	sendCount_xy = sendCount_yz = sendCount_xz = sendCount_Xy = sendCount_Yz = sendCount_xZ = 0;
-	sendCount_xY = sendCount_yZ = sendCount_Xz = sendCount_XY = sendCount_YZ = sendCount_XZ = 0;
-	//......................................................................................
-	for (k=1; k<Nz-1; k++){
-		for (j=1; j<Ny-1; j++){
-			for (i=1; i<Nx-1; i++){
-				// Check the phase ID
-				if (id[k*Nx*Ny+j*Nx+i] > 0){
-					// Counts for the six faces
-					if (i==1)    sendCount_x++;
-					if (j==1)    sendCount_y++;
-					if (k==1)    sendCount_z++;
-					if (i==Nx-2)    sendCount_X++;
-					if (j==Ny-2)    sendCount_Y++;
-					if (k==Nz-2)    sendCount_Z++;
-					// Counts for the twelve edges
-					if (i==1 && j==1)    sendCount_xy++;
-					if (i==1 && j==Ny-2)    sendCount_xY++;
-					if (i==Nx-2 && j==1)    sendCount_Xy++;
-					if (i==Nx-2 && j==Ny-2)    sendCount_XY++;
-
-					if (i==1 && k==1)    sendCount_xz++;
-					if (i==1 && k==Nz-2)    sendCount_xZ++;
-					if (i==Nx-2 && k==1)    sendCount_Xz++;
-					if (i==Nx-2 && k==Nz-2)    sendCount_XZ++;
-
-					if (j==1 && k==1)    sendCount_yz++;
-					if (j==1 && k==Nz-2)    sendCount_yZ++;
-					if (j==Ny-2 && k==1)    sendCount_Yz++;
-					if (j==Ny-2 && k==Nz-2)    sendCount_YZ++;
-				}
-			}
-		}
-	}
-
-	// allocate send lists
-	sendList_x = new int [sendCount_x];
-	sendList_y = new int [sendCount_y];
-	sendList_z = new int [sendCount_z];
-	sendList_X = new int [sendCount_X];
-	sendList_Y = new int [sendCount_Y];
-	sendList_Z = new int [sendCount_Z];
-	sendList_xy = new int [sendCount_xy];
-	sendList_yz = new int [sendCount_yz];
-	sendList_xz = new int [sendCount_xz];
-	sendList_Xy = new int [sendCount_Xy];
-	sendList_Yz = new int [sendCount_Yz];
-	sendList_xZ = new int [sendCount_xZ];
-	sendList_xY = new int [sendCount_xY];
-	sendList_yZ = new int [sendCount_yZ];
-	sendList_Xz = new int [sendCount_Xz];
-	sendList_XY = new int [sendCount_XY];
-	sendList_YZ = new int [sendCount_YZ];
-	sendList_XZ = new int [sendCount_XZ];
-	// Populate the send list
-	sendCount_x = sendCount_y = sendCount_z = sendCount_X = sendCount_Y = sendCount_Z = 0;
-	sendCount_xy = sendCount_yz = sendCount_xz = sendCount_Xy = sendCount_Yz = sendCount_xZ = 0;
-	sendCount_xY = sendCount_yZ = sendCount_Xz = sendCount_XY = sendCount_YZ = sendCount_XZ = 0;
-	for (k=1; k<Nz-1; k++){
-		for (j=1; j<Ny-1; j++){
-			for (i=1; i<Nx-1; i++){
-				// Local value to send
-				n = k*Nx*Ny+j*Nx+i;
-				if (id[n] > 0){
-					// Counts for the six faces
-					if (i==1)        sendList_x[sendCount_x++]=n;
-					if (j==1)        sendList_y[sendCount_y++]=n;
-					if (k==1)        sendList_z[sendCount_z++]=n;
-					if (i==Nx-2)    sendList_X[sendCount_X++]=n;
-					if (j==Ny-2)    sendList_Y[sendCount_Y++]=n;
-					if (k==Nz-2)    sendList_Z[sendCount_Z++]=n;
-					// Counts for the twelve edges
-					if (i==1 && j==1)        sendList_xy[sendCount_xy++]=n;
-					if (i==1 && j==Ny-2)    sendList_xY[sendCount_xY++]=n;
-					if (i==Nx-2 && j==1)    sendList_Xy[sendCount_Xy++]=n;
-					if (i==Nx-2 && j==Ny-2)    sendList_XY[sendCount_XY++]=n;
-
-					if (i==1 && k==1)        sendList_xz[sendCount_xz++]=n;
-					if (i==1 && k==Nz-2)    sendList_xZ[sendCount_xZ++]=n;
-					if (i==Nx-2 && k==1)    sendList_Xz[sendCount_Xz++]=n;
-					if (i==Nx-2 && k==Nz-2)    sendList_XZ[sendCount_XZ++]=n;
-
-					if (j==1 && k==1)        sendList_yz[sendCount_yz++]=n;
-					if (j==1 && k==Nz-2)    sendList_yZ[sendCount_yZ++]=n;
-					if (j==Ny-2 && k==1)    sendList_Yz[sendCount_Yz++]=n;
-					if (j==Ny-2 && k==Nz-2)    sendList_YZ[sendCount_YZ++]=n;
-				}
-			}
-		}
+	// The send lists only involve the outer layer of the interior, so each list is built
+	// from its own face / edge (same k,j,i order as a sweep of the whole subdomain)
+	int *sendCount[18] = { &sendCount_x, &sendCount_y, &sendCount_z, &sendCount_X, &sendCount_Y, &sendCount_Z,
+		&sendCount_xy, &sendCount_xY, &sendCount_Xy, &sendCount_XY, &sendCount_xz, &sendCount_xZ,
+		&sendCount_Xz, &sendCount_XZ, &sendCount_yz, &sendCount_yZ, &sendCount_Yz, &sendCount_YZ };
+	int **sendList[18] = { &sendList_x, &sendList_y, &sendList_z, &sendList_X, &sendList_Y, &sendList_Z,
+		&sendList_xy, &sendList_xY, &sendList_Xy, &sendList_XY, &sendList_xz, &sendList_xZ,
+		&sendList_Xz, &sendList_XZ, &sendList_yz, &sendList_yZ, &sendList_Yz, &sendList_YZ };
+	// {imin,imax,jmin,jmax,kmin,kmax} for each list
+	const int box[18][6] = {
+		{1,1,1,Ny-2,1,Nz-2}, {1,Nx-2,1,1,1,Nz-2}, {1,Nx-2,1,Ny-2,1,1},
+		{Nx-2,Nx-2,1,Ny-2,1,Nz-2}, {1,Nx-2,Ny-2,Ny-2,1,Nz-2}, {1,Nx-2,1,Ny-2,Nz-2,Nz-2},
+		{1,1,1,1,1,Nz-2}, {1,1,Ny-2,Ny-2,1,Nz-2}, {Nx-2,Nx-2,1,1,1,Nz-2}, {Nx-2,Nx-2,Ny-2,Ny-2,1,Nz-2},
+		{1,1,1,Ny-2,1,1}, {1,1,1,Ny-2,Nz-2,Nz-2}, {Nx-2,Nx-2,1,Ny-2,1,1}, {Nx-2,Nx-2,1,Ny-2,Nz-2,Nz-2},
+		{1,Nx-2,1,1,1,1}, {1,Nx-2,1,1,Nz-2,Nz-2}, {1,Nx-2,Ny-2,Ny-2,1,1}, {1,Nx-2,Ny-2,Ny-2,Nz-2,Nz-2} };
+#ifdef USE_OPENMP
+	#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int q=0; q<18; q++){
+		*sendCount[q] = BoundaryList(box[q],NULL);
+		*sendList[q] = new int [*sendCount[q]];
+		BoundaryList(box[q],*sendList[q]);
 	}
 
 	// allocate send buffers
@@ -431,24 +403,25 @@ void Domain::CommInit()
 	MPI_Waitall(18,req1,stat1);
 	MPI_Waitall(18,req2,stat2);
 	//......................................................................................
-	for (int idx=0; idx<recvCount_x; idx++)    recvList_x[idx] -= (Nx-2);
-	for (int idx=0; idx<recvCount_X; idx++)    recvList_X[idx] += (Nx-2);
-	for (int idx=0; idx<recvCount_y; idx++)    recvList_y[idx] -= (Ny-2)*Nx;
-	for (int idx=0; idx<recvCount_Y; idx++)    recvList_Y[idx] += (Ny-2)*Nx;
-	for (int idx=0; idx<recvCount_z; idx++)    recvList_z[idx] -= (Nz-2)*Nx*Ny;
-	for (int idx=0; idx<recvCount_Z; idx++)    recvList_Z[idx] += (Nz-2)*Nx*Ny;
-	for (int idx=0; idx<recvCount_xy; idx++)    recvList_xy[idx] -= (Nx-2)+(Ny-2)*Nx;
-	for (int idx=0; idx<recvCount_XY; idx++)    recvList_XY[idx] += (Nx-2)+(Ny-2)*Nx;
-	for (int idx=0; idx<recvCount_xY; idx++)    recvList_xY[idx] -= (Nx-2)-(Ny-2)*Nx;
-	for (int idx=0; idx<recvCount_Xy; idx++)    recvList_Xy[idx] += (Nx-2)-(Ny-2)*Nx;
-	for (int idx=0; idx<recvCount_xz; idx++)    recvList_xz[idx] -= (Nx-2)+(Nz-2)*Nx*Ny;
-	for (int idx=0; idx<recvCount_XZ; idx++)    recvList_XZ[idx] += (Nx-2)+(Nz-2)*Nx*Ny;
-	for (int idx=0; idx<recvCount_xZ; idx++)    recvList_xZ[idx] -= (Nx-2)-(Nz-2)*Nx*Ny;
-	for (int idx=0; idx<recvCount_Xz; idx++)    recvList_Xz[idx] += (Nx-2)-(Nz-2)*Nx*Ny;
-	for (int idx=0; idx<recvCount_yz; idx++)    recvList_yz[idx] -= (Ny-2)*Nx + (Nz-2)*Nx*Ny;
-	for (int idx=0; idx<recvCount_YZ; idx++)    recvList_YZ[idx] += (Ny-2)*Nx + (Nz-2)*Nx*Ny;
-	for (int idx=0; idx<recvCount_yZ; idx++)    recvList_yZ[idx] -= (Ny-2)*Nx - (Nz-2)*Nx*Ny;
-	for (int idx=0; idx<recvCount_Yz; idx++)    recvList_Yz[idx] += (Ny-2)*Nx - (Nz-2)*Nx*Ny;
+	// Neighbors may have different block sizes (non-uniform decomposition)
+	MapRecvList(recvList_x, recvCount_x, -1, 0, 0);
+	MapRecvList(recvList_X, recvCount_X, 1, 0, 0);
+	MapRecvList(recvList_y, recvCount_y, 0, -1, 0);
+	MapRecvList(recvList_Y, recvCount_Y, 0, 1, 0);
+	MapRecvList(recvList_z, recvCount_z, 0, 0, -1);
+	MapRecvList(recvList_Z, recvCount_Z, 0, 0, 1);
+	MapRecvList(recvList_xy, recvCount_xy, -1, -1, 0);
+	MapRecvList(recvList_XY, recvCount_XY, 1, 1, 0);
+	MapRecvList(recvList_xY, recvCount_xY, -1, 1, 0);
+	MapRecvList(recvList_Xy, recvCount_Xy, 1, -1, 0);
+	MapRecvList(recvList_xz, recvCount_xz, -1, 0, -1);
+	MapRecvList(recvList_XZ, recvCount_XZ, 1, 0, 1);
+	MapRecvList(recvList_xZ, recvCount_xZ, -1, 0, 1);
+	MapRecvList(recvList_Xz, recvCount_Xz, 1, 0, -1);
+	MapRecvList(recvList_yz, recvCount_yz, 0, -1, -1);
+	MapRecvList(recvList_YZ, recvCount_YZ, 0, 1, 1);
+	MapRecvList(recvList_yZ, recvCount_yZ, 0, -1, 1);
+	MapRecvList(recvList_Yz, recvCount_Yz, 0, 1, -1);
 	//......................................................................................
 	// allocate recv buffers
 	recvBuf_x = new int [recvCount_x];
@@ -513,9 +486,58 @@ void Domain::CommInit()
 
 }
 
+/********************************************************
+ * Pore sites of one face / edge of the interior         *
+ ********************************************************/
+int Domain::BoundaryList(const int *box, int *list)
+{
+	// Count the sites in box, and store their indices if list is given
+	int count = 0;
+	for (int k=box[4]; k<=box[5]; k++){
+		for (int j=box[2]; j<=box[3]; j++){
+			for (int i=box[0]; i<=box[1]; i++){
+				int n = k*Nx*Ny+j*Nx+i;
+				if (id[n] > 0){
+					if (list != NULL) list[count] = n;
+					count++;
+				}
+			}
+		}
+	}
+	return count;
+}
+
+/********************************************************
+ * Convert a receive list to local indices               *
+ ********************************************************/
+void Domain::MapRecvList(int *list, int count, int dx, int dy, int dz)
+{
+	// The list holds the sender's interior indices, so decode them with the
+	// sender's dimensions and shift them into the local halo along (dx,dy,dz)
+	int d[3] = { dx, dy, dz };
+	int p[3] = { rank_info.ix, rank_info.jy, rank_info.kz };
+	int np[3] = { rank_info.nx, rank_info.ny, rank_info.nz };
+	int Nloc[3] = { Nx, Ny, Nz };
+	const std::vector<int> *size[3] = { &BlockSizeX, &BlockSizeY, &BlockSizeZ };
+	int Nsrc[3], shift[3];
+	for (int a=0; a<3; a++){
+		int q = (p[a]+d[a]+np[a])%np[a];
+		Nsrc[a] = (*size[a])[q]+2;
+		shift[a] = 0;
+		if (d[a]<0) shift[a] = -(Nsrc[a]-2);
+		if (d[a]>0) shift[a] = Nloc[a]-2;
+	}
+	for (int idx=0; idx<count; idx++){
+		int n = list[idx];
+		int k = n/(Nsrc[0]*Nsrc[1]);
+		int j = (n-k*Nsrc[0]*Nsrc[1])/Nsrc[0];
+		int i = n-k*Nsrc[0]*Nsrc[1]-j*Nsrc[0];
+		list[idx] = (k+shift[2])*Nx*Ny + (j+shift[1])*Nx + i+shift[0];
+	}
+}
+
 void Domain::ReadIDs(){
 	// Read the IDs from input file
-  int nprocs=nprocx()*nprocy()*nprocz();
     size_t readID;
     char LocalRankString[8];
     char LocalRankFilename[40];
@@ -526,17 +548,54 @@ void Domain::ReadIDs(){
     sprintf(LocalRankFilename,"%s%s","ID.",LocalRankString);
     // .......... READ THE INPUT FILE .......................................
     if (rank()==0) printf("Initialize from segmented data: solid=0, NWP=1, WP=2 \n");
-    sprintf(LocalRankFilename,"ID.%05i",rank());
-    FILE *IDFILE = fopen(LocalRankFilename,"rb");
-    if (IDFILE==NULL) ERROR("Domain::ReadIDs --  Error opening file: ID.xxxxx");
-    readID=fread(id,1,N,IDFILE);
-    if (readID != size_t(N)) printf("Domain::ReadIDs -- Error reading ID (rank=%i) \n",rank());
-    fclose(IDFILE);
+    bool ReadGlobalImage = false;
+    if (d_db->keyExists( "ReadGlobalImage" )) ReadGlobalImage = d_db->getScalar<bool>( "ReadGlobalImage" );
+    if (ReadGlobalImage){
+        // Read the local block directly from the global image (no ID files needed)
+        auto Filename = d_db->getScalar<std::string>( "Filename" );
+        auto SIZE = d_db->getVector<int>( "N" );
+        std::string ReadType = "8bit";
+        if (d_db->keyExists( "ReadType" )) ReadType = d_db->getScalar<std::string>( "ReadType" );
+        std::array<int64_t,3> offset = { 0, 0, 0 };
+        if (d_db->keyExists( "offset" )){
+            auto off = d_db->getVector<int>( "offset" );
+            offset = { off[0], off[1], off[2] };
+        }
+        std::array<int64_t,3> Nglobal = { SIZE[0], SIZE[1], SIZE[2] };
+        // number of sites to use for periodic boundary condition transition zone (see lbpm_serial_decomp)
+        auto size = GlobalSize();
+        auto start = GlobalStart();
+        int64_t z_transition_size = ((int64_t)size[2] - (Nglobal[2] - offset[2]))/2;
+        if (z_transition_size < 0) z_transition_size=0;
+        if (rank()==0) printf("Reading subdomains from %s (%s) \n",Filename.c_str(),ReadType.c_str());
+        ReadSubdomainImage(Comm,Filename,ReadType,Nglobal,offset,start,{Nx-2,Ny-2,Nz-2},z_transition_size,id);
+        if (d_db->keyExists( "ReadValues" )){
+            auto ReadValues = d_db->getVector<char>( "ReadValues" );
+            auto WriteValues = d_db->getVector<char>( "WriteValues" );
+            for (int n=0; n<N; n++){
+                for (size_t idx=0; idx<ReadValues.size(); idx++){
+                    if (id[n] == ReadValues[idx]){
+                        id[n] = WriteValues[idx];
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    else {
+        sprintf(LocalRankFilename,"ID.%05i",rank());
+        FILE *IDFILE = fopen(LocalRankFilename,"rb");
+        if (IDFILE==NULL) ERROR("Domain::ReadIDs --  Error opening file: ID.xxxxx");
+        readID=fread(id,1,N,IDFILE);
+        if (readID != size_t(N)) printf("Domain::ReadIDs -- Error reading ID (rank=%i) \n",rank());
+        fclose(IDFILE);
+    }
     // Compute the porosity
     double sum;
     double porosity;
     double sum_local=0.0;
-    double iVol_global = 1.0/(1.0*(Nx-2)*(Ny-2)*(Nz-2)*nprocs);
+    auto Nglobal = GlobalSize();
+    double iVol_global = 1.0/(1.0*Nglobal[0]*Nglobal[1]*Nglobal[2]);
     
     //if (BoundaryCondition > 0) iVol_global = 1.0/(1.0*(Nx-2)*nprocx()*(Ny-2)*nprocy()*((Nz-2)*nprocz()-6));
  	//.........................................................
@@ -564,22 +623,28 @@ void Domain::ReadIDs(){
  		}
  	}
  	*/
-    for (int k=1;k<Nz-1;k++){
-        for (int j=1;j<Ny-1;j++){
-            for (int i=1;i<Nx-1;i++){
-                int n = k*Nx*Ny+j*Nx+i;
-                if (id[n] > 0){
-                    sum_local+=1.0;
-                }
-            }
-        }
-    }
-    
+    sum_local = PoreCount();
     MPI_Allreduce(&sum_local,&sum,1,MPI_DOUBLE,MPI_SUM,Comm);
     porosity = sum*iVol_global;
     if (rank()==0) printf("Media porosity = %f \n",porosity);
  	//.........................................................
 }
+std::array<int,3> Domain::GlobalSize() const
+{
+    std::array<int,3> size = { 0, 0, 0 };
+    for (size_t i=0; i<BlockSizeX.size(); i++) size[0] += BlockSizeX[i];
+    for (size_t j=0; j<BlockSizeY.size(); j++) size[1] += BlockSizeY[j];
+    for (size_t k=0; k<BlockSizeZ.size(); k++) size[2] += BlockSizeZ[k];
+    return size;
+}
+std::array<int,3> Domain::GlobalStart() const
+{
+    std::array<int,3> start = { 0, 0, 0 };
+    for (int i=0; i<rank_info.ix; i++) start[0] += BlockSizeX[i];
+    for (int j=0; j<rank_info.jy; j++) start[1] += BlockSizeY[j];
+    for (int k=0; k<rank_info.kz; k++) start[2] += BlockSizeZ[k];
+    return start;
+}
 int Domain::PoreCount(){
 	/*
 	 * count the number of nodes occupied by mobile phases
@@ -587,16 +652,108 @@ int Domain::PoreCount(){
     int Npore=0;  // number of local pore nodes
     for (int k=1;k<Nz-1;k++){
         for (int j=1;j<Ny-1;j++){
-            for (int i=1;i<Nx-1;i++){
-                int n = k*Nx*Ny+j*Nx+i;
-                if (id[n] > 0){
-                    Npore++;
-                }
-            }
+            const char *row = &id[(k*Ny+j)*Nx];
+            for (int i=1;i<Nx-1;i++)
+                Npore += row[i] > 0 ? 1 : 0;
         }
     }
     return Npore;
 }
+BitMask Domain::PoreMask() const
+{
+    BitMask mask(Nx,Ny,Nz);
+    mask.assign( id, []( char c ) { return c > 0; } );
+    return mask;
+}
+
+
+/********************************************************
+ * Balance the block sizes along one axis                *
+ ********************************************************/
+std::vector<int> BalanceBlockSizes( const std::vector<double>& weight, int nblocks, int minsize )
+{
+    int length = weight.size();
+    std::vector<double> prefix(length+1,0.0);
+    for (int c=0; c<length; c++) prefix[c+1] = prefix[c] + weight[c];
+    std::vector<int> size(nblocks,0);
+    int start = 0;
+    for (int p=1; p<nblocks; p++) {
+        // first cut position with at least p/nblocks of the weight below it
+        double target = prefix[length]*p/nblocks;
+        int cut = std::lower_bound(prefix.begin(),prefix.end(),target) - prefix.begin();
+        cut = std::max(cut,start+minsize);
+        cut = std::min(cut,length-(nblocks-p)*minsize);
+        size[p-1] = cut-start;
+        start = cut;
+    }
+    size[nblocks-1] = length-start;
+    return size;
+}
+
+
+/********************************************************
+ * Read a subdomain from the global image                *
+ ********************************************************/
+static inline int64_t clampCoordinate( int64_t x, int64_t xmin, int64_t xmax )
+{
+    return x<xmin ? xmin : (x>xmax ? xmax : x);
+}
+void ReadSubdomainImage( MPI_Comm comm,
+    const std::string& filename, const std::string& ReadType,
+    const std::array<int64_t,3>& N, const std::array<int64_t,3>& offset,
+    const std::array<int,3>& start, const std::array<int,3>& n,
+    int64_t z_transition_size, char *id )
+{
+    int bytes = 1;
+    MPI_Datatype type = MPI_CHAR;
+    if ( ReadType == "16bit" ) {
+        bytes = 2;
+        type = MPI_SHORT;
+    } else if ( ReadType != "8bit" ) {
+        ERROR("ReadSubdomainImage: valid ReadType are 8bit, 16bit");
+    }
+    // Global coordinates of the first voxel of the block (halo included)
+    int64_t shift[3] = { 0, 0, z_transition_size };
+    int64_t first[3], lo[3], hi[3];
+    for (int d=0; d<3; d++) {
+        first[d] = offset[d] + start[d] - 1 - shift[d];
+        lo[d] = clampCoordinate( first[d], offset[d], N[d]-1 );
+        hi[d] = clampCoordinate( first[d]+n[d]+1, offset[d], N[d]-1 );
+    }
+    // Read the bounding box of the (clamped) block, slowest index first for MPI_ORDER_C
+    int global_size[3] = { (int) N[2], (int) N[1], (int) N[0] };
+    int box_size[3] = { (int) (hi[2]-lo[2]+1), (int) (hi[1]-lo[1]+1), (int) (hi[0]-lo[0]+1) };
+    int box_start[3] = { (int) lo[2], (int) lo[1], (int) lo[0] };
+    int64_t box_length = (int64_t) box_size[0]*box_size[1]*box_size[2];
+    std::vector<char> buffer( box_length*bytes );
+    MPI_Datatype filetype;
+    MPI_Type_create_subarray(3,global_size,box_size,box_start,MPI_ORDER_C,type,&filetype);
+    MPI_Type_commit(&filetype);
+    MPI_File fh;
+    int err = MPI_File_open(comm,filename.c_str(),MPI_MODE_RDONLY,MPI_INFO_NULL,&fh);
+    if ( err != MPI_SUCCESS )
+        ERROR("ReadSubdomainImage: unable to open "+filename);
+    MPI_File_set_view(fh,0,type,filetype,"native",MPI_INFO_NULL);
+    MPI_File_read_all(fh,buffer.data(),box_length,type,MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+    MPI_Type_free(&filetype);
+    // Copy the block (halo included) from the bounding box
+    const short int *data16 = reinterpret_cast<const short int*>( buffer.data() );
+    int64_t bx = box_size[2];
+    int64_t by = box_size[1];
+    for (int64_t k=0; k<n[2]+2; k++) {
+        int64_t z = clampCoordinate( first[2]+k, offset[2], N[2]-1 ) - lo[2];
+        for (int64_t j=0; j<n[1]+2; j++) {
+            int64_t y = clampCoordinate( first[1]+j, offset[1], N[1]-1 ) - lo[1];
+            for (int64_t i=0; i<n[0]+2; i++) {
+                int64_t x = clampCoordinate( first[0]+i, offset[0], N[0]-1 ) - lo[0];
+                int64_t nbox = z*bx*by + y*bx + x;
+                int64_t nlocal = k*(n[0]+2)*(n[1]+2) + j*(n[0]+2) + i;
+                id[nlocal] = bytes==1 ? buffer[nbox] : char(data16[nbox]);
+            }
+        }
+    }
+}
 
 //void Domain::CommunicateMeshHalo(DoubleArray &Mesh)
 //{
@@ -26,6 +26,7 @@
 #include <stdexcept>
 
 #include "common/Array.h"
+#include "common/BitMask.h"
 #include "common/Utilities.h"
 #include "common/MPI_Helpers.h"
 #include "common/Communication.h"
@@ -126,6 +127,18 @@ public: // Public variables (need to create accessors instead)
     int Nx,Ny,Nz,N;
     RankInfoStruct rank_info; // call from communication cpp
 
+    // Interior size of every block along x, y and z (all equal to n unless BlockSizeX/Y/Z are given)
+    std::vector<int> BlockSizeX, BlockSizeY, BlockSizeZ;
+
+    // Interior size of the cache blocks the local subdomain is split into (whole subdomain unless SubBlockSize is given)
+    std::array<int,3> SubBlockSize;
+
+    //! Interior size of the global domain
+    std::array<int,3> GlobalSize() const;
+
+    //! Global coordinates of the first interior voxel of the local block
+    std::array<int,3> GlobalStart() const;
+
     MPI_Comm Comm;        // MPI Communicator for this domain
 
     int BoundaryCondition;
@@ -185,16 +198,19 @@ public: // Public variables (need to create accessors instead)
     // Solid indicator function
     char *id;
 
-    void ReadIDs();
+    void ReadIDs();         // ID.xxxxx files, or the global image "Filename" if ReadGlobalImage = true
     //void CommunicateMeshHalo(DoubleArray &Mesh);
     void CommInit(); 
     int PoreCount();
+    BitMask PoreMask() const; // bit set where id > 0, including the halo
 
 private:
 
     void PackID(int *list, int count, char *sendbuf, char *ID);
     void UnpackID(int *list, int count, char *recvbuf, char *ID);
     void CommHaloIDs();
+    void MapRecvList(int *list, int count, int dx, int dy, int dz);
+    int BoundaryList(const int *box, int *list);
     
 	//......................................................................................
 	MPI_Request req1[18], req2[18];
@@ -217,6 +233,42 @@ private:
 };
 
 
+/*!
+ * @brief  Read a subdomain directly from the global segmented image
+ * @details  Collectively read the block owned by the calling rank (including the
+ *    one-voxel halo) from a raw 8-bit or 16-bit image using an MPI-IO subarray view,
+ *    so no rank ever holds more than its own block.  The block layout matches
+ *    lbpm_serial_decomp: coordinates are shifted by the offset and by the z transition
+ *    zone, and coordinates outside the image are clamped to the nearest voxel.
+ * @param[in] comm              Communicator (every rank must call)
+ * @param[in] filename          Name of the global image
+ * @param[in] ReadType          Either "8bit" or "16bit"
+ * @param[in] N                 Size of the global image
+ * @param[in] offset            Start of the region to decompose within the image
+ * @param[in] start             Start of the block within the decomposed region (e.g. Domain::GlobalStart)
+ * @param[in] n                 Size of the subdomain (without halo)
+ * @param[in] z_transition_size Size of the z transition zone
+ * @param[out] id               Labels for the block, size (n[0]+2)*(n[1]+2)*(n[2]+2)
+ */
+void ReadSubdomainImage( MPI_Comm comm,
+    const std::string& filename, const std::string& ReadType,
+    const std::array<int64_t,3>& N, const std::array<int64_t,3>& offset,
+    const std::array<int,3>& start, const std::array<int,3>& n,
+    int64_t z_transition_size, char *id );
+
+
+/*!
+ * @brief  Choose the block sizes along one axis that balance a weight
+ * @details  Place nblocks-1 cut planes so that every block holds a similar share of
+ *    the total weight (e.g. pore voxels or measured run time of every plane).
+ * @param[in] weight    Weight of every plane along the axis
+ * @param[in] nblocks   Number of blocks
+ * @param[in] minsize   Smallest block size allowed
+ * @return  Size of every block (the sizes add up to weight.size())
+ */
+std::vector<int> BalanceBlockSizes( const std::vector<double>& weight, int nblocks, int minsize );
+
+
 // Class to hold data on a patch
 template<class TYPE>
 class PatchData {
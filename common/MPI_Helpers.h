@@ -34,6 +34,7 @@
     #define MPI_COMM_SELF 0
     #define MPI_COMM_NULL -1
     #define MPI_GROUP_NULL -2
+    #define MPI_PROC_NULL -3
     #define MPI_STATUS_IGNORE NULL
     enum MPI_Datatype { MPI_LOGICAL, MPI_CHAR, MPI_UNSIGNED_CHAR, MPI_INT, 
         MPI_UNSIGNED, MPI_LONG, MPI_UNSIGNED_LONG, MPI_LONG_LONG, MPI_FLOAT, MPI_DOUBLE };
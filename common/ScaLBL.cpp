@@ -14,6 +14,7 @@
   along with OPM.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "common/ScaLBL.h"
+#include <algorithm>
 
 ScaLBL_Communicator::ScaLBL_Communicator(std::shared_ptr <Domain> Dm){
 	//......................................................................................
@@ -94,6 +95,9 @@ ScaLBL_Communicator::ScaLBL_Communicator(std::shared_ptr <Domain> Dm){
 	nprocz = Dm->nprocz();
 	nprocs=nprocx*nprocy*nprocz;
 	BoundaryCondition = Dm->BoundaryCondition;
+	subx = Dm->SubBlockSize[0];
+	suby = Dm->SubBlockSize[1];
+	subz = Dm->SubBlockSize[2];
 	//......................................................................................
     // allocate memory for variables to be stored alongside the ghost cell locations
 	ScaLBL_AllocateZeroCopy((void **) &sendbuf_x, 5*sendCount_x*sizeof(double));	// Allocate device memory
@@ -340,6 +344,21 @@ int ScaLBL_Communicator::LastInterior(){
 	return last_interior;
 }
 
+void ScaLBL_Communicator::SendRecv(double *sendbuf, int sendcount, int sendrank, double *recvbuf, int recvcount, int recvrank,
+		MPI_Request *sendreq, MPI_Request *recvreq){
+	if (sendrank == rank && recvrank == rank){
+		// the neighbor is this rank (periodic wrap) -- skip MPI and copy the packed halo directly
+		if (sendcount != recvcount) ERROR("ScaLBL_Communicator::SendRecv: local send/recv counts do not match \n");
+		ScaLBL_CopyDeviceToDevice(recvbuf, sendbuf, sendcount*sizeof(double));
+		*sendreq = MPI_REQUEST_NULL;
+		*recvreq = MPI_REQUEST_NULL;
+	}
+	else{
+		MPI_Isend(sendbuf, sendcount,MPI_DOUBLE,sendrank,sendtag,MPI_COMM_SCALBL,sendreq);
+		MPI_Irecv(recvbuf, recvcount,MPI_DOUBLE,recvrank,recvtag,MPI_COMM_SCALBL,recvreq);
+	}
+}
+
 void ScaLBL_Communicator::D3Q19_MapRecv(int Cqx, int Cqy, int Cqz, int *list,  int start, int count,
 		int *d3q19_recvlist){
 	int i,j,k,n,nn,idx;
@@ -371,6 +390,122 @@ void ScaLBL_Communicator::D3Q19_MapRecv(int Cqx, int Cqy, int Cqz, int *list,  i
 	delete [] ReturnDist;
 }
 
+int ScaLBL_Communicator::LayoutLists(int **list, int *count){
+	int *lists[54] = {
+		dvcSendList_x, dvcSendList_y, dvcSendList_z, dvcSendList_X, dvcSendList_Y, dvcSendList_Z,
+		dvcSendList_xy, dvcSendList_xY, dvcSendList_Xy, dvcSendList_XY, dvcSendList_xz, dvcSendList_xZ,
+		dvcSendList_Xz, dvcSendList_XZ, dvcSendList_yz, dvcSendList_yZ, dvcSendList_Yz, dvcSendList_YZ,
+		dvcRecvList_x, dvcRecvList_y, dvcRecvList_z, dvcRecvList_X, dvcRecvList_Y, dvcRecvList_Z,
+		dvcRecvList_xy, dvcRecvList_xY, dvcRecvList_Xy, dvcRecvList_XY, dvcRecvList_xz, dvcRecvList_xZ,
+		dvcRecvList_Xz, dvcRecvList_XZ, dvcRecvList_yz, dvcRecvList_yZ, dvcRecvList_Yz, dvcRecvList_YZ,
+		dvcRecvDist_x, dvcRecvDist_y, dvcRecvDist_z, dvcRecvDist_X, dvcRecvDist_Y, dvcRecvDist_Z,
+		dvcRecvDist_xy, dvcRecvDist_xY, dvcRecvDist_Xy, dvcRecvDist_XY, dvcRecvDist_xz, dvcRecvDist_xZ,
+		dvcRecvDist_Xz, dvcRecvDist_XZ, dvcRecvDist_yz, dvcRecvDist_yZ, dvcRecvDist_Yz, dvcRecvDist_YZ };
+	int counts[54] = {
+		sendCount_x, sendCount_y, sendCount_z, sendCount_X, sendCount_Y, sendCount_Z,
+		sendCount_xy, sendCount_xY, sendCount_Xy, sendCount_XY, sendCount_xz, sendCount_xZ,
+		sendCount_Xz, sendCount_XZ, sendCount_yz, sendCount_yZ, sendCount_Yz, sendCount_YZ,
+		recvCount_x, recvCount_y, recvCount_z, recvCount_X, recvCount_Y, recvCount_Z,
+		recvCount_xy, recvCount_xY, recvCount_Xy, recvCount_XY, recvCount_xz, recvCount_xZ,
+		recvCount_Xz, recvCount_XZ, recvCount_yz, recvCount_yZ, recvCount_Yz, recvCount_YZ,
+		5*recvCount_x, 5*recvCount_y, 5*recvCount_z, 5*recvCount_X, 5*recvCount_Y, 5*recvCount_Z,
+		recvCount_xy, recvCount_xY, recvCount_Xy, recvCount_XY, recvCount_xz, recvCount_xZ,
+		recvCount_Xz, recvCount_XZ, recvCount_yz, recvCount_yZ, recvCount_Yz, recvCount_YZ };
+	for (int q=0; q<54; q++){
+		list[q] = lists[q];
+		count[q] = counts[q];
+	}
+	return 54;
+}
+
+unsigned long long ScaLBL_Communicator::LayoutKey(const char *id){
+	// 64-bit FNV-1a hash of the decomposition followed by the local id field (including the halo)
+	int *list[54];
+	int count[54];
+	int nlists = LayoutLists(list,count);
+	const int format = 2;	// changes whenever the layout file format changes
+	std::vector<int> shape = { format, Nx, Ny, Nz, subx, suby, subz, iproc, jproc, kproc, nprocx, nprocy, nprocz, rank };
+	shape.insert(shape.end(),count,count+nlists);
+	unsigned long long key = 14695981039346656037ULL;
+	const unsigned char *bytes = reinterpret_cast<const unsigned char*>(shape.data());
+	for (size_t b=0; b<shape.size()*sizeof(int); b++){
+		key = (key ^ bytes[b])*1099511628211ULL;
+	}
+	for (int n=0; n<Nx*Ny*Nz; n++){
+		key = (key ^ (unsigned char) id[n])*1099511628211ULL;
+	}
+	return key;
+}
+
+bool ScaLBL_Communicator::ReadLayout(const std::string& filename, IntArray &Map, int *neighborList, const char *id, int &Np){
+	/*
+	 * Restore the state left by MemoryOptimizedLayoutAA from a file written by WriteLayout
+	 *   returns false if the file is missing or was built for another id / decomposition,
+	 *   in which case the layout must be built with MemoryOptimizedLayoutAA
+	 */
+	if (Map.size(0) != (size_t) Nx || Map.size(1) != (size_t) Ny || Map.size(2) != (size_t) Nz)
+		ERROR("ScaLBL_Communicator::ReadLayout: Map array dimensions do not match! \n");
+	FILE *LAYOUT = fopen(filename.c_str(),"rb");
+	if (LAYOUT==NULL) return false;
+	unsigned long long key;
+	int header[5] = {0,0,0,0,0};
+	// header: Nx*Ny*Nz, Np, next, first_interior, last_interior
+	bool valid = fread(&key,sizeof(key),1,LAYOUT)==1 && key==LayoutKey(id);
+	valid = valid && fread(header,sizeof(int),5,LAYOUT)==5 && header[0]==Nx*Ny*Nz;
+	int np = header[1];
+	valid = valid && fread(Map.data(),sizeof(int),Nx*Ny*Nz,LAYOUT)==size_t(Nx*Ny*Nz);
+	valid = valid && fread(neighborList,sizeof(int),18*np,LAYOUT)==size_t(18*np);
+	if (valid){
+		// the device lists are only overwritten once the whole file has been read
+		int *list[54];
+		int count[54];
+		int nlists = LayoutLists(list,count);
+		std::vector<int> offset(nlists+1,0);
+		for (int q=0; q<nlists; q++) offset[q+1] = offset[q]+count[q];
+		std::vector<int> TempBuffer(offset[nlists]);
+		valid = fread(TempBuffer.data(),sizeof(int),TempBuffer.size(),LAYOUT)==TempBuffer.size();
+		if (valid){
+			for (int q=0; q<nlists; q++)
+				ScaLBL_CopyToDevice(list[q],&TempBuffer[offset[q]],count[q]*sizeof(int));
+		}
+	}
+	fclose(LAYOUT);
+	if (!valid){
+		Map.fill(-2);
+		return false;
+	}
+	Np = np;
+	next = header[2];
+	first_interior = header[3];
+	last_interior = header[4];
+	// N matches the dense structure, as after MemoryOptimizedLayoutAA
+	N = Np;
+	return true;
+}
+
+void ScaLBL_Communicator::WriteLayout(const std::string& filename, const IntArray &Map, const int *neighborList, const char *id, int Np){
+	int *list[54];
+	int count[54];
+	int nlists = LayoutLists(list,count);
+	FILE *LAYOUT = fopen(filename.c_str(),"wb");
+	if (LAYOUT==NULL){
+		printf("ScaLBL_Communicator::WriteLayout: could not open %s \n",filename.c_str());
+		return;
+	}
+	unsigned long long key = LayoutKey(id);
+	int header[5] = { Nx*Ny*Nz, Np, next, first_interior, last_interior };
+	fwrite(&key,sizeof(key),1,LAYOUT);
+	fwrite(header,sizeof(int),5,LAYOUT);
+	fwrite(Map.data(),sizeof(int),Nx*Ny*Nz,LAYOUT);
+	fwrite(neighborList,sizeof(int),18*Np,LAYOUT);
+	for (int q=0; q<nlists; q++){
+		std::vector<int> TempBuffer(count[q]);
+		ScaLBL_CopyToHost(TempBuffer.data(),list[q],count[q]*sizeof(int));
+		fwrite(TempBuffer.data(),sizeof(int),count[q],LAYOUT);
+	}
+	fclose(LAYOUT);
+}
+
 int ScaLBL_Communicator::MemoryOptimizedLayoutAA(IntArray &Map, int *neighborList, char *id, int Np){
 	/*
 	 * Generate a memory optimized layout
@@ -381,78 +516,112 @@ int ScaLBL_Communicator::MemoryOptimizedLayoutAA(IntArray &Map, int *neighborLis
 	 *   the index in the Send and Recv lists is also updated
 	 *   this means that the commuincations are no longer valid for regular data structures
 	 */
-	int idx,i,j,k,n;
+	int idx,i,n;
 
 	// Check that Map has size matching sub-domain
 	if (Map.size(0) != Nx)
 		ERROR("ScaLBL_Communicator::MemoryOptimizedLayout: Map array dimensions do not match! \n");
 
-	// Initialize Map, including ghost cells
-	for (k=0;k<Nz;k++){
-		for (j=0;j<Ny;j++){
-			for (i=0;i<Nx;i++){
-				Map(i,j,k) = -2;
+	// Initialize Map: ghost cells are -2, the rest is solid (-1) until indexed below
+#ifdef USE_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int k=0;k<Nz;k++){
+		for (int j=0;j<Ny;j++){
+			for (int i=0;i<Nx;i++){
+				if (i==0 || j==0 || k==0 || i==Nx-1 || j==Ny-1 || k==Nz-1) Map(i,j,k) = -2;
+				else Map(i,j,k) = -1;
 			}
 		}
 	}
 
-	//printf("Exterior... \n");
-
+	// Both steps below count the pores of each piece in parallel, then index the pieces
+	// from the prefix sum of the counts, so the ordering matches a serial sweep
 	// ********* Exterior **********
 	// Step 1/2: Index the outer walls of the grid, exclude the ghost cells.
-	// solid is -1, and pores are seqientially indexed
-	idx=0;	next=0;
-	for (k=1; k<Nz-1; k++){
-		for (j=1; j<Ny-1; j++){
-			for (i=1; i<Nx-1; i++){
-				// domain interior
-				Map(i,j,k) = -1;
-				// Local index
-				n = k*Nx*Ny+j*Nx+i;
-				if (id[n] > 0){
-					// Counts for the six faces
-					if (i==1)       Map(n)=idx++;
-					else if (j==1)  Map(n)=idx++;
-					else if (k==1)  Map(n)=idx++;
-					else if (i==Nx-2)  Map(n)=idx++;
-					else if (j==Ny-2)  Map(n)=idx++;
-					else if (k==Nz-2)  Map(n)=idx++;
+	// solid is -1, and pores are seqientially indexed (one piece per plane)
+	std::vector<int> plane_start(Nz+1,0);
+	for (int pass=0; pass<2; pass++){
+#ifdef USE_OPENMP
+		#pragma omp parallel for schedule(dynamic)
+#endif
+		for (int k=1; k<Nz-1; k++){
+			int idx = (pass==1) ? plane_start[k] : 0;
+			for (int j=1; j<Ny-1; j++){
+				// away from the z and y walls only the two x walls are visited
+				int di = (k==1 || k==Nz-2 || j==1 || j==Ny-2) ? 1 : std::max(Nx-3,1);
+				for (int i=1; i<Nx-1; i+=di){
+					int n = k*Nx*Ny+j*Nx+i;
+					if (id[n] > 0){
+						if (pass==1) Map(n) = idx;
+						idx++;
+					}
 				}
 			}
+			if (pass==0) plane_start[k+1] = idx;
+		}
+		if (pass==0){
+			for (int k=1; k<Nz-1; k++) plane_start[k+1] += plane_start[k];
 		}
 	}
-	next=idx;
+	next = plane_start[std::max(Nz-1,1)];
 	
 	//printf("Interior... \n");
 	
 	// ********* Interior **********
 	// align the next read
 	first_interior=(next/16 + 1)*16; //what the hell is this
-	idx = first_interior;
 	// Step 2/2: Next loop over the domain interior in block-cyclic fashion
-	for (k=2; k<Nz-2; k++){
-		for (j=2; j<Ny-2; j++){
-			for (i=2; i<Nx-2; i++){
-				// Local index (regular layout)
-				n = k*Nx*Ny + j*Nx + i;
-				if (id[n] > 0 ){
-					Map(n) = idx++;
-					//neighborList[idx++] = n; // index of self in regular layout
+	// each sub-block is stored contiguously, so the interior sweep stays within a cache-sized block
+	std::vector<std::array<int,3>> blocks;
+	for (int kb=2; kb<Nz-2; kb+=subz){
+		for (int jb=2; jb<Ny-2; jb+=suby){
+			for (int ib=2; ib<Nx-2; ib+=subx){
+				blocks.push_back({ ib, jb, kb });
+			}
+		}
+	}
+	int nblocks = blocks.size();
+	std::vector<int> offset(nblocks+1,0);
+	offset[0] = first_interior;
+	for (int pass=0; pass<2; pass++){
+#ifdef USE_OPENMP
+		#pragma omp parallel for schedule(dynamic)
+#endif
+		for (int b=0; b<nblocks; b++){
+			int ib = blocks[b][0], jb = blocks[b][1], kb = blocks[b][2];
+			int idx = (pass==1) ? offset[b] : 0;
+			for (int k=kb; k<std::min(kb+subz,Nz-2); k++){
+				for (int j=jb; j<std::min(jb+suby,Ny-2); j++){
+					for (int i=ib; i<std::min(ib+subx,Nx-2); i++){
+						// Local index (regular layout)
+						int n = k*Nx*Ny + j*Nx + i;
+						if (id[n] > 0 ){
+							if (pass==1) Map(n) = idx;
+							idx++;
+						}
+					}
 				}
 			}
+			if (pass==0) offset[b+1] = idx;
+		}
+		if (pass==0){
+			for (int b=0; b<nblocks; b++) offset[b+1] += offset[b];
 		}
 	}
-	last_interior=idx;
+	last_interior=offset[nblocks];
 	
 	Np = (last_interior/16 + 1)*16;
 	//printf("    Np=%i \n",Np);
 		
 	// Now use Map to determine the neighbors for each lattice direction
-	for (k=1;k<Nz-1;k++){
-		for (j=1;j<Ny-1;j++){
-			for (i=1;i<Nx-1;i++){
-				n=k*Nx*Ny+j*Nx+i;
-				idx=Map(i,j,k);
+#ifdef USE_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int k=1;k<Nz-1;k++){
+		for (int j=1;j<Ny-1;j++){
+			for (int i=1;i<Nx-1;i++){
+				int idx=Map(i,j,k);
 				if (idx > Np) printf("ScaLBL_Communicator::MemoryOptimizedLayout: Map(%i,%i,%i) = %i > %i \n",i,j,k,Map(i,j,k),Np);
 				else if (!(idx<0)){
 					// store the idx associated with each neighbor
@@ -1045,8 +1214,7 @@ void ScaLBL_Communicator::SendD3Q19AA(double *dist){
 	ScaLBL_D3Q19_Pack(12,dvcSendList_x,3*sendCount_x,sendCount_x,sendbuf_x,dist,N);
 	ScaLBL_D3Q19_Pack(14,dvcSendList_x,4*sendCount_x,sendCount_x,sendbuf_x,dist,N);
 	
-	MPI_Isend(sendbuf_x, 5*sendCount_x,MPI_DOUBLE,rank_x,sendtag,MPI_COMM_SCALBL,&req1[0]);
-	MPI_Irecv(recvbuf_X, 5*recvCount_X,MPI_DOUBLE,rank_X,recvtag,MPI_COMM_SCALBL,&req2[0]);
+	SendRecv(sendbuf_x, 5*sendCount_x,rank_x,recvbuf_X, 5*recvCount_X,rank_X,&req1[0],&req2[0]);
 	//...Packing for X face(1,7,9,11,13)................................
 	ScaLBL_D3Q19_Pack(1,dvcSendList_X,0,sendCount_X,sendbuf_X,dist,N);
 	ScaLBL_D3Q19_Pack(7,dvcSendList_X,sendCount_X,sendCount_X,sendbuf_X,dist,N);
@@ -1054,8 +1222,7 @@ void ScaLBL_Communicator::SendD3Q19AA(double *dist){
 	ScaLBL_D3Q19_Pack(11,dvcSendList_X,3*sendCount_X,sendCount_X,sendbuf_X,dist,N);
 	ScaLBL_D3Q19_Pack(13,dvcSendList_X,4*sendCount_X,sendCount_X,sendbuf_X,dist,N);
 	
-	MPI_Isend(sendbuf_X, 5*sendCount_X,MPI_DOUBLE,rank_X,sendtag,MPI_COMM_SCALBL,&req1[1]);
-	MPI_Irecv(recvbuf_x, 5*recvCount_x,MPI_DOUBLE,rank_x,recvtag,MPI_COMM_SCALBL,&req2[1]);
+	SendRecv(sendbuf_X, 5*sendCount_X,rank_X,recvbuf_x, 5*recvCount_x,rank_x,&req1[1],&req2[1]);
 	//...Packing for y face(4,8,9,16,18).................................
 	ScaLBL_D3Q19_Pack(4,dvcSendList_y,0,sendCount_y,sendbuf_y,dist,N);
 	ScaLBL_D3Q19_Pack(8,dvcSendList_y,sendCount_y,sendCount_y,sendbuf_y,dist,N);
@@ -1063,8 +1230,7 @@ void ScaLBL_Communicator::SendD3Q19AA(double *dist){
 	ScaLBL_D3Q19_Pack(16,dvcSendList_y,3*sendCount_y,sendCount_y,sendbuf_y,dist,N);
 	ScaLBL_D3Q19_Pack(18,dvcSendList_y,4*sendCount_y,sendCount_y,sendbuf_y,dist,N);
 	
-	MPI_Isend(sendbuf_y, 5*sendCount_y,MPI_DOUBLE,rank_y,sendtag,MPI_COMM_SCALBL,&req1[2]);
-	MPI_Irecv(recvbuf_Y, 5*recvCount_Y,MPI_DOUBLE,rank_Y,recvtag,MPI_COMM_SCALBL,&req2[2]);
+	SendRecv(sendbuf_y, 5*sendCount_y,rank_y,recvbuf_Y, 5*recvCount_Y,rank_Y,&req1[2],&req2[2]);
 	//...Packing for Y face(3,7,10,15,17).................................
 	ScaLBL_D3Q19_Pack(3,dvcSendList_Y,0,sendCount_Y,sendbuf_Y,dist,N);
 	ScaLBL_D3Q19_Pack(7,dvcSendList_Y,sendCount_Y,sendCount_Y,sendbuf_Y,dist,N);
@@ -1072,8 +1238,7 @@ void ScaLBL_Communicator::SendD3Q19AA(double *dist){
 	ScaLBL_D3Q19_Pack(15,dvcSendList_Y,3*sendCount_Y,sendCount_Y,sendbuf_Y,dist,N);
 	ScaLBL_D3Q19_Pack(17,dvcSendList_Y,4*sendCount_Y,sendCount_Y,sendbuf_Y,dist,N);
 	
-	MPI_Isend(sendbuf_Y, 5*sendCount_Y,MPI_DOUBLE,rank_Y,sendtag,MPI_COMM_SCALBL,&req1[3]);
-	MPI_Irecv(recvbuf_y, 5*recvCount_y,MPI_DOUBLE,rank_y,recvtag,MPI_COMM_SCALBL,&req2[3]);
+	SendRecv(sendbuf_Y, 5*sendCount_Y,rank_Y,recvbuf_y, 5*recvCount_y,rank_y,&req1[3],&req2[3]);
 	//...Packing for z face(6,12,13,16,17)................................
 	ScaLBL_D3Q19_Pack(6,dvcSendList_z,0,sendCount_z,sendbuf_z,dist,N);
 	ScaLBL_D3Q19_Pack(12,dvcSendList_z,sendCount_z,sendCount_z,sendbuf_z,dist,N);
@@ -1081,8 +1246,7 @@ void ScaLBL_Communicator::SendD3Q19AA(double *dist){
 	ScaLBL_D3Q19_Pack(16,dvcSendList_z,3*sendCount_z,sendCount_z,sendbuf_z,dist,N);
 	ScaLBL_D3Q19_Pack(17,dvcSendList_z,4*sendCount_z,sendCount_z,sendbuf_z,dist,N);
 	
-	MPI_Isend(sendbuf_z, 5*sendCount_z,MPI_DOUBLE,rank_z,sendtag,MPI_COMM_SCALBL,&req1[4]);
-	MPI_Irecv(recvbuf_Z, 5*recvCount_Z,MPI_DOUBLE,rank_Z,recvtag,MPI_COMM_SCALBL,&req2[4]);
+	SendRecv(sendbuf_z, 5*sendCount_z,rank_z,recvbuf_Z, 5*recvCount_Z,rank_Z,&req1[4],&req2[4]);
 	
 	//...Packing for Z face(5,11,14,15,18)................................
 	ScaLBL_D3Q19_Pack(5,dvcSendList_Z,0,sendCount_Z,sendbuf_Z,dist,N);
@@ -1091,57 +1255,44 @@ void ScaLBL_Communicator::SendD3Q19AA(double *dist){
 	ScaLBL_D3Q19_Pack(15,dvcSendList_Z,3*sendCount_Z,sendCount_Z,sendbuf_Z,dist,N);
 	ScaLBL_D3Q19_Pack(18,dvcSendList_Z,4*sendCount_Z,sendCount_Z,sendbuf_Z,dist,N);
 	
-	MPI_Isend(sendbuf_Z, 5*sendCount_Z,MPI_DOUBLE,rank_Z,sendtag,MPI_COMM_SCALBL,&req1[5]);
-	MPI_Irecv(recvbuf_z, 5*recvCount_z,MPI_DOUBLE,rank_z,recvtag,MPI_COMM_SCALBL,&req2[5]);
+	SendRecv(sendbuf_Z, 5*sendCount_Z,rank_Z,recvbuf_z, 5*recvCount_z,rank_z,&req1[5],&req2[5]);
 	
 	//...Pack the xy edge (8)................................
 	ScaLBL_D3Q19_Pack(8,dvcSendList_xy,0,sendCount_xy,sendbuf_xy,dist,N);
-	MPI_Isend(sendbuf_xy, sendCount_xy,MPI_DOUBLE,rank_xy,sendtag,MPI_COMM_SCALBL,&req1[6]);
-	MPI_Irecv(recvbuf_XY, recvCount_XY,MPI_DOUBLE,rank_XY,recvtag,MPI_COMM_SCALBL,&req2[6]);
+	SendRecv(sendbuf_xy, sendCount_xy,rank_xy,recvbuf_XY, recvCount_XY,rank_XY,&req1[6],&req2[6]);
 	//...Pack the Xy edge (9)................................
 	ScaLBL_D3Q19_Pack(9,dvcSendList_Xy,0,sendCount_Xy,sendbuf_Xy,dist,N);
-	MPI_Isend(sendbuf_Xy, sendCount_Xy,MPI_DOUBLE,rank_Xy,sendtag,MPI_COMM_SCALBL,&req1[8]);
-	MPI_Irecv(recvbuf_xY, recvCount_xY,MPI_DOUBLE,rank_xY,recvtag,MPI_COMM_SCALBL,&req2[8]);
+	SendRecv(sendbuf_Xy, sendCount_Xy,rank_Xy,recvbuf_xY, recvCount_xY,rank_xY,&req1[8],&req2[8]);
 	//...Pack the xY edge (10)................................
 	ScaLBL_D3Q19_Pack(10,dvcSendList_xY,0,sendCount_xY,sendbuf_xY,dist,N);
-	MPI_Isend(sendbuf_xY, sendCount_xY,MPI_DOUBLE,rank_xY,sendtag,MPI_COMM_SCALBL,&req1[9]);
-	MPI_Irecv(recvbuf_Xy, recvCount_Xy,MPI_DOUBLE,rank_Xy,recvtag,MPI_COMM_SCALBL,&req2[9]);
+	SendRecv(sendbuf_xY, sendCount_xY,rank_xY,recvbuf_Xy, recvCount_Xy,rank_Xy,&req1[9],&req2[9]);
 	//...Pack the XY edge (7)................................
 	ScaLBL_D3Q19_Pack(7,dvcSendList_XY,0,sendCount_XY,sendbuf_XY,dist,N);
-	MPI_Isend(sendbuf_XY, sendCount_XY,MPI_DOUBLE,rank_XY,sendtag,MPI_COMM_SCALBL,&req1[7]);
-	MPI_Irecv(recvbuf_xy, recvCount_xy,MPI_DOUBLE,rank_xy,recvtag,MPI_COMM_SCALBL,&req2[7]);
+	SendRecv(sendbuf_XY, sendCount_XY,rank_XY,recvbuf_xy, recvCount_xy,rank_xy,&req1[7],&req2[7]);
 	//...Pack the xz edge (12)................................
 	ScaLBL_D3Q19_Pack(12,dvcSendList_xz,0,sendCount_xz,sendbuf_xz,dist,N);
-	MPI_Isend(sendbuf_xz, sendCount_xz,MPI_DOUBLE,rank_xz,sendtag,MPI_COMM_SCALBL,&req1[10]);
-	MPI_Irecv(recvbuf_XZ, recvCount_XZ,MPI_DOUBLE,rank_XZ,recvtag,MPI_COMM_SCALBL,&req2[10]);
+	SendRecv(sendbuf_xz, sendCount_xz,rank_xz,recvbuf_XZ, recvCount_XZ,rank_XZ,&req1[10],&req2[10]);
 	//...Pack the xZ edge (14)................................
 	ScaLBL_D3Q19_Pack(14,dvcSendList_xZ,0,sendCount_xZ,sendbuf_xZ,dist,N);
-	MPI_Isend(sendbuf_xZ, sendCount_xZ,MPI_DOUBLE,rank_xZ,sendtag,MPI_COMM_SCALBL,&req1[13]);
-	MPI_Irecv(recvbuf_Xz, recvCount_Xz,MPI_DOUBLE,rank_Xz,recvtag,MPI_COMM_SCALBL,&req2[13]);
+	SendRecv(sendbuf_xZ, sendCount_xZ,rank_xZ,recvbuf_Xz, recvCount_Xz,rank_Xz,&req1[13],&req2[13]);
 	//...Pack the Xz edge (13)................................
 	ScaLBL_D3Q19_Pack(13,dvcSendList_Xz,0,sendCount_Xz,sendbuf_Xz,dist,N);
-	MPI_Isend(sendbuf_Xz, sendCount_Xz,MPI_DOUBLE,rank_Xz,sendtag,MPI_COMM_SCALBL,&req1[12]);
-	MPI_Irecv(recvbuf_xZ, recvCount_xZ,MPI_DOUBLE,rank_xZ,recvtag,MPI_COMM_SCALBL,&req2[12]);
+	SendRecv(sendbuf_Xz, sendCount_Xz,rank_Xz,recvbuf_xZ, recvCount_xZ,rank_xZ,&req1[12],&req2[12]);
 	//...Pack the XZ edge (11)................................
 	ScaLBL_D3Q19_Pack(11,dvcSendList_XZ,0,sendCount_XZ,sendbuf_XZ,dist,N);
-	MPI_Isend(sendbuf_XZ, sendCount_XZ,MPI_DOUBLE,rank_XZ,sendtag,MPI_COMM_SCALBL,&req1[11]);
-	MPI_Irecv(recvbuf_xz, recvCount_xz,MPI_DOUBLE,rank_xz,recvtag,MPI_COMM_SCALBL,&req2[11]);
+	SendRecv(sendbuf_XZ, sendCount_XZ,rank_XZ,recvbuf_xz, recvCount_xz,rank_xz,&req1[11],&req2[11]);
 	//...Pack the yz edge (16)................................
 	ScaLBL_D3Q19_Pack(16,dvcSendList_yz,0,sendCount_yz,sendbuf_yz,dist,N);
-	MPI_Isend(sendbuf_yz, sendCount_yz,MPI_DOUBLE,rank_yz,sendtag,MPI_COMM_SCALBL,&req1[14]);
-	MPI_Irecv(recvbuf_YZ, recvCount_YZ,MPI_DOUBLE,rank_YZ,recvtag,MPI_COMM_SCALBL,&req2[14]);
+	SendRecv(sendbuf_yz, sendCount_yz,rank_yz,recvbuf_YZ, recvCount_YZ,rank_YZ,&req1[14],&req2[14]);
 	//...Pack the yZ edge (18)................................
 	ScaLBL_D3Q19_Pack(18,dvcSendList_yZ,0,sendCount_yZ,sendbuf_yZ,dist,N);
-	MPI_Isend(sendbuf_yZ, sendCount_yZ,MPI_DOUBLE,rank_yZ,sendtag,MPI_COMM_SCALBL,&req1[17]);
-	MPI_Irecv(recvbuf_Yz, recvCount_Yz,MPI_DOUBLE,rank_Yz,recvtag,MPI_COMM_SCALBL,&req2[17]);
+	SendRecv(sendbuf_yZ, sendCount_yZ,rank_yZ,recvbuf_Yz, recvCount_Yz,rank_Yz,&req1[17],&req2[17]);
 	//...Pack the Yz edge (17)................................
 	ScaLBL_D3Q19_Pack(17,dvcSendList_Yz,0,sendCount_Yz,sendbuf_Yz,dist,N);
-	MPI_Isend(sendbuf_Yz, sendCount_Yz,MPI_DOUBLE,rank_Yz,sendtag,MPI_COMM_SCALBL,&req1[16]);
-	MPI_Irecv(recvbuf_yZ, recvCount_yZ,MPI_DOUBLE,rank_yZ,recvtag,MPI_COMM_SCALBL,&req2[16]);
+	SendRecv(sendbuf_Yz, sendCount_Yz,rank_Yz,recvbuf_yZ, recvCount_yZ,rank_yZ,&req1[16],&req2[16]);
 	//...Pack the YZ edge (15)................................
 	ScaLBL_D3Q19_Pack(15,dvcSendList_YZ,0,sendCount_YZ,sendbuf_YZ,dist,N);
-	MPI_Isend(sendbuf_YZ, sendCount_YZ,MPI_DOUBLE,rank_YZ,sendtag,MPI_COMM_SCALBL,&req1[15]);
-	MPI_Irecv(recvbuf_yz, recvCount_yz,MPI_DOUBLE,rank_yz,recvtag,MPI_COMM_SCALBL,&req2[15]);
+	SendRecv(sendbuf_YZ, sendCount_YZ,rank_YZ,recvbuf_yz, recvCount_yz,rank_yz,&req1[15],&req2[15]);
 	//...................................................................................
     }
 }
@@ -1329,36 +1480,31 @@ void ScaLBL_Communicator::BiSendD3Q7AA(double *Aq, double *Bq){
 	ScaLBL_D3Q19_Pack(2,dvcSendList_x,0,sendCount_x,sendbuf_x,Aq,N);
 	ScaLBL_D3Q19_Pack(2,dvcSendList_x,sendCount_x,sendCount_x,sendbuf_x,Bq,N);
 
-	MPI_Isend(sendbuf_x, 2*sendCount_x,MPI_DOUBLE,rank_x,sendtag,MPI_COMM_SCALBL,&req1[0]);
-	MPI_Irecv(recvbuf_X, 2*recvCount_X,MPI_DOUBLE,rank_X,recvtag,MPI_COMM_SCALBL,&req2[0]);
+	SendRecv(sendbuf_x, 2*sendCount_x,rank_x,recvbuf_X, 2*recvCount_X,rank_X,&req1[0],&req2[0]);
 	
 	//...Packing for X face(1,7,9,11,13)................................
 	ScaLBL_D3Q19_Pack(1,dvcSendList_X,0,sendCount_X,sendbuf_X,Aq,N);
 	ScaLBL_D3Q19_Pack(1,dvcSendList_X,sendCount_X,sendCount_X,sendbuf_X,Bq,N);
 	
-	MPI_Isend(sendbuf_X, 2*sendCount_X,MPI_DOUBLE,rank_X,sendtag,MPI_COMM_SCALBL,&req1[1]);
-	MPI_Irecv(recvbuf_x, 2*recvCount_x,MPI_DOUBLE,rank_x,recvtag,MPI_COMM_SCALBL,&req2[1]);
+	SendRecv(sendbuf_X, 2*sendCount_X,rank_X,recvbuf_x, 2*recvCount_x,rank_x,&req1[1],&req2[1]);
 
 	//...Packing for y face(4,8,9,16,18).................................
 	ScaLBL_D3Q19_Pack(4,dvcSendList_y,0,sendCount_y,sendbuf_y,Aq,N);
 	ScaLBL_D3Q19_Pack(4,dvcSendList_y,sendCount_y,sendCount_y,sendbuf_y,Bq,N);
 
-	MPI_Isend(sendbuf_y, 2*sendCount_y,MPI_DOUBLE,rank_y,sendtag,MPI_COMM_SCALBL,&req1[2]);
-	MPI_Irecv(recvbuf_Y, 2*recvCount_Y,MPI_DOUBLE,rank_Y,recvtag,MPI_COMM_SCALBL,&req2[2]);
+	SendRecv(sendbuf_y, 2*sendCount_y,rank_y,recvbuf_Y, 2*recvCount_Y,rank_Y,&req1[2],&req2[2]);
 	
 	//...Packing for Y face(3,7,10,15,17).................................
 	ScaLBL_D3Q19_Pack(3,dvcSendList_Y,0,sendCount_Y,sendbuf_Y,Aq,N);
 	ScaLBL_D3Q19_Pack(3,dvcSendList_Y,sendCount_Y,sendCount_Y,sendbuf_Y,Bq,N);
 
-	MPI_Isend(sendbuf_Y, 2*sendCount_Y,MPI_DOUBLE,rank_Y,sendtag,MPI_COMM_SCALBL,&req1[3]);
-	MPI_Irecv(recvbuf_y, 2*recvCount_y,MPI_DOUBLE,rank_y,recvtag,MPI_COMM_SCALBL,&req2[3]);
+	SendRecv(sendbuf_Y, 2*sendCount_Y,rank_Y,recvbuf_y, 2*recvCount_y,rank_y,&req1[3],&req2[3]);
 	
 	//...Packing for z face(6,12,13,16,17)................................
 	ScaLBL_D3Q19_Pack(6,dvcSendList_z,0,sendCount_z,sendbuf_z,Aq,N);
 	ScaLBL_D3Q19_Pack(6,dvcSendList_z,sendCount_z,sendCount_z,sendbuf_z,Bq,N);
 	
-	MPI_Isend(sendbuf_z, 2*sendCount_z,MPI_DOUBLE,rank_z,sendtag,MPI_COMM_SCALBL,&req1[4]);
-	MPI_Irecv(recvbuf_Z, 2*recvCount_Z,MPI_DOUBLE,rank_Z,recvtag,MPI_COMM_SCALBL,&req2[4]);
+	SendRecv(sendbuf_z, 2*sendCount_z,rank_z,recvbuf_Z, 2*recvCount_Z,rank_Z,&req1[4],&req2[4]);
 	
 	//...Packing for Z face(5,11,14,15,18)................................
 	ScaLBL_D3Q19_Pack(5,dvcSendList_Z,0,sendCount_Z,sendbuf_Z,Aq,N);
@@ -1366,8 +1512,7 @@ void ScaLBL_Communicator::BiSendD3Q7AA(double *Aq, double *Bq){
 
 	//...................................................................................
 	// Send all the distributions
-	MPI_Isend(sendbuf_Z, 2*sendCount_Z,MPI_DOUBLE,rank_Z,sendtag,MPI_COMM_SCALBL,&req1[5]);
-	MPI_Irecv(recvbuf_z, 2*recvCount_z,MPI_DOUBLE,rank_z,recvtag,MPI_COMM_SCALBL,&req2[5]);
+	SendRecv(sendbuf_Z, 2*sendCount_Z,rank_Z,recvbuf_z, 2*recvCount_z,rank_z,&req1[5],&req2[5]);
     }
 }
 
@@ -1469,18 +1614,12 @@ void ScaLBL_Communicator::TriSendD3Q7AA(double *Aq, double *Bq, double *Cq){
 
 	//...................................................................................
 	// Send all the distributions
-	MPI_Isend(sendbuf_x, 3*sendCount_x,MPI_DOUBLE,rank_x,sendtag,MPI_COMM_SCALBL,&req1[0]);
-	MPI_Irecv(recvbuf_X, 3*recvCount_X,MPI_DOUBLE,rank_X,recvtag,MPI_COMM_SCALBL,&req2[0]);
-	MPI_Isend(sendbuf_X, 3*sendCount_X,MPI_DOUBLE,rank_X,sendtag,MPI_COMM_SCALBL,&req1[1]);
-	MPI_Irecv(recvbuf_x, 3*recvCount_x,MPI_DOUBLE,rank_x,recvtag,MPI_COMM_SCALBL,&req2[1]);
-	MPI_Isend(sendbuf_y, 3*sendCount_y,MPI_DOUBLE,rank_y,sendtag,MPI_COMM_SCALBL,&req1[2]);
-	MPI_Irecv(recvbuf_Y, 3*recvCount_Y,MPI_DOUBLE,rank_Y,recvtag,MPI_COMM_SCALBL,&req2[2]);
-	MPI_Isend(sendbuf_Y, 3*sendCount_Y,MPI_DOUBLE,rank_Y,sendtag,MPI_COMM_SCALBL,&req1[3]);
-	MPI_Irecv(recvbuf_y, 3*recvCount_y,MPI_DOUBLE,rank_y,recvtag,MPI_COMM_SCALBL,&req2[3]);
-	MPI_Isend(sendbuf_z, 3*sendCount_z,MPI_DOUBLE,rank_z,sendtag,MPI_COMM_SCALBL,&req1[4]);
-	MPI_Irecv(recvbuf_Z, 3*recvCount_Z,MPI_DOUBLE,rank_Z,recvtag,MPI_COMM_SCALBL,&req2[4]);
-	MPI_Isend(sendbuf_Z, 3*sendCount_Z,MPI_DOUBLE,rank_Z,sendtag,MPI_COMM_SCALBL,&req1[5]);
-	MPI_Irecv(recvbuf_z, 3*recvCount_z,MPI_DOUBLE,rank_z,recvtag,MPI_COMM_SCALBL,&req2[5]);
+	SendRecv(sendbuf_x, 3*sendCount_x,rank_x,recvbuf_X, 3*recvCount_X,rank_X,&req1[0],&req2[0]);
+	SendRecv(sendbuf_X, 3*sendCount_X,rank_X,recvbuf_x, 3*recvCount_x,rank_x,&req1[1],&req2[1]);
+	SendRecv(sendbuf_y, 3*sendCount_y,rank_y,recvbuf_Y, 3*recvCount_Y,rank_Y,&req1[2],&req2[2]);
+	SendRecv(sendbuf_Y, 3*sendCount_Y,rank_Y,recvbuf_y, 3*recvCount_y,rank_y,&req1[3],&req2[3]);
+	SendRecv(sendbuf_z, 3*sendCount_z,rank_z,recvbuf_Z, 3*recvCount_Z,rank_Z,&req1[4],&req2[4]);
+	SendRecv(sendbuf_Z, 3*sendCount_Z,rank_Z,recvbuf_z, 3*recvCount_z,rank_z,&req1[5],&req2[5]);
     }
 }
 
@@ -1586,42 +1725,24 @@ void ScaLBL_Communicator::SendHalo(double *data){
 	// Send / Recv all the phase indcator field values
 	//...................................................................................
 
-	MPI_Isend(sendbuf_x, sendCount_x,MPI_DOUBLE,rank_x,sendtag,MPI_COMM_SCALBL,&req1[0]);
-	MPI_Irecv(recvbuf_X, recvCount_X,MPI_DOUBLE,rank_X,recvtag,MPI_COMM_SCALBL,&req2[0]);
-	MPI_Isend(sendbuf_X, sendCount_X,MPI_DOUBLE,rank_X,sendtag,MPI_COMM_SCALBL,&req1[1]);
-	MPI_Irecv(recvbuf_x, recvCount_x,MPI_DOUBLE,rank_x,recvtag,MPI_COMM_SCALBL,&req2[1]);
-	MPI_Isend(sendbuf_y, sendCount_y,MPI_DOUBLE,rank_y,sendtag,MPI_COMM_SCALBL,&req1[2]);
-	MPI_Irecv(recvbuf_Y, recvCount_Y,MPI_DOUBLE,rank_Y,recvtag,MPI_COMM_SCALBL,&req2[2]);
-	MPI_Isend(sendbuf_Y, sendCount_Y,MPI_DOUBLE,rank_Y,sendtag,MPI_COMM_SCALBL,&req1[3]);
-	MPI_Irecv(recvbuf_y, recvCount_y,MPI_DOUBLE,rank_y,recvtag,MPI_COMM_SCALBL,&req2[3]);
-	MPI_Isend(sendbuf_z, sendCount_z,MPI_DOUBLE,rank_z,sendtag,MPI_COMM_SCALBL,&req1[4]);
-	MPI_Irecv(recvbuf_Z, recvCount_Z,MPI_DOUBLE,rank_Z,recvtag,MPI_COMM_SCALBL,&req2[4]);
-	MPI_Isend(sendbuf_Z, sendCount_Z,MPI_DOUBLE,rank_Z,sendtag,MPI_COMM_SCALBL,&req1[5]);
-	MPI_Irecv(recvbuf_z, recvCount_z,MPI_DOUBLE,rank_z,recvtag,MPI_COMM_SCALBL,&req2[5]);
-	MPI_Isend(sendbuf_xy, sendCount_xy,MPI_DOUBLE,rank_xy,sendtag,MPI_COMM_SCALBL,&req1[6]);
-	MPI_Irecv(recvbuf_XY, recvCount_XY,MPI_DOUBLE,rank_XY,recvtag,MPI_COMM_SCALBL,&req2[6]);
-	MPI_Isend(sendbuf_XY, sendCount_XY,MPI_DOUBLE,rank_XY,sendtag,MPI_COMM_SCALBL,&req1[7]);
-	MPI_Irecv(recvbuf_xy, recvCount_xy,MPI_DOUBLE,rank_xy,recvtag,MPI_COMM_SCALBL,&req2[7]);
-	MPI_Isend(sendbuf_Xy, sendCount_Xy,MPI_DOUBLE,rank_Xy,sendtag,MPI_COMM_SCALBL,&req1[8]);
-	MPI_Irecv(recvbuf_xY, recvCount_xY,MPI_DOUBLE,rank_xY,recvtag,MPI_COMM_SCALBL,&req2[8]);
-	MPI_Isend(sendbuf_xY, sendCount_xY,MPI_DOUBLE,rank_xY,sendtag,MPI_COMM_SCALBL,&req1[9]);
-	MPI_Irecv(recvbuf_Xy, recvCount_Xy,MPI_DOUBLE,rank_Xy,recvtag,MPI_COMM_SCALBL,&req2[9]);
-	MPI_Isend(sendbuf_xz, sendCount_xz,MPI_DOUBLE,rank_xz,sendtag,MPI_COMM_SCALBL,&req1[10]);
-	MPI_Irecv(recvbuf_XZ, recvCount_XZ,MPI_DOUBLE,rank_XZ,recvtag,MPI_COMM_SCALBL,&req2[10]);
-	MPI_Isend(sendbuf_XZ, sendCount_XZ,MPI_DOUBLE,rank_XZ,sendtag,MPI_COMM_SCALBL,&req1[11]);
-	MPI_Irecv(recvbuf_xz, recvCount_xz,MPI_DOUBLE,rank_xz,recvtag,MPI_COMM_SCALBL,&req2[11]);
-	MPI_Isend(sendbuf_Xz, sendCount_Xz,MPI_DOUBLE,rank_Xz,sendtag,MPI_COMM_SCALBL,&req1[12]);
-	MPI_Irecv(recvbuf_xZ, recvCount_xZ,MPI_DOUBLE,rank_xZ,recvtag,MPI_COMM_SCALBL,&req2[12]);
-	MPI_Isend(sendbuf_xZ, sendCount_xZ,MPI_DOUBLE,rank_xZ,sendtag,MPI_COMM_SCALBL,&req1[13]);
-	MPI_Irecv(recvbuf_Xz, recvCount_Xz,MPI_DOUBLE,rank_Xz,recvtag,MPI_COMM_SCALBL,&req2[13]);
-	MPI_Isend(sendbuf_yz, sendCount_yz,MPI_DOUBLE,rank_yz,sendtag,MPI_COMM_SCALBL,&req1[14]);
-	MPI_Irecv(recvbuf_YZ, recvCount_YZ,MPI_DOUBLE,rank_YZ,recvtag,MPI_COMM_SCALBL,&req2[14]);
-	MPI_Isend(sendbuf_YZ, sendCount_YZ,MPI_DOUBLE,rank_YZ,sendtag,MPI_COMM_SCALBL,&req1[15]);
-	MPI_Irecv(recvbuf_yz, recvCount_yz,MPI_DOUBLE,rank_yz,recvtag,MPI_COMM_SCALBL,&req2[15]);
-	MPI_Isend(sendbuf_Yz, sendCount_Yz,MPI_DOUBLE,rank_Yz,sendtag,MPI_COMM_SCALBL,&req1[16]);
-	MPI_Irecv(recvbuf_yZ, recvCount_yZ,MPI_DOUBLE,rank_yZ,recvtag,MPI_COMM_SCALBL,&req2[16]);
-	MPI_Isend(sendbuf_yZ, sendCount_yZ,MPI_DOUBLE,rank_yZ,sendtag,MPI_COMM_SCALBL,&req1[17]);
-	MPI_Irecv(recvbuf_Yz, recvCount_Yz,MPI_DOUBLE,rank_Yz,recvtag,MPI_COMM_SCALBL,&req2[17]);
+	SendRecv(sendbuf_x, sendCount_x,rank_x,recvbuf_X, recvCount_X,rank_X,&req1[0],&req2[0]);
+	SendRecv(sendbuf_X, sendCount_X,rank_X,recvbuf_x, recvCount_x,rank_x,&req1[1],&req2[1]);
+	SendRecv(sendbuf_y, sendCount_y,rank_y,recvbuf_Y, recvCount_Y,rank_Y,&req1[2],&req2[2]);
+	SendRecv(sendbuf_Y, sendCount_Y,rank_Y,recvbuf_y, recvCount_y,rank_y,&req1[3],&req2[3]);
+	SendRecv(sendbuf_z, sendCount_z,rank_z,recvbuf_Z, recvCount_Z,rank_Z,&req1[4],&req2[4]);
+	SendRecv(sendbuf_Z, sendCount_Z,rank_Z,recvbuf_z, recvCount_z,rank_z,&req1[5],&req2[5]);
+	SendRecv(sendbuf_xy, sendCount_xy,rank_xy,recvbuf_XY, recvCount_XY,rank_XY,&req1[6],&req2[6]);
+	SendRecv(sendbuf_XY, sendCount_XY,rank_XY,recvbuf_xy, recvCount_xy,rank_xy,&req1[7],&req2[7]);
+	SendRecv(sendbuf_Xy, sendCount_Xy,rank_Xy,recvbuf_xY, recvCount_xY,rank_xY,&req1[8],&req2[8]);
+	SendRecv(sendbuf_xY, sendCount_xY,rank_xY,recvbuf_Xy, recvCount_Xy,rank_Xy,&req1[9],&req2[9]);
+	SendRecv(sendbuf_xz, sendCount_xz,rank_xz,recvbuf_XZ, recvCount_XZ,rank_XZ,&req1[10],&req2[10]);
+	SendRecv(sendbuf_XZ, sendCount_XZ,rank_XZ,recvbuf_xz, recvCount_xz,rank_xz,&req1[11],&req2[11]);
+	SendRecv(sendbuf_Xz, sendCount_Xz,rank_Xz,recvbuf_xZ, recvCount_xZ,rank_xZ,&req1[12],&req2[12]);
+	SendRecv(sendbuf_xZ, sendCount_xZ,rank_xZ,recvbuf_Xz, recvCount_Xz,rank_Xz,&req1[13],&req2[13]);
+	SendRecv(sendbuf_yz, sendCount_yz,rank_yz,recvbuf_YZ, recvCount_YZ,rank_YZ,&req1[14],&req2[14]);
+	SendRecv(sendbuf_YZ, sendCount_YZ,rank_YZ,recvbuf_yz, recvCount_yz,rank_yz,&req1[15],&req2[15]);
+	SendRecv(sendbuf_Yz, sendCount_Yz,rank_Yz,recvbuf_yZ, recvCount_yZ,rank_yZ,&req1[16],&req2[16]);
+	SendRecv(sendbuf_yZ, sendCount_yZ,rank_yZ,recvbuf_Yz, recvCount_Yz,rank_Yz,&req1[17],&req2[17]);
 	//...................................................................................
     }
 }
@@ -1657,35 +1778,32 @@ void ScaLBL_Communicator::RecvHalo(double *data){
 	}
 }
 
-void ScaLBL_Communicator::RegularLayout(IntArray map, const double *data, DoubleArray &regdata){
-	// Gets data from the device and stores in regular layout
-	int i,j,k,n,idx;
-	int Nx = map.size(0);
-	int Ny = map.size(1);
-	int Nz = map.size(2);
+void ScaLBL_Communicator::RegularLayout(const IntArray &map, const double *data, DoubleArray &regdata){
+	RegularLayout(map,std::vector<const double*>(1,data),std::vector<DoubleArray*>(1,&regdata));
+}
 
-	// initialize the array
-	regdata.fill(0.f);
-	
-	double *TmpDat;
-	double value;
-	TmpDat = new double [N];
-	ScaLBL_CopyToHost(&TmpDat[0],&data[0], N*sizeof(double));
-	for (k=0; k<Nz; k++){
-		for (j=0; j<Ny; j++){
-			for (i=0; i<Nx; i++){
-				n=k*Nx*Ny+j*Nx+i;
-				idx=map(i,j,k);
-				if (!(idx<0)){
-					value=TmpDat[idx];
-					regdata(i,j,k)=value;
-				}
-			}
-		}
+void ScaLBL_Communicator::RegularLayout(const IntArray &map, const std::vector<const double*> &data, const std::vector<DoubleArray*> &regdata){
+	// Gets data from the device and stores in regular layout (sites that are not mapped are set to zero)
+	ASSERT(data.size()==regdata.size());
+	int nfields = data.size();
+	size_t Nmap = map.length();
+	if (regular_buf.size() < (size_t) nfields*N) regular_buf.resize((size_t) nfields*N);
+	double *TmpDat = regular_buf.data();
+	for (int f=0; f<nfields; f++){
+		ScaLBL_CopyToHost(&TmpDat[(size_t)f*N],data[f],N*sizeof(double));
+		if (regdata[f]->size() != map.size()) regdata[f]->resize(map.size());
+	}
+	const int *mapPtr = map.data();
+	std::vector<double*> regPtr(nfields);
+	for (int f=0; f<nfields; f++) regPtr[f] = regdata[f]->data();
+#ifdef USE_OPENMP
+	#pragma omp parallel for
+#endif
+	for (size_t n=0; n<Nmap; n++){
+		int idx = mapPtr[n];
+		for (int f=0; f<nfields; f++)
+			regPtr[f][n] = (idx<0) ? 0.0 : TmpDat[(size_t)f*N+idx];
 	}
-	//printf("r=%i, value=%f   ",rank,value);
-	
-	delete [] TmpDat;
 }
 
 
@@ -1800,3 +1918,88 @@ void ScaLBL_Communicator::PrintD3Q19(){
 //		//ScaLBL_SetSlice_z(Phi,Value,Nx,Ny,Nz,0);
 //	}
 //}
+
+void ScaLBL_MemoryBudget::Add(const std::string& name, size_t bytes, bool device){
+	items.push_back(std::make_pair(name,bytes));
+	if (device) device_bytes += bytes;
+}
+
+void ScaLBL_MemoryBudget::AddCommunicator(const std::string& name, std::shared_ptr <Domain> Dm){
+	// faces carry 5 distributions per site: send and recv buffers, both lists and the recv distribution list
+	size_t faces = Dm->sendCount_x + Dm->sendCount_X + Dm->sendCount_y + Dm->sendCount_Y + Dm->sendCount_z + Dm->sendCount_Z;
+	size_t faces_recv = Dm->recvCount_x + Dm->recvCount_X + Dm->recvCount_y + Dm->recvCount_Y + Dm->recvCount_z + Dm->recvCount_Z;
+	size_t edges = Dm->sendCount_xy + Dm->sendCount_xY + Dm->sendCount_Xy + Dm->sendCount_XY
+			+ Dm->sendCount_xz + Dm->sendCount_xZ + Dm->sendCount_Xz + Dm->sendCount_XZ
+			+ Dm->sendCount_yz + Dm->sendCount_yZ + Dm->sendCount_Yz + Dm->sendCount_YZ;
+	size_t edges_recv = Dm->recvCount_xy + Dm->recvCount_xY + Dm->recvCount_Xy + Dm->recvCount_XY
+			+ Dm->recvCount_xz + Dm->recvCount_xZ + Dm->recvCount_Xz + Dm->recvCount_XZ
+			+ Dm->recvCount_yz + Dm->recvCount_yZ + Dm->recvCount_Yz + Dm->recvCount_YZ;
+	size_t bytes = 5*(faces + faces_recv)*sizeof(double) + (edges + edges_recv)*sizeof(double)
+			+ (faces + edges)*sizeof(int) + (faces_recv + edges_recv)*sizeof(int)
+			+ (5*faces_recv + edges_recv)*sizeof(int);
+	Add(name,bytes);
+}
+
+size_t ScaLBL_MemoryBudget::Total() const{
+	size_t total = 0;
+	for (size_t i=0; i<items.size(); i++) total += items[i].second;
+	return total;
+}
+
+void ScaLBL_MemoryBudget::Check(MPI_Comm comm, const char *model) const{
+	const double MB = 1048576.0;
+	int rank;
+	MPI_Comm_rank(comm,&rank);
+	double in_use = double(Utilities::getMemoryUsage());
+	double need = double(Total()) + in_use;
+	// ranks that share a node share its memory
+	MPI_Comm node;
+	MPI_Comm_split_type(comm,MPI_COMM_TYPE_SHARED,rank,MPI_INFO_NULL,&node);
+	int node_rank, node_ranks;
+	MPI_Comm_rank(node,&node_rank);
+	MPI_Comm_size(node,&node_ranks);
+	double node_need = 0.0;
+	MPI_Allreduce(&need,&node_need,1,MPI_DOUBLE,MPI_SUM,node);
+	MPI_Comm_free(&node);
+	double node_memory = double(Utilities::getSystemMemory());
+	// fraction of the node memory needed (zero if the node memory is unknown)
+	struct { double value; int rank; } fullest, local = { node_memory > 0.0 ? node_need/node_memory : 0.0, rank };
+	MPI_Allreduce(&local,&fullest,1,MPI_DOUBLE_INT,MPI_MAXLOC,comm);
+	double max_need = 0.0, sum_need = 0.0;
+	MPI_Allreduce(&need,&max_need,1,MPI_DOUBLE,MPI_MAX,comm);
+	MPI_Allreduce(&need,&sum_need,1,MPI_DOUBLE,MPI_SUM,comm);
+	int nodes = 0, leader = (node_rank==0);
+	MPI_Allreduce(&leader,&nodes,1,MPI_INT,MPI_SUM,comm);
+	if (fullest.value <= 1.0){
+		if (rank==0) printf("%s memory: %.1f MB per rank (max), %.0f%% of the fullest node \n",model,max_need/MB,100.0*fullest.value);
+		ScaLBL_ReserveDeviceMemory(device_bytes);
+		return;
+	}
+	if (rank==fullest.rank){
+		printf("%s does not fit in memory (rank %i): \n",model,rank);
+		printf("   %-32s %12s \n","allocation","MB");
+		for (size_t i=0; i<items.size(); i++) printf("   %-32s %12.1f \n",items[i].first.c_str(),items[i].second/MB);
+		printf("   %-32s %12.1f \n","already in use",in_use/MB);
+		printf("   %-32s %12.1f \n","total",need/MB);
+		printf("%i ranks on this node need %.1f MB, the node has %.1f MB \n",node_ranks,node_need/MB,node_memory/MB);
+		printf("Run on at least %i nodes (now %i), with fewer ranks per node or a finer decomposition \n",
+				int(ceil(sum_need/node_memory)),nodes);
+		fflush(stdout);
+	}
+	MPI_Barrier(comm);
+	ERROR("Insufficient memory to create the model");
+}
+
+void ScaLBL_MemoryBudget::Report(MPI_Comm comm, const char *model) const{
+	const double MB = 1048576.0;
+	int rank;
+	MPI_Comm_rank(comm,&rank);
+	size_t in_use, peak;
+	double usage[3], max_usage[3];
+	ScaLBL_DeviceMemoryUsage(&in_use,&peak,&usage[2]);
+	usage[0] = double(in_use);
+	usage[1] = double(peak);
+	MPI_Allreduce(usage,max_usage,3,MPI_DOUBLE,MPI_MAX,comm);
+	if (rank==0) printf("%s device memory: %.1f MB in use, peak %.1f MB, fragmentation %.1f%% \n",
+			model,max_usage[0]/MB,max_usage[1]/MB,100.0*max_usage[2]);
+}
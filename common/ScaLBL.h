@@ -32,6 +32,12 @@ extern "C" void ScaLBL_AllocateDeviceMemory(void** address, size_t size);
 
 extern "C" void ScaLBL_FreeDeviceMemory(void* pointer);
 
+// Hint with the total size of the device arrays about to be allocated (sizes the CPU arena)
+extern "C" void ScaLBL_ReserveDeviceMemory(size_t size);
+
+// Device memory in use and its peak; fragmentation is the fraction of the CPU arena below its high-water mark that is free
+extern "C" void ScaLBL_DeviceMemoryUsage(size_t *in_use, size_t *peak, double *fragmentation);
+
 extern "C" void ScaLBL_CopyToDevice(void* dest, const void* source, size_t size);
 
 extern "C" void ScaLBL_CopyToHost(void* dest, const void* source, size_t size);
@@ -40,6 +46,8 @@ extern "C" void ScaLBL_AllocateZeroCopy(void** address, size_t size);
 
 extern "C" void ScaLBL_CopyToZeroCopy(void* dest, const void* source, size_t size);
 
+extern "C" void ScaLBL_CopyDeviceToDevice(void* dest, const void* source, size_t size);
+
 extern "C" void ScaLBL_DeviceBarrier();
 
 extern "C" void ScaLBL_D3Q19_Pack(int q, int *list, int start, int count, double *sendbuf, double *dist, int N);
@@ -156,6 +164,9 @@ extern "C" void ScaLBL_Color_BC_z(int *list, int *Map, double *Phi, double *Den,
 
 extern "C" void ScaLBL_Color_BC_Z(int *list, int *Map, double *Phi, double *Den, double vA, double vB, int count, int Np);
 
+// Accumulate the phase velocities, phase volumes and squared change of Phi over [start,finish) into Sums[0..8]
+extern "C" void ScaLBL_Color_Averages(int *Map, double *Phi, double *Vel, double *PhiOld, double *Sums, int start, int finish, int Np);
+
 extern "C" void ScaLBL_SetSlice_z(double *Phi, double value, int Nx, int Ny, int Nz, int Slice);
 
 //extern "C" void ScaLBL_FDM_Concentration_BC_z(int *list, double *cq, double cin, int count, int Np);
@@ -192,6 +203,9 @@ public:
 	int LastInterior();
 	
 	int MemoryOptimizedLayoutAA(IntArray &Map, int *neighborList, char *id, int Np);
+	// Layout cache: the file is keyed by the local id field and the decomposition, so a stale file is ignored
+	bool ReadLayout(const std::string& filename, IntArray &Map, int *neighborList, const char *id, int &Np);
+	void WriteLayout(const std::string& filename, const IntArray &Map, const int *neighborList, const char *id, int Np);
 //	void MemoryOptimizedLayout(IntArray &Map, int *neighborList, char *id, int Np);
 //	void MemoryOptimizedLayoutFull(IntArray &Map, int *neighborList, char *id, int Np);
 //	void MemoryDenseLayout(IntArray &Map, int *neighborList, char *id, int Np);
@@ -211,7 +225,9 @@ public:
 	void SendHalo(double *data);
 	void RecvHalo(double *data);
 	void RecvGrad(double *Phi, double *Gradient);
-	void RegularLayout(IntArray map, const double *data, DoubleArray &regdata);
+	void RegularLayout(const IntArray &map, const double *data, DoubleArray &regdata);
+	// scatter several pore-indexed fields (data[f] -> regdata[f]) in one pass over the map
+	void RegularLayout(const IntArray &map, const std::vector<const double*> &data, const std::vector<DoubleArray*> &regdata);
 
 	// Routines to set boundary conditions
 	void Color_BC_z(int *Map, double *Phi, double *Den, double vA, double vB);
@@ -229,12 +245,20 @@ public:
 private:
 	//void D3Q19_MapRecv_OLD(int q, int Cqx, int Cqy, int Cqz, int *list,  int start, int count, int *d3q19_recvlist);
 	void D3Q19_MapRecv(int Cqx, int Cqy, int Cqz, int *list,  int start, int count, int *d3q19_recvlist);
+	// Device send/recv/distribution lists in a fixed order (used by the layout cache)
+	int LayoutLists(int **list, int *count);
+	unsigned long long LayoutKey(const char *id);
+	// Post a send/recv pair, or copy directly when both neighbors are this rank (periodic with one process)
+	void SendRecv(double *sendbuf, int sendcount, int sendrank, double *recvbuf, int recvcount, int recvrank,
+			MPI_Request *sendreq, MPI_Request *recvreq);
 
 	bool Lock; 	// use Lock to make sure only one call at a time to protect data in transit
 	// only one set of Send requests can be active at any time (per instance)
 	int i,j,k,n;
 
 	int iproc,jproc,kproc;
+	int subx,suby,subz;
+	std::vector<double> regular_buf;	// host staging buffer reused by RegularLayout
 	int nprocx,nprocy,nprocz,nprocs;
 	int sendtag,recvtag;
 	// Give the object it's own MPI communicator
@@ -280,5 +304,28 @@ private:
 
 };
 
+/*!
+ * @brief Memory preflight for the allocations made by a model's Create()
+ * @details Add() every allocation before making any of them. Check() adds the memory already
+ *    in use, sums over the ranks that share a node and compares the result with
+ *    Utilities::getSystemMemory(). If a node would run out, the fullest rank prints a table of
+ *    its allocations and all ranks abort before anything is allocated.
+ */
+class ScaLBL_MemoryBudget{
+public:
+	//! device = false for host arrays (not allocated with ScaLBL_AllocateDeviceMemory)
+	void Add(const std::string& name, size_t bytes, bool device=true);
+	//! Send/recv buffers and lists allocated by one ScaLBL_Communicator on Dm
+	void AddCommunicator(const std::string& name, std::shared_ptr <Domain> Dm);
+	size_t Total() const;
+	//! Aborts if a node would run out of memory, otherwise reserves the device arrays
+	void Check(MPI_Comm comm, const char *model) const;
+	//! Print the device memory in use, its peak and the fragmentation (max over ranks)
+	void Report(MPI_Comm comm, const char *model) const;
+private:
+	std::vector<std::pair<std::string,size_t>> items;
+	size_t device_bytes = 0;
+};
+
 
 #endif
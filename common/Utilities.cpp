@@ -237,6 +237,27 @@ void Utilities::clearMPIErrorHandler(  )
 }*/
 
 
+/****************************************************************************
+*  Function to get the memory availible                                     *
+****************************************************************************/
+size_t Utilities::getSystemMemory()
+{
+    size_t N_bytes = 0;
+    #if defined(USE_LINUX) || defined(USE_MAC)
+        long pages = sysconf(_SC_PHYS_PAGES);
+        long page_bytes = sysconf(_SC_PAGESIZE);
+        if ( pages > 0 && page_bytes > 0 )
+            N_bytes = static_cast<size_t>(pages) * static_cast<size_t>(page_bytes);
+    #elif defined(USE_WINDOWS)
+        MEMORYSTATUSEX status;
+        status.dwLength = sizeof(status);
+        if ( GlobalMemoryStatusEx(&status) )
+            N_bytes = status.ullTotalPhys;
+    #endif
+    return N_bytes;
+}
+
+
 /****************************************************************************
 *  Function to get the memory usage                                         *
 *  Note: this function should be thread-safe                                *
@@ -165,6 +165,35 @@ extern "C" void ScaLBL_Color_BC_Z(int *list, int *Map, double *Phi, double *Den,
 		Phi[nm] = (vA-vB)/(vA+vB);
 	}
 }
+
+extern "C" void ScaLBL_Color_Averages(int *Map, double *Phi, double *Vel, double *PhiOld, double *Sums, int start, int finish, int Np)
+{
+	// Sums: velocity of phase A (phi>0), velocity of phase B (phi<=0), volume of A, volume of B,
+	// squared change of phi since the last call (PhiOld is updated in place)
+	double vax=0.0, vay=0.0, vaz=0.0, vbx=0.0, vby=0.0, vbz=0.0;
+	double volA=0.0, volB=0.0, dphi=0.0;
+#ifdef USE_OPENMP
+	#pragma omp parallel for simd reduction(+:vax,vay,vaz,vbx,vby,vbz,volA,volB,dphi)
+#endif
+	for (int n=start; n<finish; n++){
+		double phi = Phi[Map[n]];
+		double ux = Vel[n];
+		double uy = Vel[Np+n];
+		double uz = Vel[2*Np+n];
+		double a = (phi > 0.0) ? 1.0 : 0.0;
+		double b = (phi < 0.0) ? 1.0 : 0.0;
+		vax += a*ux;   vay += a*uy;   vaz += a*uz;
+		vbx += (1.0-a)*ux;   vby += (1.0-a)*uy;   vbz += (1.0-a)*uz;
+		volA += a;
+		volB += b;
+		double delta = phi - PhiOld[n];
+		dphi += delta*delta;
+		PhiOld[n] = phi;
+	}
+	Sums[0] += vax;   Sums[1] += vay;   Sums[2] += vaz;
+	Sums[3] += vbx;   Sums[4] += vby;   Sums[5] += vbz;
+	Sums[6] += volA;  Sums[7] += volB;  Sums[8] += dphi;
+}
 //*************************************************************************
 
 //*************************************************************************
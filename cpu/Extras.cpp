@@ -18,15 +18,166 @@
 #include <stdio.h>
 #include <string.h>
 #include <mm_malloc.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <mutex>
 
 extern "C" int ScaLBL_SetDevice(int rank){
 	return 0;
 }
 
+/* Device memory on the CPU comes from one arena per process, sized by the memory budget
+ * (ScaLBL_ReserveDeviceMemory). The arena is a single anonymous mapping: explicit hugepages
+ * (MAP_HUGETLB) when the system has enough of them for the reserved size, otherwise ordinary
+ * pages with transparent hugepages (madvise), starting on a hugepage boundary in both cases.
+ * Arrays of at least one hugepage start on a hugepage boundary, small arrays (the comm
+ * buffers and lists) are packed together. Freed blocks are coalesced and reused first-fit.
+ * Allocations made before the reservation, or that do not fit in the arena, fall back to
+ * _mm_malloc.
+ */
+static const size_t ArenaAlign = 64;
+static const size_t HugePage = 2*1024*1024;
+
+static std::mutex arena_mutex;
+static bool arena_tried = false;
+static char *arena = NULL;
+static size_t arena_size = 0;
+static size_t arena_top = 0;                      // high-water mark of the arena
+static size_t arena_in_use = 0, arena_peak = 0;
+static std::map<size_t,size_t> arena_free;        // offset -> size of the free blocks below arena_top
+static std::map<size_t,size_t> arena_used;        // offset -> size of the allocated blocks
+
+static size_t AlignUp(size_t value, size_t align){
+	return (value + align - 1)/align*align;
+}
+
+// size is the budgeted device memory; nothing is reserved for size = 0
+static void ArenaCreate(size_t size){
+	if (size == 0) return;
+	arena_tried = true;
+	// leave room for aligning the large arrays to hugepages
+	size = AlignUp(size,HugePage) + 32*HugePage;
+#ifdef MAP_HUGETLB
+	// explicit hugepages are reserved up front, so this fails cleanly if there are not enough
+	void *ptr = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+	if (ptr != MAP_FAILED){
+		arena = (char*) ptr;
+		arena_size = size;
+		return;
+	}
+#endif
+	// only address space is reserved; pages are committed as they are touched.
+	// Map one extra hugepage and trim the ends so that the arena starts on a hugepage boundary
+	void *region = mmap(NULL,size+HugePage,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+	if (region == MAP_FAILED) return;
+	char *base = (char*) AlignUp(size_t(region),HugePage);
+	size_t head = base - (char*) region;
+	if (head > 0) munmap(region,head);
+	if (HugePage > head) munmap(base + size,HugePage - head);
+#ifdef MADV_HUGEPAGE
+	madvise(base,size,MADV_HUGEPAGE);
+#endif
+	arena = base;
+	arena_size = size;
+}
+
+// Returns NULL if the block does not fit in the arena
+static void *ArenaAllocate(size_t size){
+	std::lock_guard<std::mutex> lock(arena_mutex);
+	if (arena == NULL) return NULL;
+	size_t align = (size >= HugePage) ? HugePage : ArenaAlign;
+	size = AlignUp(std::max(size,size_t(1)),ArenaAlign);
+	bool fresh = false;
+	size_t offset = arena_size;
+	for (auto it=arena_free.begin(); it!=arena_free.end(); ++it){
+		size_t start = AlignUp(it->first,align);
+		if (start + size <= it->first + it->second){
+			size_t block = it->first, end = it->first + it->second;
+			arena_free.erase(it);
+			if (start > block) arena_free[block] = start - block;
+			if (end > start + size) arena_free[start + size] = end - start - size;
+			offset = start;
+			break;
+		}
+	}
+	if (offset == arena_size){
+		size_t start = AlignUp(arena_top,align);
+		if (start + size > arena_size) return NULL;
+		if (start > arena_top) arena_free[arena_top] = start - arena_top;
+		arena_top = start + size;
+		offset = start;
+		fresh = true;
+	}
+	arena_used[offset] = size;
+	arena_in_use += size;
+	arena_peak = std::max(arena_peak,arena_in_use);
+	// pages above the high-water mark are still zero
+	if (!fresh) memset(arena + offset,0,size);
+	return arena + offset;
+}
+
+// Returns false if the pointer is not in the arena
+static bool ArenaFree(void *pointer){
+	std::lock_guard<std::mutex> lock(arena_mutex);
+	if (arena == NULL || (char*) pointer < arena || (char*) pointer >= arena + arena_size) return false;
+	auto it = arena_used.find((char*) pointer - arena);
+	if (it == arena_used.end()) return false;
+	size_t offset = it->first, size = it->second;
+	arena_used.erase(it);
+	arena_in_use -= size;
+	// coalesce with the free neighbors
+	auto next = arena_free.lower_bound(offset);
+	if (next != arena_free.end() && next->first == offset + size){
+		size += next->second;
+		next = arena_free.erase(next);
+	}
+	if (next != arena_free.begin()){
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == offset){
+			offset = prev->first;
+			size += prev->second;
+			arena_free.erase(prev);
+		}
+	}
+	if (offset + size == arena_top){
+		// the block drops back above the high-water mark, which must read as zero:
+		// clear up to the next hugepage and give the whole hugepages back to the system
+		size_t page = std::min(AlignUp(offset,HugePage),arena_top);
+		memset(arena + offset,0,page - offset);
+		if (page < arena_top && madvise(arena + page,AlignUp(arena_top,HugePage) - page,MADV_DONTNEED) != 0)
+			memset(arena + page,0,arena_top - page);
+		arena_top = offset;
+	}
+	else {
+		arena_free[offset] = size;
+	}
+	return true;
+}
+
+extern "C" void ScaLBL_ReserveDeviceMemory(size_t size){
+	std::lock_guard<std::mutex> lock(arena_mutex);
+	if (!arena_tried) ArenaCreate(size);
+}
+
+extern "C" void ScaLBL_DeviceMemoryUsage(size_t *in_use, size_t *peak, double *fragmentation){
+	std::lock_guard<std::mutex> lock(arena_mutex);
+	size_t free_bytes = 0;
+	for (auto it=arena_free.begin(); it!=arena_free.end(); ++it) free_bytes += it->second;
+	*in_use = arena_in_use;
+	*peak = arena_peak;
+	*fragmentation = (arena_top > 0) ? double(free_bytes)/double(arena_top) : 0.0;
+}
+
 extern "C" void ScaLBL_AllocateZeroCopy(void** address, size_t size){
 	//cudaMalloc(address,size);
-	(*address) = _mm_malloc(size,64);
-	memset(*address,0,size);
+	(*address) = ArenaAllocate(size);
+	if (*address==NULL){
+		(*address) = _mm_malloc(size,64);
+		if (*address!=NULL) memset(*address,0,size);
+	}
 	
 	if (*address==NULL){
 		printf("Memory allocation failed! \n");
@@ -35,8 +186,11 @@ extern "C" void ScaLBL_AllocateZeroCopy(void** address, size_t size){
 
 extern "C" void ScaLBL_AllocateDeviceMemory(void** address, size_t size){
 	//cudaMalloc(address,size);
-	(*address) = _mm_malloc(size,64);
-	memset(*address,0,size);
+	(*address) = ArenaAllocate(size);
+	if (*address==NULL){
+		(*address) = _mm_malloc(size,64);
+		if (*address!=NULL) memset(*address,0,size);
+	}
 	
 	if (*address==NULL){
 		printf("Memory allocation failed! \n");
@@ -44,6 +198,7 @@ extern "C" void ScaLBL_AllocateDeviceMemory(void** address, size_t size){
 }
 
 extern "C" void ScaLBL_FreeDeviceMemory(void* pointer){
+	if (pointer==NULL || ArenaFree(pointer)) return;
 	_mm_free(pointer);
 }
 
@@ -63,6 +218,11 @@ extern "C" void ScaLBL_CopyToZeroCopy(void* dest, const void* source, size_t siz
 	memcpy(dest, source, size);
 }
 
+extern "C" void ScaLBL_CopyDeviceToDevice(void* dest, const void* source, size_t size){
+//	cudaMemcpy(dest,source,size,cudaMemcpyDeviceToDevice);
+	memcpy(dest, source, size);
+}
+
 extern "C" void ScaLBL_DeviceBarrier(){
 //	cudaDeviceSynchronize();
 }
@@ -20,6 +20,20 @@
 #define NBLOCKS 1024
 #define NTHREADS 256
 
+#if !defined(__CUDA_ARCH__) || __CUDA_ARCH__ >= 600
+#else
+__device__ double atomicAdd(double* address, double val) { 
+   unsigned long long int* address_as_ull = (unsigned long long int*)address;
+   unsigned long long int old = *address_as_ull, assumed;
+
+   do {
+      assumed = old;
+      old = atomicCAS(address_as_ull, assumed, __double_as_longlong(val+__longlong_as_double(assumed)));
+   } while (assumed != old);
+   return __longlong_as_double(old);
+}
+#endif
+
 __global__  void dvc_ScaLBL_Color_Init(char *ID, double *Den, double *Phi, double das, double dbs, int Nx, int Ny, int Nz)
 {
 	//int i,j,k;
@@ -193,6 +207,37 @@ __global__  void dvc_ScaLBL_Color_BC_Z(int *list, int *Map, double *Phi, double
 }
 //*************************************************************************
 
+__global__  void dvc_ScaLBL_Color_Averages(int *Map, double *Phi, double *Vel, double *PhiOld, double *Sums, int start, int finish, int Np)
+{
+	__shared__ double temp[9][NTHREADS];
+	double local[9] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+	for (int n = start + blockIdx.x*blockDim.x + threadIdx.x; n < finish; n += blockDim.x*gridDim.x){
+		double phi = Phi[Map[n]];
+		double ux = Vel[n];
+		double uy = Vel[Np+n];
+		double uz = Vel[2*Np+n];
+		int k = (phi > 0.0) ? 0 : 3;
+		local[k] += ux;   local[k+1] += uy;   local[k+2] += uz;
+		if (phi > 0.0) local[6] += 1.0;
+		if (phi < 0.0) local[7] += 1.0;
+		double delta = phi - PhiOld[n];
+		local[8] += delta*delta;
+		PhiOld[n] = phi;
+	}
+	// reduce over the block, then one atomic per sum
+	for (int q=0; q<9; q++) temp[q][threadIdx.x] = local[q];
+	__syncthreads();
+	for (int s=blockDim.x/2; s>0; s>>=1){
+		if (threadIdx.x < s){
+			for (int q=0; q<9; q++) temp[q][threadIdx.x] += temp[q][threadIdx.x+s];
+		}
+		__syncthreads();
+	}
+	if (threadIdx.x == 0){
+		for (int q=0; q<9; q++) atomicAdd(&Sums[q],temp[q][0]);
+	}
+}
+
 __global__  void dvc_ScaLBL_D3Q19_ColorGradient(char *ID, double *phi, double *ColorGrad, int Nx, int Ny, int Nz)
 {
 	int n,N,i,j,k,nn;
@@ -4151,5 +4196,15 @@ extern "C" void ScaLBL_Color_BC_Z(int *list, int *Map, double *Phi, double *Den,
 	}
 }
 
+extern "C" void ScaLBL_Color_Averages(int *Map, double *Phi, double *Vel, double *PhiOld, double *Sums, int start, int finish, int Np){
+	if (finish <= start) return;
+	int GRID = min((finish-start)/NTHREADS + 1, NBLOCKS);
+	dvc_ScaLBL_Color_Averages<<<GRID,NTHREADS>>>(Map, Phi, Vel, PhiOld, Sums, start, finish, Np);
+	cudaError_t err = cudaGetLastError();
+	if (cudaSuccess != err){
+		printf("CUDA error in ScaLBL_Color_Averages: %s \n",cudaGetErrorString(err));
+	}
+}
+
 
 
@@ -40,6 +40,19 @@ extern "C" void ScaLBL_FreeDeviceMemory(void* pointer){
        cudaFree(pointer);
 }
 
+extern "C" void ScaLBL_ReserveDeviceMemory(size_t size){
+}
+
+extern "C" void ScaLBL_DeviceMemoryUsage(size_t *in_use, size_t *peak, double *fragmentation){
+	static size_t max_in_use = 0;
+	size_t free_bytes = 0, total_bytes = 0;
+	cudaMemGetInfo(&free_bytes,&total_bytes);
+	*in_use = total_bytes - free_bytes;
+	max_in_use = (*in_use > max_in_use) ? *in_use : max_in_use;
+	*peak = max_in_use;
+	*fragmentation = 0.0;
+}
+
 extern "C" void ScaLBL_CopyToDevice(void* dest, const void* source, size_t size){
 	cudaMemcpy(dest,source,size,cudaMemcpyHostToDevice);
 	cudaError_t err = cudaGetLastError();
@@ -72,6 +85,14 @@ extern "C" void ScaLBL_CopyToHost(void* dest, const void* source, size_t size){
 	}
 }
 
+extern "C" void ScaLBL_CopyDeviceToDevice(void* dest, const void* source, size_t size){
+	cudaMemcpy(dest,source,size,cudaMemcpyDeviceToDevice);
+	cudaError_t err = cudaGetLastError();
+	if (cudaSuccess != err){
+	   printf("Error in cudaMemcpy (device->device): %s \n",cudaGetErrorString(err));
+	}
+}
+
 extern "C" void ScaLBL_DeviceBarrier(){
 	cudaDeviceSynchronize();
 }
@@ -25,7 +25,8 @@ color lattice boltzmann model
 ScaLBL_ColorModel::ScaLBL_ColorModel(int RANK, int NP, MPI_Comm COMM):
 rank(RANK), nprocs(NP),  Restart(0),timestep(0),timestepMax(0),tauA(0),tauB(0),rhoA(0),rhoB(0),alpha(0),beta(0),
 Fx(0),Fy(0),Fz(0),flux(0),din(0),dout(0),inletA(0),inletB(0),outletA(0),outletB(0),
-Nx(0),Ny(0),Nz(0),N(0),Np(0),poro(0),nprocx(0),nprocy(0),nprocz(0),BoundaryCondition(0),Lx(0),Ly(0),Lz(0),comm(COMM)
+Nx(0),Ny(0),Nz(0),N(0),Np(0),poro(0),volB(0),volA(0),nprocx(0),nprocy(0),nprocz(0),BoundaryCondition(0),Lx(0),Ly(0),Lz(0),comm(COMM),
+ReleaseCartesian(false),velocity_timestep(-1)
 {
 
 }
@@ -104,7 +105,7 @@ void ScaLBL_ColorModel::ReadParams(string filename){
 void ScaLBL_ColorModel::SetDomain(){
 	Dm  = std::shared_ptr<Domain>(new Domain(domain_db,comm));      // full domain for analysis
 	Mask  = std::shared_ptr<Domain>(new Domain(domain_db,comm));    // mask domain removes immobile phases
-	Nx+=2; Ny+=2; Nz += 2;
+	Nx = Dm->Nx; Ny = Dm->Ny; Nz = Dm->Nz;   // blocks may differ in size (BlockSizeX/Y/Z)
 	N = Nx*Ny*Nz;
 	id = new char [N];
 	for (int i=0; i<Nx*Ny*Nz; i++) Dm->id[i] = 1;               // initialize this way
@@ -127,19 +128,8 @@ void ScaLBL_ColorModel::ReadInput(){
 	
 	// Generate the signed distance map
 	// Initialize the domain and communication
-	Array<char> id_solid(Nx,Ny,Nz);
-	int count = 0;
 	// Solve for the position of the solid phase
-	for (int k=0;k<Nz;k++){
-		for (int j=0;j<Ny;j++){
-			for (int i=0;i<Nx;i++){
-				int n = k*Nx*Ny+j*Nx+i;
-				// Initialize the solid phase
-				if (Mask->id[n] > 0)	id_solid(i,j,k) = 1;
-				else	     	      	id_solid(i,j,k) = 0;
-			}
-		}
-	}
+	BitMask id_solid = Mask->PoreMask();
 	// Initialize the signed distance function
 	for (int k=0;k<Nz;k++){
 		for (int j=0;j<Ny;j++){
@@ -246,6 +236,27 @@ void ScaLBL_ColorModel::Create(){
 	Mask->CommInit();
 	Np=Mask->PoreCount();
 	//...........................................................................
+	// Check that everything allocated below fits in memory before allocating any of it
+	ScaLBL_MemoryBudget Budget;
+	Budget.AddCommunicator("ScaLBL_Comm",Mask);
+	Budget.AddCommunicator("ScaLBL_Comm_Regular",Mask);
+	Budget.Add("Map",sizeof(int)*N,false);
+	Budget.Add("neighborList (host)",sizeof(int)*18*((Np/16 + 2)*16),false);
+	Budget.Add("NeighborList",sizeof(int)*18*Np);
+	Budget.Add("dvcMap",sizeof(int)*Np);
+	Budget.Add("fq",sizeof(double)*19*Np);
+	Budget.Add("Aq, Bq",sizeof(double)*14*Np);
+	Budget.Add("Den",sizeof(double)*2*Np);
+	Budget.Add("Phi",sizeof(double)*N);
+	Budget.Add("Velocity",sizeof(double)*3*Np);
+	Budget.Add("PhiOld",sizeof(double)*Np);
+	Budget.Add("TmpMap (host)",sizeof(int)*Np,false);
+	Budget.Add("PhaseLabel (host)",sizeof(double)*N,false);
+	Budget.Add("Velocity_x/y/z, Phase_Cart (on demand)",sizeof(double)*4*N,false);
+	// copies of the four fields held by the visualization writes on the analysis threads
+	Budget.Add("Analysis snapshots (host)",sizeof(double)*4*N*AnalysisThreads::maxItems(analysis_db),false);
+	Budget.Check(comm,"Color model");
+	//...........................................................................
 	if (rank==0)    printf ("Create ScaLBL_Communicator \n");
 	// Create a communicator for the device (will use optimized layout)
 	// ScaLBL_Communicator ScaLBL_Comm(Mask); // original
@@ -256,7 +267,17 @@ void ScaLBL_ColorModel::Create(){
 	if (rank==0)    printf ("Set up memory efficient layout, %i | %i | %i \n", Np, Npad, N);
 	Map.resize(Nx,Ny,Nz);       Map.fill(-2);
 	auto neighborList= new int[18*Npad];
-	Np = ScaLBL_Comm->MemoryOptimizedLayoutAA(Map,neighborList,Mask->id,Np);
+	// Reuse the layout from an earlier run on the same image and decomposition
+	bool LayoutCache = false;
+	if (domain_db->keyExists( "LayoutCache" )) LayoutCache = domain_db->getScalar<bool>( "LayoutCache" );
+	std::string LayoutFile = std::string("Layout.") + LocalRankString;
+	if (LayoutCache && ScaLBL_Comm->ReadLayout(LayoutFile,Map,neighborList,Mask->id,Np)){
+		if (rank==0)    printf ("Read layout from %s \n", LayoutFile.c_str());
+	}
+	else {
+		Np = ScaLBL_Comm->MemoryOptimizedLayoutAA(Map,neighborList,Mask->id,Np);
+		if (LayoutCache) ScaLBL_Comm->WriteLayout(LayoutFile,Map,neighborList,Mask->id,Np);
+	}
 	MPI_Barrier(comm);
 
 	//...........................................................................
@@ -277,6 +298,12 @@ void ScaLBL_ColorModel::Create(){
 	ScaLBL_AllocateDeviceMemory((void **) &Phi, sizeof(double)*Nx*Ny*Nz);		
 	//ScaLBL_AllocateDeviceMemory((void **) &Pressure, sizeof(double)*Np);
 	ScaLBL_AllocateDeviceMemory((void **) &Velocity, 3*dist_mem_size);
+	ScaLBL_AllocateDeviceMemory((void **) &PhiOld, dist_mem_size);
+	ScaLBL_AllocateDeviceMemory((void **) &AnalysisSums, 9*sizeof(double));
+	{
+		std::vector<double> zero(Np,0.0);
+		ScaLBL_CopyToDevice(PhiOld, zero.data(), dist_mem_size);
+	}
 	//ScaLBL_AllocateDeviceMemory((void **) &ColorGrad, 3*dist_mem_size);
 	//...........................................................................
 	// Update GPU data structures
@@ -319,12 +346,7 @@ void ScaLBL_ColorModel::Create(){
 	PhaseLabel = new double[N];
 	AssignComponentLabels(PhaseLabel);
 	ScaLBL_CopyToDevice(Phi, PhaseLabel, N*sizeof(double));
-	
-	Density_A_Cart.resize(Nx,Ny,Nz);
-	Density_B_Cart.resize(Nx,Ny,Nz);
-    Velocity_x.resize(Nx,Ny,Nz);
-    Velocity_y.resize(Nx,Ny,Nz);
-    Velocity_z.resize(Nx,Ny,Nz);
+	Budget.Report(comm,"Color model");
 }        
 
 /********************************************************
@@ -448,7 +470,6 @@ void ScaLBL_ColorModel::Run(){
     double fluxReversalSat = -1.0;
     // the settling parameter is a general tool
     double settlingTolerance = 3e-5;
-    DoubleArray oldPhase(Nx,Ny,Nz); //stores the settling parameter info
     // for steady state problems (borrows params from above as well) 
     bool autoMorphFlag = false; //this will setup morpho automatically if this is off, default to manual mode or no morph
 	bool autoMorphAdapt = false; //dynamic flag, dont touch.
@@ -552,13 +573,59 @@ void ScaLBL_ColorModel::Run(){
 		tolerance = 0.02;
 	}
 	int analysis_interval = analysis_db->getScalar<int>( "analysis_interval" );
+	// rebalance the decomposition when the rank times drift apart (0 = never)
+	double rebalance_threshold = 0.0;
+	if (analysis_db->keyExists( "rebalance_threshold" )){
+		rebalance_threshold = analysis_db->getScalar<double>( "rebalance_threshold" );
+	}
+	if (rebalance_threshold > 0.0 && domain_db->keyExists( "RankMap" )){
+		if (rank==0) printf("WARNING: rebalance_threshold is not supported with a RankMap, rebalancing is disabled \n");
+		rebalance_threshold = 0.0;
+	}
+	int nranks;
+	MPI_Comm_size(comm,&nranks);
 	
+	if (analysis_db->keyExists( "ReleaseCartesian" )){
+		ReleaseCartesian = analysis_db->getScalar<bool>( "ReleaseCartesian" );
+	}
 	if (analysis_db->keyExists( "raw_visualisation_interval" )){
 		visualisation_interval = analysis_db->getScalar<int>( "raw_visualisation_interval" );
 	}
 	else{
 		visualisation_interval = 1e10;
 	}
+	// streaming steady-state detection over the last steady_window analysis steps (0 = off)
+	int steady_window = 0;
+	double steady_tolerance = 1e-3;
+	double steady_confidence = 0.95;
+	if (analysis_db->keyExists( "steady_window" )){
+		steady_window = analysis_db->getScalar<int>( "steady_window" );
+	}
+	if (analysis_db->keyExists( "steady_tolerance" )){
+		steady_tolerance = analysis_db->getScalar<double>( "steady_tolerance" );
+	}
+	if (analysis_db->keyExists( "steady_confidence" )){
+		steady_confidence = analysis_db->getScalar<double>( "steady_confidence" );
+	}
+	SteadyStateDetector steadyState( {"Sat","qA","qB","gradP"}, steady_window, steady_tolerance, steady_confidence );
+	// Minkowski functionals of the pore space (once) and of phase A (every analysis step)
+	bool compute_minkowski = false;
+	if (analysis_db->keyExists( "compute_minkowski" )){
+		compute_minkowski = analysis_db->getScalar<bool>( "compute_minkowski" );
+	}
+	std::shared_ptr<const DoubleArray> pore;
+	if (compute_minkowski){
+		Minkowski solid(comm);
+		solid.ComputeScalar(Distance,0.0,1.5);
+		if (rank==0) printf("Pore space: ");
+		solid.PrintAll();
+		pore = std::make_shared<const DoubleArray>(Distance);
+	}
+	// track the blobs of phase A between analysis steps (events in lbpm_id_map.txt)
+	bool track_blobs = false;
+	if (analysis_db->keyExists( "track_blobs" )){
+		track_blobs = analysis_db->getScalar<bool>( "track_blobs" );
+	}
 	
 	if (rank==0){
 		printf("********************************************************\n");
@@ -566,6 +633,9 @@ void ScaLBL_ColorModel::Run(){
 		if (autoMorphFlag){
 		    printf("[In Colour Model], Morphological Adaptation is Active. Ramp-up before Morphological Adaptation: %i \n", ramp_timesteps);
 		}
+		if (steadyState.enabled()){
+		    printf("[In Colour Model], Steady state is detected over %i analysis steps (tolerance %e, confidence %f) \n", steady_window, steady_tolerance, steady_confidence);
+		}
 		fflush(stdout);
 	}
 	//.......create and start timer............
@@ -580,14 +650,18 @@ void ScaLBL_ColorModel::Run(){
     //std::shared_ptr<Database> analysis_db;
 	//bool Regular = false;
 	int counter=0;
-	//runAnalysis analysis( analysis_db, rank_info, ScaLBL_Comm, Dm, Np, Regular, beta, Map );
-	//analysis.createThreads( analysis_method, 4 );
-	while (timestep < timestepMax ) {
+	// time spent by this rank in the current analysis interval (excluding the step barriers)
+	double work_time = 0.0;
+	double step_start;
+	// threads for the in-situ analysis (N_threads, load_balance and max_queued in the Analysis db)
+	Analysis = std::make_shared<AnalysisThreads>( analysis_db, comm );
+	while (timestep < timestepMax && !steadyFlag) {
 		//if ( rank==0 ) { printf("Running timestep %i (%i MB)\n",timestep+1,(int)(Utilities::getMemoryUsage()/1048576)); }
 		//PROFILE_START("Update");
 
 		// *************ODD TIMESTEP*************
 		timestep++;
+		step_start = MPI_Wtime();
 		// Compute the Phase indicator field
 		// Read for Aq, Bq happens in this routine (requires communication)
 		ScaLBL_Comm->BiSendD3Q7AA(Aq,Bq); //READ FROM NORMAL
@@ -621,10 +695,12 @@ void ScaLBL_ColorModel::Run(){
 		ScaLBL_D3Q19_AAodd_Color(NeighborList, dvcMap, fq, Aq, Bq, Den, Phi, Velocity, rhoA, rhoB, tauA, tauB,
 				alpha, beta, Fx, Fy, Fz, Nx, Nx*Ny, 0, ScaLBL_Comm->LastExterior(), Np);
 		ScaLBL_DeviceBarrier(); 
+		work_time += MPI_Wtime() - step_start;
 		MPI_Barrier(comm);
 
 		// *************EVEN TIMESTEP*************
 		timestep++;
+		step_start = MPI_Wtime();
 		// Compute the Phase indicator field
 		ScaLBL_Comm->BiSendD3Q7AA(Aq,Bq); //READ FROM NORMAL
 		ScaLBL_D3Q7_AAeven_PhaseField(dvcMap, Aq, Bq, Den, Phi, ScaLBL_Comm->FirstInterior(), ScaLBL_Comm->LastInterior(), Np);
@@ -656,6 +732,7 @@ void ScaLBL_ColorModel::Run(){
 		}
 		ScaLBL_D3Q19_AAeven_Color(dvcMap, fq, Aq, Bq, Den, Phi, Velocity, rhoA, rhoB, tauA, tauB, alpha, beta, Fx, Fy, Fz, Nx, Nx*Ny, 0, ScaLBL_Comm->LastExterior(), Np);
 		ScaLBL_DeviceBarrier(); 
+		work_time += MPI_Wtime() - step_start;
 		MPI_Barrier(comm);
 		//************************************************************************
 		
@@ -663,6 +740,7 @@ void ScaLBL_ColorModel::Run(){
 		//raw visualisation intervals
 		if (timestep%visualisation_interval == 0){
 		    WriteDebugYDW();
+		    if (ReleaseCartesian) ClearCartesian();
 		}
 			    // Run the analysis
        
@@ -674,58 +752,32 @@ void ScaLBL_ColorModel::Run(){
         		cputime = (stoptime - starttime);
 	            printf("TimeStep: %d, Elapsed time = %f \n", timestep, cputime);
             }
+			// load balance over this interval
+			double work_max, work_sum;
+			MPI_Allreduce(&work_time,&work_max,1,MPI_DOUBLE,MPI_MAX,comm);
+			MPI_Allreduce(&work_time,&work_sum,1,MPI_DOUBLE,MPI_SUM,comm);
+			double imbalance = (work_sum > 0.0) ? work_max*nranks/work_sum : 1.0;
+			if (rank==0) printf("Load imbalance (max/mean rank time) = %f \n", imbalance);
             //ScaLBL_D3Q19_Pressure(fq,Pressure,Np);
 			//ScaLBL_DeviceBarrier(); MPI_Barrier(comm);
-			ScaLBL_Comm->RegularLayout(Map,&Velocity[0],Velocity_x);
-			ScaLBL_Comm->RegularLayout(Map,&Velocity[Np],Velocity_y);
-			ScaLBL_Comm->RegularLayout(Map,&Velocity[2*Np],Velocity_z);
-			ScaLBL_Comm->RegularLayout(Map,&Den[0],Density_A_Cart);
-			ScaLBL_Comm->RegularLayout(Map,&Den[Np],Density_B_Cart);
-            DoubleArray phase(Nx,Ny,Nz);
-        	ScaLBL_CopyToHost(phase.data(), Phi, N*sizeof(double));
-			double count_loc=0;
-			double count;
-			//double vax, vay, vaz, vbx, vby, vbz;
-            double vA_x;// = Averages->van_global(0);
-            double vA_y;// = Averages->van_global(1);
-            double vA_z;// = Averages->van_global(2);
-            double vB_x;// = Averages->vaw_global(0);
-            double vB_y;// = Averages->vaw_global(1);
-            double vB_z;// = Averages->vaw_global(2);
-			double vax_loc, vay_loc, vaz_loc, vbx_loc, vby_loc, vbz_loc;
-			vax_loc = vay_loc = vaz_loc = 0.f;
-			vbx_loc = vby_loc = vbz_loc = 0.f;
-			for (int k=1; k<Nz-1; k++){
-				for (int j=1; j<Ny-1; j++){
-					for (int i=1; i<Nx-1; i++){
-						count_loc+=1.0;
-						if (Distance(i,j,k) > 0){
-						    if (phase(i,j,k)>0){
-							    vax_loc += Velocity_x(i,j,k);
-							    vay_loc += Velocity_y(i,j,k);
-							    vaz_loc += Velocity_z(i,j,k);
-							} else {
-							    vbx_loc += Velocity_x(i,j,k);
-							    vby_loc += Velocity_y(i,j,k);
-							    vbz_loc += Velocity_z(i,j,k);
-							}
-						}
-					}
-				}
-			}
-			MPI_Allreduce(&vax_loc,&vA_x,1,MPI_DOUBLE,MPI_SUM,Mask->Comm);
-			MPI_Allreduce(&vay_loc,&vA_y,1,MPI_DOUBLE,MPI_SUM,Mask->Comm);
-			MPI_Allreduce(&vaz_loc,&vA_z,1,MPI_DOUBLE,MPI_SUM,Mask->Comm);
-			MPI_Allreduce(&vbx_loc,&vB_x,1,MPI_DOUBLE,MPI_SUM,Mask->Comm);
-			MPI_Allreduce(&vby_loc,&vB_y,1,MPI_DOUBLE,MPI_SUM,Mask->Comm);
-			MPI_Allreduce(&vbz_loc,&vB_z,1,MPI_DOUBLE,MPI_SUM,Mask->Comm);
-			MPI_Allreduce(&count_loc,&count,1,MPI_DOUBLE,MPI_SUM,Mask->Comm);
-			vA_x /= count;
-			vA_y /= count;
-			vA_z /= count;
-			vB_x /= count;
-			vB_y /= count;
-			vB_z /= count;
+			// phase velocities, volumes and settling parameter from the pore-indexed arrays,
+			// gathered with a single reduction
+			double sums_loc[10] = { 0.0 };
+			double sums[10];
+			ScaLBL_CopyToDevice(AnalysisSums, sums_loc, 9*sizeof(double));
+			ScaLBL_Color_Averages(dvcMap, Phi, Velocity, PhiOld, AnalysisSums, 0, ScaLBL_Comm->LastExterior(), Np);
+			ScaLBL_Color_Averages(dvcMap, Phi, Velocity, PhiOld, AnalysisSums, ScaLBL_Comm->FirstInterior(), ScaLBL_Comm->LastInterior(), Np);
+			ScaLBL_DeviceBarrier();
+			ScaLBL_CopyToHost(sums_loc, AnalysisSums, 9*sizeof(double));
+			sums_loc[9] = double((Nx-2)*(Ny-2)*(Nz-2));
+			MPI_Allreduce(sums_loc,sums,10,MPI_DOUBLE,MPI_SUM,comm);
+			double count = sums[9];
+            double vA_x = sums[0]/count;
+            double vA_y = sums[1]/count;
+            double vA_z = sums[2]/count;
+            double vB_x = sums[3]/count;
+            double vB_y = sums[4]/count;
+            double vB_z = sums[5]/count;
             double muA = rhoA*(tauA-0.5)/3.f;
             double muB = rhoB*(tauB-0.5)/3.f;
 
@@ -742,37 +794,41 @@ void ScaLBL_ColorModel::Run(){
 				printf("Phase 1: %f Darcies,    ",timestep, absperm1);
 				printf("Phase 2: %f Darcies\n",timestep, absperm2);
 			}
-            // compute the settling parameter and phase volumes
-            double countA = 0.;// = Averages->Volume_w();
-            double countB = 0.;// = Averages->Volume_n();
+            // the settling parameter and phase volumes
             double current_saturation;
-            double settlingParam = 0.;
-            double phiDiff = 0.;
-            for (int k=0;k<Nz;k++){
-	            for (int j=0;j<Ny;j++){
-		            for (int i=0;i<Nx;i++){
-						if (Distance(i,j,k) > 0){
-	                        phiDiff = phiDiff + (phase(i,j,k) - oldPhase(i,j,k))*(phase(i,j,k) - oldPhase(i,j,k));
-	                        oldPhase(i,j,k) = phase(i,j,k);
-	                        if (phase(i,j,k)>0) {
-	                            countA=countA+1;
-	                        } if (phase(i,j,k)<0) {
-	                            countB=countB+1;
-	                        }
-	                    }
-		            }
-	            }
-            }
-
-        	MPI_Barrier(Dm->Comm);
-            MPI_Allreduce(&phiDiff,&settlingParam,1,MPI_DOUBLE,MPI_SUM,Dm->Comm);
-	        MPI_Allreduce(&countA,&volA,1,MPI_DOUBLE,MPI_SUM,Dm->Comm);
-	        MPI_Allreduce(&countB,&volB,1,MPI_DOUBLE,MPI_SUM,Dm->Comm);
-        	MPI_Barrier(Dm->Comm);
+            double settlingParam = sums[8];
+            volA = sums[6];
+            volB = sums[7];
             //scale the settling parameter by the domain size
             settlingParam = sqrt(settlingParam)/(double(Nx*Ny*Nz*nprocs))/poro;
             current_saturation = volB/(volA+volB);
 			//if (rank==0) printf("Va: %f, Vb: %f\n", volA, volB);
+            // the saturation drift is absolute, the phase fluxes are measured against the total flux
+            steadyState.add( {current_saturation, flow_rate_A, flow_rate_B, gradP},
+                             {1.0, flow_rate_A+flow_rate_B, flow_rate_A+flow_rate_B, gradP} );
+            steadyState.print(rank);
+            if (compute_minkowski){
+            	// computed and logged on the analysis threads from a copy of the phase field
+            	CartesianPhase();
+            	auto phase = std::make_shared<const DoubleArray>(Phase_Cart);
+            	int step = timestep;
+            	Analysis->add( [phase,pore,step]( MPI_Comm morph_comm ){
+            		Minkowski morph(morph_comm);
+            		morph.ComputeScalar(*phase,0.0,1.0,*pore);
+            		if (comm_rank(morph_comm)==0){
+            			FILE * minkowski_file = fopen("minkowski.csv","a");
+            			fprintf(minkowski_file,"%i %.8g %.8g %.8g %.8g\n",step,morph.Vi,morph.Ai,morph.Ji,morph.Xi);
+            			fclose(minkowski_file);
+            		}
+            	});
+            }
+            if (track_blobs){
+            	CartesianPhase();
+            	if (!Blobs) Blobs = std::make_shared<BlobTracker>(Nx-2,Ny-2,Nz-2,rank_info,comm);
+            	const ID_map_struct& id_map = Blobs->update(Phase_Cart,Distance,0.0,0.0);
+            	writeIDMap(id_map,timestep,"lbpm_id_map.txt");
+            	if (rank==0) printf("Blobs: %i (%lld cells relabeled) \n",Blobs->count(),(long long)Blobs->relabeled());
+            }
             // rampup the component affinities 
             if (affinityRampupFlag && timestep < affinityRampSteps){
             	size_t NLABELS=0;
@@ -789,6 +845,8 @@ void ScaLBL_ColorModel::Run(){
 	            }
 	            int label_count[NLABELS];
 	            int label_count_global[NLABELS];
+	            CartesianPhase();
+	            DoubleArray &phase = Phase_Cart;
 	            // Assign the labels
 	            for (int idx=0; idx<NLABELS; idx++) label_count[idx]=0;
 	            
@@ -837,6 +895,7 @@ void ScaLBL_ColorModel::Run(){
 			            ScaLBL_SetSlice_z(Phi,-1.0,Nx,Ny,Nz,Nz-3);
 		            }
 	            }
+	            steadyState.reset();
             }
             
             
@@ -866,6 +925,7 @@ void ScaLBL_ColorModel::Run(){
                     if (rank==0 && current_saturation < fluxReversalSat) printf("Current Saturation of %f is less than the flux reversal saturation of %f. \nFluxes have been reversed. \nThis will not carry on to restart. \nPlease manually change the inputfile at end of simulation.\n", current_saturation, fluxReversalSat);
                     if (rank==0 && settlingParam < settlingTolerance) printf("Current Saturation of %f has reached steady state, so flux reversal has been activated. \nFluxes have been reversed. \nThis will not carry on to restart. \nPlease manually change the inputfile at end of simulation.\n", current_saturation);
                     fluxReversalFlag = false;
+                    steadyState.reset();
                 }
             }
 
@@ -898,11 +958,14 @@ void ScaLBL_ColorModel::Run(){
 			}
 			
 			
+			// with the steady-state detector the stabilisation is checked at every analysis step,
+			// otherwise every stabilisationRate timesteps against the previous capillary number
+			bool steadyCheck = steadyState.enabled() ? (stabilityCounter > 0 && steadyState.steady()) : (stabilityCounter >= stabilisationRate);
 			//co-injeciton stabilisation routine
 			if (timestep > ramp_timesteps && coinjectionFlag){
-			    if (stabilityCounter >= stabilisationRate){ // theres no adaptation phase, so no extra flag here
+			    if (steadyCheck){ // theres no adaptation phase, so no extra flag here
 			        if (rank==0) printf("[CO-INJECTION]: Seeking Nca stabilisation. Ca = %e, (previous = %e), Saturation = %f \n",Ca,Ca_previous, current_saturation);
-			        if (fabs((Ca - Ca_previous)/Ca) < tolerance ){
+			        if (steadyState.enabled() || fabs((Ca - Ca_previous)/Ca) < tolerance ){
             		    WriteDebugYDW();
 				        if (rank==0){ //save the data as a rel perm point
 					        printf("*** Steady state reached. WRITE STEADY POINT *** \n");
@@ -923,6 +986,7 @@ void ScaLBL_ColorModel::Run(){
                             inletB=inletB+satInc;
 		                }
         			    if (rank==0) printf("[CO-INJECTION]: Inlet altered to: Phase 1: %f, Phase 2: %f \n",inletA, inletB);
+        			    steadyState.reset();
 				    } else { //if the system is unstable, continue stabilisation
 					    if (rank==0) printf("********* System is unstable, continuing LBM stabilisation.\n");
 					    stabilityCounter = 1;
@@ -956,9 +1020,9 @@ void ScaLBL_ColorModel::Run(){
 			        flux = 0;
 			    }
                 // once rampup and init flux are done, run morph
-			    if (!autoMorphAdapt && stabilityCounter >= stabilisationRate){//if acceleration is currently off, (stabilisation is active)
+			    if (!autoMorphAdapt && steadyCheck){//if acceleration is currently off, (stabilisation is active)
 				    if (rank==0) printf("[AUTOMORPH]: Seeking Nca stabilisation. Ca = %e, (previous = %e), Saturation = %f \n",Ca,Ca_previous, current_saturation);
-				    if (fabs((Ca - Ca_previous)/Ca) < tolerance ){ //if the capillary number has stabilised, record, adjust, and activate acceleration
+				    if (steadyState.enabled() || fabs((Ca - Ca_previous)/Ca) < tolerance ){ //if the capillary number has stabilised, record, adjust, and activate acceleration
 	        		    WriteDebugYDW();
 					    if (rank==0){ //save the data as a rel perm point
 						    printf("*** Steady state reached. WRITE STEADY POINT *** \n");
@@ -1053,12 +1117,26 @@ void ScaLBL_ColorModel::Run(){
 			            
     				}
     				MPI_Barrier(comm);
+    				steadyState.reset();
 			    }
 				accelerationCounter += analysis_interval; //increment the acceleration
 			}
+			// without an adaptation routine the run ends once it is steady
+			if (timestep > ramp_timesteps && !autoMorphFlag && !coinjectionFlag && steadyState.steady()){
+				if (rank==0) printf("*** Steady state reached, ending the run *** \n");
+				steadyFlag = true;
+			}
+			if (rebalance_threshold > 0.0 && imbalance > rebalance_threshold){
+				if (rank==0) printf("Load imbalance exceeds %f, rebalancing the decomposition \n", rebalance_threshold);
+				Rebalance(work_time);
+				if (pore) pore = std::make_shared<const DoubleArray>(Distance);
+			}
+			work_time = 0.0;
+			if (ReleaseCartesian) ClearCartesian();
 		}
 	}
-	//analysis.finish();
+	// wait for the analysis still running on the threads
+	Analysis.reset();
 	//PROFILE_STOP("Loop");
 	//PROFILE_SAVE("lbpm_color_simulator",1);
 	//************************************************************************
@@ -1081,6 +1159,152 @@ void ScaLBL_ColorModel::Run(){
 	// ************************************************************************
 }
 
+/********************************************************
+ * Rebalance the decomposition during the run            *
+ ********************************************************/
+bool ScaLBL_ColorModel::Rebalance(double work_time){
+	// Spread the time of this rank over its pore nodes, plane by plane along each axis
+	auto size = Dm->GlobalSize();
+	auto start = Dm->GlobalStart();
+	int nproc[3] = { nprocx, nprocy, nprocz };
+	std::vector<double> weight[3], weight_global[3];
+	for (int d=0; d<3; d++){
+		weight[d].assign(size[d],0.0);
+		weight_global[d].assign(size[d],0.0);
+	}
+	int Npore = Mask->PoreCount();
+	double cost = (Npore > 0) ? work_time/Npore : work_time/((Nx-2)*(Ny-2)*(Nz-2));
+	for (int k=1; k<Nz-1; k++){
+		for (int j=1; j<Ny-1; j++){
+			for (int i=1; i<Nx-1; i++){
+				if (Npore == 0 || Mask->id[k*Nx*Ny+j*Nx+i] > 0){
+					weight[0][start[0]+i-1] += cost;
+					weight[1][start[1]+j-1] += cost;
+					weight[2][start[2]+k-1] += cost;
+				}
+			}
+		}
+	}
+	std::array<std::vector<int>,3> old_size = { Dm->BlockSizeX, Dm->BlockSizeY, Dm->BlockSizeZ };
+	std::array<std::vector<int>,3> new_size;
+	for (int d=0; d<3; d++){
+		MPI_Allreduce(weight[d].data(),weight_global[d].data(),size[d],MPI_DOUBLE,MPI_SUM,comm);
+		// keep room for the three inlet/outlet layers used by the boundary conditions
+		new_size[d] = BalanceBlockSizes(weight_global[d],nproc[d],4);
+	}
+	if (new_size == old_size){
+		if (rank==0) printf("Rebalance: block sizes are unchanged \n");
+		return false;
+	}
+
+	// Copy the state to the regular layout (the distributions are in their natural
+	// locations after an even timestep)
+	int *TmpMap = new int[Np];
+	ScaLBL_CopyToHost(TmpMap, dvcMap, Np*sizeof(int));
+	std::vector<double> cState((19+7+7+2+1)*Np);
+	double *dvcState[5] = { fq, Aq, Bq, Den, PhiOld };
+	int nq[5] = { 19, 7, 7, 2, 1 };
+	int offset = 0;
+	for (int s=0; s<5; s++){
+		ScaLBL_CopyToHost(&cState[offset], dvcState[s], nq[s]*Np*sizeof(double));
+		offset += nq[s]*Np;
+	}
+	std::vector<DoubleArray> fields(36);
+	for (int q=0; q<36; q++){
+		fields[q].resize(Nx,Ny,Nz);
+		fields[q].fill(0.0);
+		for (int n=0; n<Np; n++){
+			if ((n < ScaLBL_Comm->LastExterior() || !(n < ScaLBL_Comm->FirstInterior())) && n < ScaLBL_Comm->LastInterior()){
+				int idx = TmpMap[n];
+				if (!(idx < 0) && idx<N) fields[q](idx) = cState[q*Np+n];
+			}
+		}
+	}
+	delete [] TmpMap;
+	DoubleArray phase(Nx,Ny,Nz);
+	ScaLBL_CopyToHost(phase.data(), Phi, N*sizeof(double));
+	Array<char> labels(Nx,Ny,Nz);
+	for (int n=0; n<N; n++) labels(n) = id[n];
+
+	// Move everything to the new blocks
+	const RankInfoStruct &info = Dm->rank_info;
+	std::vector<DoubleArray> new_fields(36);
+	for (int q=0; q<36; q++)
+		redistributeBlocks(comm,info,old_size,fields[q],new_size,new_fields[q]);
+	fields.clear();
+	DoubleArray new_phase, new_distance;
+	Array<char> new_labels;
+	redistributeBlocks(comm,info,old_size,phase,new_size,new_phase);
+	redistributeBlocks(comm,info,old_size,Distance,new_size,new_distance);
+	redistributeBlocks(comm,info,old_size,labels,new_size,new_labels);
+
+	// Rebuild the domains and the layout with the new block sizes
+	domain_db->putVector<int>( "BlockSizeX", new_size[0] );
+	domain_db->putVector<int>( "BlockSizeY", new_size[1] );
+	domain_db->putVector<int>( "BlockSizeZ", new_size[2] );
+	Dm  = std::shared_ptr<Domain>(new Domain(domain_db,comm));
+	Mask  = std::shared_ptr<Domain>(new Domain(domain_db,comm));
+	Nx = Dm->Nx; Ny = Dm->Ny; Nz = Dm->Nz;
+	N = Nx*Ny*Nz;
+	delete [] id;
+	id = new char [N];
+	for (int n=0; n<N; n++) id[n] = new_labels(n);
+	for (int n=0; n<N; n++) Dm->id[n] = 1;
+	Dm->CommInit();
+	// the blob ids belong to the old decomposition
+	Blobs.reset();
+	for (int n=0; n<N; n++) Mask->id[n] = id[n];
+	Distance = new_distance;
+	ClearCartesian();
+	ScaLBL_FreeDeviceMemory(NeighborList);
+	ScaLBL_FreeDeviceMemory(dvcMap);
+	ScaLBL_FreeDeviceMemory(fq);
+	ScaLBL_FreeDeviceMemory(Aq);
+	ScaLBL_FreeDeviceMemory(Bq);
+	ScaLBL_FreeDeviceMemory(Den);
+	ScaLBL_FreeDeviceMemory(Phi);
+	ScaLBL_FreeDeviceMemory(Velocity);
+	ScaLBL_FreeDeviceMemory(PhiOld);
+	ScaLBL_FreeDeviceMemory(AnalysisSums);
+	double porosity = poro;
+	poro = 0.0;
+	Create();
+	poro = porosity;
+
+	// Copy the state back into the new layout
+	TmpMap = new int[Np];
+	ScaLBL_CopyToHost(TmpMap, dvcMap, Np*sizeof(int));
+	cState.assign((19+7+7+2+1)*Np,0.0);
+	for (int q=0; q<36; q++){
+		for (int n=0; n<Np; n++){
+			if ((n < ScaLBL_Comm->LastExterior() || !(n < ScaLBL_Comm->FirstInterior())) && n < ScaLBL_Comm->LastInterior()){
+				int idx = TmpMap[n];
+				if (!(idx < 0) && idx<N) cState[q*Np+n] = new_fields[q](idx);
+			}
+		}
+	}
+	delete [] TmpMap;
+	double *newState[5] = { fq, Aq, Bq, Den, PhiOld };
+	offset = 0;
+	for (int s=0; s<5; s++){
+		ScaLBL_CopyToDevice(newState[s], &cState[offset], nq[s]*Np*sizeof(double));
+		offset += nq[s]*Np;
+	}
+	ScaLBL_CopyToDevice(Phi, new_phase.data(), N*sizeof(double));
+	ScaLBL_DeviceBarrier();
+	MPI_Barrier(comm);
+	if (rank==0){
+		printf("Rebalance: new block sizes (use these in the Domain database to restart) \n");
+		const char *names[3] = { "BlockSizeX", "BlockSizeY", "BlockSizeZ" };
+		for (int d=0; d<3; d++){
+			printf("   %s = ",names[d]);
+			for (size_t b=0; b<new_size[d].size(); b++) printf(b==0 ? "%i" : ", %i",new_size[d][b]);
+			printf("\n");
+		}
+	}
+	return true;
+}
+
 double ScaLBL_ColorModel::SpinoInit(const double delta_sw){
 	const RankInfoStruct rank_info(rank,nprocx,nprocy,nprocz);
 
@@ -1090,7 +1314,6 @@ double ScaLBL_ColorModel::SpinoInit(const double delta_sw){
 	DoubleArray phase(Nx,Ny,Nz);
 	IntArray phase_label(Nx,Ny,Nz);;
 	DoubleArray phase_distance(Nx,Ny,Nz);
-	Array<char> phase_id(Nx,Ny,Nz);
 
 	// Basic algorithm to 
 	// 1. Copy phase field Phi to CPU in phase
@@ -1174,9 +1397,8 @@ double ScaLBL_ColorModel::MorphInit(const double beta, const double morph_delta)
 	double vS = 0.f;
 
 	DoubleArray phase(Nx,Ny,Nz);
-	IntArray phase_label(Nx,Ny,Nz);;
 	DoubleArray phase_distance(Nx,Ny,Nz);
-	Array<char> phase_id(Nx,Ny,Nz);
+	BitMask phase_id(Nx,Ny,Nz);
 
 	// Basic algorithm to 
 	// 1. Copy phase field to CPU
@@ -1194,17 +1416,17 @@ double ScaLBL_ColorModel::MorphInit(const double beta, const double morph_delta)
 	MPI_Allreduce(&count,&count_global,1,MPI_DOUBLE,MPI_SUM,comm);
 	volume_initial = count_global;
 
-	// 2. Identify connected components of phase field -> phase_label
-	//BlobIDstruct new_index;
-	ComputeGlobalBlobIDs(Nx-2,Ny-2,Nz-2,rank_info,phase,Distance,vF,vS,phase_label,comm);
-	MPI_Barrier(comm);
-	// only operate on component "0"
+	// 2. Identify connected components of phase field (only the blobs changed since the last call are relabeled)
+	if (!Blobs) Blobs = std::make_shared<BlobTracker>(Nx-2,Ny-2,Nz-2,rank_info,comm);
+	Blobs->update(phase,Distance,vF,vS);
+	const BlobIDArray& phase_label = Blobs->IDs();
+	// only operate on the largest component (everything if there are no blobs)
+	BlobIDType largest = Blobs->largest();
 	for (int k=0; k<Nz; k++){
 		for (int j=0; j<Ny; j++){
 			for (int i=0; i<Nx; i++){
 				int label = phase_label(i,j,k);
-				if (label == 0 )     phase_id(i,j,k) = 0;
-				else 		     phase_id(i,j,k) = 1;
+				phase_id.set(i,j,k,largest < 0 || label != largest);
 			}
 		}
 	}	
@@ -1306,17 +1528,45 @@ double ScaLBL_ColorModel::MorphInit(const double beta, const double morph_delta)
 	return delta_volume;
 }
 
+/********************************************************
+ * Cartesian copies of the sparse fields (on demand)     *
+ ********************************************************/
+void ScaLBL_ColorModel::CartesianVelocity(){
+	// the velocity only changes with the timestep
+	if (velocity_timestep == timestep && !Velocity_x.empty()) return;
+	if (Velocity_x.empty()){
+		Velocity_x.resize(Nx,Ny,Nz);
+		Velocity_y.resize(Nx,Ny,Nz);
+		Velocity_z.resize(Nx,Ny,Nz);
+	}
+	ScaLBL_Comm->RegularLayout(Map,{&Velocity[0],&Velocity[Np],&Velocity[2*Np]},{&Velocity_x,&Velocity_y,&Velocity_z});
+	velocity_timestep = timestep;
+}
+
+void ScaLBL_ColorModel::CartesianPhase(){
+	// Phi is already stored on the full grid
+	if (Phase_Cart.empty()) Phase_Cart.resize(Nx,Ny,Nz);
+	ScaLBL_CopyToHost(Phase_Cart.data(), Phi, N*sizeof(double));
+}
+
+void ScaLBL_ColorModel::ClearCartesian(){
+	Velocity_x.clear();
+	Velocity_y.clear();
+	Velocity_z.clear();
+	Phase_Cart.clear();
+	velocity_timestep = -1;
+}
+
 void ScaLBL_ColorModel::WriteDebug(){
-	// Copy back final phase indicator field and convert to regular layout
-	DoubleArray PhaseField(Nx,Ny,Nz);
-	//ScaLBL_Comm->RegularLayout(Map,Phi,PhaseField);
-	ScaLBL_CopyToHost(PhaseField.data(), Phi, sizeof(double)*N);
+	// Copy back final phase indicator field
+	CartesianPhase();
 	char LocalRankFilename[100];
 	FILE *OUTFILE;
 	sprintf(LocalRankFilename,"Phase.%05i.raw",rank); //change this file name to include the size
 	OUTFILE = fopen(LocalRankFilename,"wb");
-	fwrite(PhaseField.data(),8,N,OUTFILE);
+	fwrite(Phase_Cart.data(),8,N,OUTFILE);
 	fclose(OUTFILE);
+	if (ReleaseCartesian) ClearCartesian();
 }
 
 void ScaLBL_ColorModel::WriteDebugYDW(){
@@ -1327,70 +1577,29 @@ void ScaLBL_ColorModel::WriteDebugYDW(){
 	    mkdir(LocalRankFoldername, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
     }
 	MPI_Barrier(comm);
-	// Copy back final phase indicator field and convert to regular layout
-	DoubleArray PhaseField(Nx,Ny,Nz);
-	//ScaLBL_Comm->RegularLayout(Map,Phi,PhaseField);
-	ScaLBL_CopyToHost(PhaseField.data(), Phi, sizeof(double)*N);
-	//create the file
-	
-	FILE *OUTFILE;
-	char LocalRankFilename[100];
-	sprintf(LocalRankFilename,"rawVis%d/Part_%d_%d_%d_%d_%d_%d_%d.txt",timestep,rank,Nx,Ny,Nz,nprocx,nprocy,nprocz); //change this file name to include the size
-	OUTFILE = fopen(LocalRankFilename,"w");
-    //td::fstream ofs(LocalRankFilename, std::ios::out | std::ios::binary );
-	for (int k=0; k<Nz; k++){
-		for (int j=0; j<Ny; j++){
-			for (int i=0; i<Nx; i++){
-				//printf("%f\n",PhaseField(i, j, k));
-				//float value = PhaseField(i, j, k);
-			    //ofs.write( (const char*) &value, sizeof(value) );
-			    fprintf(OUTFILE,"%f\n",PhaseField(i, j, k));
-			}
-		}
-	}
-
-	FILE *OUTFILEX;
-	char LocalRankFilenameX[100];
-	sprintf(LocalRankFilenameX,"rawVis%d/Velx_Part_%d_%d_%d_%d_%d_%d_%d.txt",timestep,rank,Nx,Ny,Nz,nprocx,nprocy,nprocz); //change this file name to include the size
-	OUTFILEX = fopen(LocalRankFilenameX,"w");
-
-	for (int k=0; k<Nz; k++){
-		for (int j=0; j<Ny; j++){
-			for (int i=0; i<Nx; i++){
-			    fprintf(OUTFILEX,"%f\n",Velocity_x(i, j, k));
-			}
-		}
-	}
-	
-	FILE *OUTFILEY;
-	char LocalRankFilenameY[100];
-	sprintf(LocalRankFilenameY,"rawVis%d/Vely_Part_%d_%d_%d_%d_%d_%d_%d.txt",timestep,rank,Nx,Ny,Nz,nprocx,nprocy,nprocz); //change this file name to include the size
-	OUTFILEY = fopen(LocalRankFilenameY,"w");
-	for (int k=0; k<Nz; k++){
-		for (int j=0; j<Ny; j++){
-			for (int i=0; i<Nx; i++){
-			    fprintf(OUTFILEY,"%f\n",Velocity_y(i, j, k));
-			}
-		}
-	}
-	
-	FILE *OUTFILEZ;
-	char LocalRankFilenameZ[100];
-	sprintf(LocalRankFilenameZ,"rawVis%d/Velz_Part_%d_%d_%d_%d_%d_%d_%d.txt",timestep,rank,Nx,Ny,Nz,nprocx,nprocy,nprocz); //change this file name to include the size
-	OUTFILEZ = fopen(LocalRankFilenameZ,"w");
-	for (int k=0; k<Nz; k++){
-		for (int j=0; j<Ny; j++){
-			for (int i=0; i<Nx; i++){
-			    fprintf(OUTFILEZ,"%f\n",Velocity_z(i, j, k));
-			}
+	// Copy back final phase indicator field and the current velocity
+	CartesianPhase();
+	CartesianVelocity();
+	// every rank writes its interior block into one global file per field (no stitching needed)
+	// the writes run on the analysis threads from copies of the fields, so the simulation can go on
+	auto global_size = Dm->GlobalSize();
+	auto global_start = Dm->GlobalStart();
+	auto fields = std::make_shared<std::vector<DoubleArray>>();
+	fields->push_back(Phase_Cart);
+	fields->push_back(Velocity_x);
+	fields->push_back(Velocity_y);
+	fields->push_back(Velocity_z);
+	int step = timestep;
+	auto write = [global_size,global_start,fields,step]( MPI_Comm write_comm ){
+		const char *names[4] = { "Phase", "Velx", "Vely", "Velz" };
+		char GlobalFilename[100];
+		for (int i=0; i<4; i++){
+			sprintf(GlobalFilename,"rawVis%d/%s_%d_%d_%d.raw",step,names[i],global_size[0],global_size[1],global_size[2]);
+			writeGlobalArray(write_comm,global_size,global_start,(*fields)[i],1,GlobalFilename);
 		}
-	}
-
-//	fwrite(PhaseField.data(),8,N,OUTFILE);
-	fclose(OUTFILE);
-	fclose(OUTFILEX);
-	fclose(OUTFILEY);
-	fclose(OUTFILEZ);
-	MPI_Barrier(comm);
-    //ofs.close();
+	};
+	if (Analysis)
+		Analysis->add(write);
+	else
+		write(comm);
 }
@@ -28,6 +28,9 @@ Implementation of color lattice boltzmann model
 //#include "analysis/TwoPhase.h"
 #include "analysis/analysis.h" //only used for blob identification in morph
 #include "analysis/distance.h" //for distance map calculation
+#include "analysis/AnalysisThreads.h"
+#include "analysis/SteadyState.h"
+#include "analysis/Minkowski.h"
 #include "common/ScaLBL.h"
 #include "common/Communication.h"
 #include "common/MPI_Helpers.h"
@@ -73,6 +76,10 @@ public:
     std::shared_ptr<Database> domain_db;
     std::shared_ptr<Database> color_db;
     std::shared_ptr<Database> analysis_db;
+    // threads for the in-situ analysis (created by Run)
+    std::shared_ptr<AnalysisThreads> Analysis;
+    // persistent blob ids of the phase field (created on first use, reset by Rebalance)
+    std::shared_ptr<BlobTracker> Blobs;
 
     IntArray Map;
     // the poreindexed arrays
@@ -84,15 +91,21 @@ public:
 	double *ColorGrad;
 	double *Velocity;
 	double *Pressure;
+	double *PhiOld;        // Phi at the last analysis step (for the settling parameter)
+	double *AnalysisSums;  // device accumulators for ScaLBL_Color_Averages
 	// the cartesian arrays
     DoubleArray Distance;
-    DoubleArray Density_A_Cart;
-    DoubleArray Density_B_Cart;
+    // allocated on first use by CartesianVelocity() and CartesianPhase(), then reused
     DoubleArray Velocity_x;
     DoubleArray Velocity_y;
     DoubleArray Velocity_z;
+    DoubleArray Phase_Cart;
 private:
 	MPI_Comm comm;
+	// free the on-demand Cartesian arrays after every analysis / visualisation step
+	bool ReleaseCartesian;
+	// timestep at which Velocity_x/y/z were last filled
+	int velocity_timestep;
     
 	int dist_mem_size;
 	int neighborSize;
@@ -106,5 +119,9 @@ private:
     void AssignComponentLabels(double *phase);
     double MorphInit(const double beta, const double morph_delta);
     double SpinoInit(const double delta_sw);
+    bool Rebalance(double work_time);
+    void CartesianVelocity();
+    void CartesianPhase();
+    void ClearCartesian();
 };
 
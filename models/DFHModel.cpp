@@ -100,7 +100,7 @@ void ScaLBL_DFHModel::ReadParams(string filename){
 void ScaLBL_DFHModel::SetDomain(){
 	Dm  = std::shared_ptr<Domain>(new Domain(domain_db,comm));      // full domain for analysis
 	Mask  = std::shared_ptr<Domain>(new Domain(domain_db,comm));    // mask domain removes immobile phases
-	Nx+=2; Ny+=2; Nz += 2;
+	Nx = Dm->Nx; Ny = Dm->Ny; Nz = Dm->Nz;   // blocks may differ in size (BlockSizeX/Y/Z)
 	N = Nx*Ny*Nz;
 	id = new char [N];
 	for (int i=0; i<Nx*Ny*Nz; i++) Dm->id[i] = 1;               // initialize this way
@@ -195,6 +195,23 @@ void ScaLBL_DFHModel::Create(){
 	Mask->CommInit();
 	Np=Mask->PoreCount();
 	//...........................................................................
+	// Check that everything allocated below fits in memory before allocating any of it
+	ScaLBL_MemoryBudget Budget;
+	Budget.AddCommunicator("ScaLBL_Comm",Mask);
+	Budget.Add("Map",sizeof(int)*N,false);
+	Budget.Add("neighborList (host)",sizeof(int)*18*((Np/16 + 2)*16),false);
+	Budget.Add("NeighborList",sizeof(int)*18*Np);
+	Budget.Add("dvcMap",sizeof(int)*Np);
+	Budget.Add("fq",sizeof(double)*19*Np);
+	Budget.Add("Aq, Bq",sizeof(double)*14*Np);
+	Budget.Add("Den",sizeof(double)*2*Np);
+	Budget.Add("Phi, Pressure",sizeof(double)*2*Np);
+	Budget.Add("Velocity, Gradient",sizeof(double)*6*Np);
+	Budget.Add("SolidPotential",sizeof(double)*3*Np);
+	Budget.Add("TmpMap (host)",sizeof(int)*Np,false);
+	Budget.Add("Distance",sizeof(double)*N,false);
+	Budget.Check(comm,"DFH model");
+	//...........................................................................
 	if (rank==0)    printf ("Create ScaLBL_Communicator \n");
 	// Create a communicator for the device (will use optimized layout)
 	// ScaLBL_Communicator ScaLBL_Comm(Mask); // original
@@ -204,7 +221,17 @@ void ScaLBL_DFHModel::Create(){
 	if (rank==0)    printf ("Set up memory efficient layout, %i | %i | %i \n", Np, Npad, N);
 	Map.resize(Nx,Ny,Nz);       Map.fill(-2);
 	auto neighborList= new int[18*Npad];
-	Np = ScaLBL_Comm->MemoryOptimizedLayoutAA(Map,neighborList,Mask->id,Np);
+	// Reuse the layout from an earlier run on the same image and decomposition
+	bool LayoutCache = false;
+	if (domain_db->keyExists( "LayoutCache" )) LayoutCache = domain_db->getScalar<bool>( "LayoutCache" );
+	std::string LayoutFile = std::string("Layout.") + LocalRankString;
+	if (LayoutCache && ScaLBL_Comm->ReadLayout(LayoutFile,Map,neighborList,Mask->id,Np)){
+		if (rank==0)    printf ("Read layout from %s \n", LayoutFile.c_str());
+	}
+	else {
+		Np = ScaLBL_Comm->MemoryOptimizedLayoutAA(Map,neighborList,Mask->id,Np);
+		if (LayoutCache) ScaLBL_Comm->WriteLayout(LayoutFile,Map,neighborList,Mask->id,Np);
+	}
 	MPI_Barrier(comm);
 
 	//...........................................................................
@@ -250,6 +277,7 @@ void ScaLBL_DFHModel::Create(){
 	ScaLBL_DeviceBarrier();
 	delete [] TmpMap;
 	Distance.resize(Nx,Ny,Nz);
+	Budget.Report(comm,"DFH model");
 }        
 
 /********************************************************
@@ -385,9 +413,7 @@ void ScaLBL_DFHModel::AssignSolidPotential(){
 	DoubleArray Psy(Nx,Ny,Nz);
 	DoubleArray Psz(Nx,Ny,Nz);
 	DoubleArray Psnorm(Nx,Ny,Nz);
-	ScaLBL_Comm->RegularLayout(Map,&SolidPotential[0],Psx);
-	ScaLBL_Comm->RegularLayout(Map,&SolidPotential[Np],Psy);
-	ScaLBL_Comm->RegularLayout(Map,&SolidPotential[2*Np],Psz);
+	ScaLBL_Comm->RegularLayout(Map,{&SolidPotential[0],&SolidPotential[Np],&SolidPotential[2*Np]},{&Psx,&Psy,&Psz});
 
 	for (int n=0; n<N; n++) Psnorm(n) = Psx(n)*Psx(n)+Psy(n)*Psy(n)+Psz(n)*Psz(n);
 	FILE *PFILE;
@@ -608,25 +634,25 @@ void ScaLBL_DFHModel::Run(){
 void ScaLBL_DFHModel::WriteDebug(){
 	// Copy back final phase indicator field and convert to regular layout
 	DoubleArray PhaseField(Nx,Ny,Nz);
-	ScaLBL_Comm->RegularLayout(Map,Phi,PhaseField);
+	DoubleArray AField(Nx,Ny,Nz);
+	DoubleArray BField(Nx,Ny,Nz);
+	ScaLBL_Comm->RegularLayout(Map,{Phi,&Den[0],&Den[Np]},{&PhaseField,&AField,&BField});
 	FILE *OUTFILE;
 	sprintf(LocalRankFilename,"Phase.%05i.raw",rank);
 	OUTFILE = fopen(LocalRankFilename,"wb");
 	fwrite(PhaseField.data(),8,N,OUTFILE);
 	fclose(OUTFILE);
 
-	ScaLBL_Comm->RegularLayout(Map,&Den[0],PhaseField);
 	FILE *AFILE;
 	sprintf(LocalRankFilename,"A.%05i.raw",rank);
 	AFILE = fopen(LocalRankFilename,"wb");
-	fwrite(PhaseField.data(),8,N,AFILE);
+	fwrite(AField.data(),8,N,AFILE);
 	fclose(AFILE);
 
-	ScaLBL_Comm->RegularLayout(Map,&Den[Np],PhaseField);
 	FILE *BFILE;
 	sprintf(LocalRankFilename,"B.%05i.raw",rank);
 	BFILE = fopen(LocalRankFilename,"wb");
-	fwrite(PhaseField.data(),8,N,BFILE);
+	fwrite(BField.data(),8,N,BFILE);
 	fclose(BFILE);
 
 }
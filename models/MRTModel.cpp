@@ -128,7 +128,7 @@ void ScaLBL_MRTModel::ReadParams(string filename){
 void ScaLBL_MRTModel::SetDomain(){
 	//Dm  = std::shared_ptr<Domain>(new Domain(domain_db,comm));      // full domain for analysis
 	Mask  = std::shared_ptr<Domain>(new Domain(domain_db,comm));    // mask domain removes immobile phases
-	Nx+=2; Ny+=2; Nz += 2;
+	Nx = Mask->Nx; Ny = Mask->Ny; Nz = Mask->Nz;   // blocks may differ in size (BlockSizeX/Y/Z)
 	N = Nx*Ny*Nz;
 	Geom.resize(Nx,Ny,Nz);
 	Velocity_x.resize(Nx,Ny,Nz);
@@ -154,21 +154,8 @@ void ScaLBL_MRTModel::ReadInput(){
     sprintf(LocalRankFilename,"%s%s","ID.",LocalRankString);
     sprintf(LocalRestartFile,"%s%s","Restart.",LocalRankString);
 
-	// Generate the signed Geom map
-	// Initialize the domain and communication
-	//Array<char> id_solid(Nx,Ny,Nz);
-	int count = 0;
-	// Solve for the position of the solid phase
-	for (int k=0;k<Nz;k++){
-		for (int j=0;j<Ny;j++){
-			for (int i=0;i<Nx;i++){
-				int n = k*Nx*Ny+j*Nx+i;
-				// Initialize the solid phase
-				if (Mask->id[n] > 0)	Geom(i,j,k) = 1;
-				else	     	    Geom(i,j,k) = 0;
-			}
-		}
-	}
+	// Solve for the position of the solid phase (one bit per cell)
+	Geom = Mask->PoreMask();
     if (rank == 0) cout << "Geometry successfully loaded" << endl;
 }
 
@@ -181,18 +168,46 @@ void ScaLBL_MRTModel::Create(){
 	// Initialize communication structures in averaging domain
 	//for (int i=0; i<Nx*Ny*Nz; i++) Dm->id[i] = Mask->id[i];
 	Mask->CommInit();
+	Np=Mask->PoreCount();
+	//...........................................................................
+	// Check that everything allocated below fits in memory before allocating any of it
+	ScaLBL_MemoryBudget Budget;
+	Budget.AddCommunicator("ScaLBL_Comm",Mask);
+	Budget.Add("Map",sizeof(int)*N,false);
+	Budget.Add("neighborList (host)",sizeof(int)*18*((Np/16 + 2)*16),false);
+	Budget.Add("NeighborList",sizeof(int)*18*Np);
+	Budget.Add("fq",sizeof(double)*19*Np);
+	Budget.Add("Pressure, Velocity",sizeof(double)*4*Np);
+	if (thermalFlag){
+		Budget.Add("cq",sizeof(double)*19*Np);
+		Budget.Add("Concentration",sizeof(double)*Np);
+	}
+	// Cartesian arrays allocated in SetDomain
+	Budget.Add("Geom (host)",Geom.bytes(),false);
+	Budget.Add("Velocity_x/y/z (host)",sizeof(double)*3*N,false);
+	if (thermalFlag) Budget.Add("ConcentrationCart (host)",sizeof(double)*N,false);
+	Budget.Check(comm,"MRT model");
 	//...........................................................................
 	if (rank==0)    printf ("Create ScaLBL_Communicator \n");
 	// Create a communicator for the device (will use optimized layout)
 	// ScaLBL_Communicator ScaLBL_Comm(Mask); // original
 	ScaLBL_Comm  = std::shared_ptr<ScaLBL_Communicator>(new ScaLBL_Communicator(Mask));
-	Np=Mask->PoreCount();
 	int Npad=(Np/16 + 2)*16; // the fuck is this
 	if (rank==0)    printf ("Set up memory efficient layout \n");
 	Map.resize(Nx,Ny,Nz);       
 	//Map.fill(-2);
 	auto neighborList= new int[18*Npad];
-	Np = ScaLBL_Comm->MemoryOptimizedLayoutAA(Map,neighborList,Mask->id,Np);
+	// Reuse the layout from an earlier run on the same image and decomposition
+	bool LayoutCache = false;
+	if (domain_db->keyExists( "LayoutCache" )) LayoutCache = domain_db->getScalar<bool>( "LayoutCache" );
+	std::string LayoutFile = std::string("Layout.") + LocalRankString;
+	if (LayoutCache && ScaLBL_Comm->ReadLayout(LayoutFile,Map,neighborList,Mask->id,Np)){
+		if (rank==0)    printf ("Read layout from %s \n", LayoutFile.c_str());
+	}
+	else {
+		Np = ScaLBL_Comm->MemoryOptimizedLayoutAA(Map,neighborList,Mask->id,Np);
+		if (LayoutCache) ScaLBL_Comm->WriteLayout(LayoutFile,Map,neighborList,Mask->id,Np);
+	}
 	MPI_Barrier(comm);
 	//...........................................................................
 	//                MAIN  VARIABLES ALLOCATED HERE
@@ -220,7 +235,7 @@ void ScaLBL_MRTModel::Create(){
 	// copy the neighbor list 
 	ScaLBL_CopyToDevice(NeighborList, neighborList, neighborSize);
 	MPI_Barrier(comm);
-	
+	Budget.Report(comm,"MRT model");
 }        
 
 void ScaLBL_MRTModel::Initialize(){
@@ -298,6 +313,15 @@ void ScaLBL_MRTModel::Run(){
 	starttime = MPI_Wtime();
 	
 	if (rank==0) printf("No. of timesteps: %i , Boundary Condition: %i \n", timestepMax, BoundaryCondition);
+	// the geometry does not change, so its Minkowski functionals are computed once
+	if (mrt_db->keyExists( "compute_minkowski" ) && mrt_db->getScalar<bool>( "compute_minkowski" )){
+		if (rank==0) printf("Computing Minkowski functionals \n");
+		DoubleArray Distance(Nx,Ny,Nz);
+		CalcDist(Distance,Geom,*Mask);
+		Minkowski Morphology(comm);
+		Morphology.ComputeScalar(Distance,0.0,1.5);
+		Morphology.PrintAll();
+	}
 	
 	if (rank==0) printf("********************************************************\n");
 	timestep=0;
@@ -388,9 +412,7 @@ void ScaLBL_MRTModel::Run(){
 			ScaLBL_D3Q19_Pressure(fq,Pressure,Np);
 		    
 			ScaLBL_DeviceBarrier(); MPI_Barrier(comm);
-			ScaLBL_Comm->RegularLayout(Map,&Velocity[0],Velocity_x);
-			ScaLBL_Comm->RegularLayout(Map,&Velocity[Np],Velocity_y);
-			ScaLBL_Comm->RegularLayout(Map,&Velocity[2*Np],Velocity_z);
+			ScaLBL_Comm->RegularLayout(Map,{&Velocity[0],&Velocity[Np],&Velocity[2*Np]},{&Velocity_x,&Velocity_y,&Velocity_z});
 			double count_loc=0;
 			double count;
 			double vax,vay,vaz;
@@ -400,7 +422,7 @@ void ScaLBL_MRTModel::Run(){
 				for (int j=1; j<Ny-1; j++){
 					for (int i=1; i<Nx-1; i++){
 						count_loc+=1.0;
-						if (Geom(i,j,k) > 0){
+						if (Geom(i,j,k)){
 							vax_loc += Velocity_x(i,j,k);
 							vay_loc += Velocity_y(i,j,k);
 							vaz_loc += Velocity_z(i,j,k);
@@ -431,26 +453,10 @@ void ScaLBL_MRTModel::Run(){
 	                    mkdir(LocalRankFoldername, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
                     }
 	                MPI_Barrier(comm);
-	                //create the file
-	                FILE *OUTFILE;
-	                char LocalRankFilename[100];
-	                sprintf(LocalRankFilename,"rawVisConcentration%d/Part_%d_%d_%d_%d_%d_%d_%d.txt",timestep,rank,Nx,Ny,Nz,nprocx,nprocy,nprocz); //change this file name to include the size
-	                OUTFILE = fopen(LocalRankFilename,"w");
-                    int idx;
-                    for (int k=0; k<Nz; k++){
-	                    for (int j=0; j<Ny; j++){
-		                    for (int i=0; i<Nx; i++){
-				                idx=Map(i,j,k);
-		                        //if (idx<0) ConcentrationCart(i, j, k)=69420;
-                                //fqTensor(i,j,k,d)=fqField(i,j,k);
-			                    //fprintf(OUTFILE,"%f\n",ConcentrationCart(i, j, k));
-			                    double temp = ConcentrationCart(i,j,k);
-	                            fwrite(&temp,sizeof(double),1,OUTFILE);
-		                    }
-	                    }
-                    }
-	                fclose(OUTFILE);
-	                MPI_Barrier(comm);
+	                // one global file (ghost layers excluded) written collectively by all ranks
+	                char GlobalFilename[100];
+	                sprintf(GlobalFilename,"rawVisConcentration%d/Concentration_%d_%d_%d.raw",timestep,Mask->GlobalSize()[0],Mask->GlobalSize()[1],Mask->GlobalSize()[2]);
+	                writeGlobalArray(comm,Mask->GlobalSize(),Mask->GlobalStart(),ConcentrationCart,1,GlobalFilename);
                 }
 
 
@@ -462,7 +468,7 @@ void ScaLBL_MRTModel::Run(){
 				    for (int j=1; j<Ny-1; j++){
 					    for (int i=1; i<Nx-1; i++){
 						    count_loc+=1.0;
-						    if (Geom(i,j,k) > 0){
+						    if (Geom(i,j,k)){
 							    meanCLoc += ConcentrationCart(i,j,k);
 						    }
 					    }
@@ -476,9 +482,6 @@ void ScaLBL_MRTModel::Run(){
 		    }
 			
 			
-			//if (rank==0) printf("Computing Minkowski functionals \n");
-			//Morphology.ComputeScalar(Geom,0.f);
-			//Morphology.PrintAll();
 			double mu = (tau-0.5)/3.f; //this is the kimematic viscosity, so use momentum in v to cancel out
 			double gradP=sqrt(Fx*Fx+Fy*Fy+Fz*Fz)+(din-dout)/((Nz-2)*nprocz)/3;
 			double absperm = voxelSize*voxelSize*mu*sqrt(vax*vax+vay*vay+vaz*vaz)/gradP;
@@ -560,60 +563,24 @@ void ScaLBL_MRTModel::velPField(){
 	    mkdir(LocalRankFoldername, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
     }
 	MPI_Barrier(comm);
-	//create the file
-	FILE *OUTFILE;
-	char LocalRankFilename[100];
-	sprintf(LocalRankFilename,"rawVisVelP%d/Part_%d_%d_%d_%d_%d_%d_%d.txt",timestep,rank,Nx,Ny,Nz,nprocx,nprocy,nprocz); //change this file name to include the size
-	OUTFILE = fopen(LocalRankFilename,"wb");
     DoubleArray vx(Nx, Ny, Nz);
     DoubleArray vy(Nx, Ny, Nz);
     DoubleArray vz(Nx, Ny, Nz);
     DoubleArray P(Nx, Ny, Nz);
-	ScaLBL_Comm->RegularLayout(Map,&Velocity[0],vx);
-	ScaLBL_Comm->RegularLayout(Map,&Velocity[Np],vy);
-	ScaLBL_Comm->RegularLayout(Map,&Velocity[2*Np],vz);
-    ScaLBL_Comm->RegularLayout(Map,&Pressure[0],P);
-//	fwrite(vx.data(),sizeof(double),N,OUTFILE);
-//	fwrite(vy.data(),sizeof(double),N,OUTFILE);
-//	fwrite(vz.data(),sizeof(double),N,OUTFILE);
-//	fwrite(P.data(),sizeof(double),N,OUTFILE);
-    for (int k=0; k<Nz; k++){
-	    for (int j=0; j<Ny; j++){
-		    for (int i=0; i<Nx; i++){
-			    //fprintf(OUTFILE,"%f\n",vx(i, j, k));
-			    double temp = vx(i,j,k);
-	            fwrite(&temp,sizeof(double),1,OUTFILE);
-		    }
-	    }
-    }
-    for (int k=0; k<Nz; k++){
-	    for (int j=0; j<Ny; j++){
-		    for (int i=0; i<Nx; i++){
-			    double temp = vy(i,j,k);
-			    //fprintf(OUTFILE,"%f\n",vy(i, j, k));
-	            fwrite(&temp,sizeof(double),1,OUTFILE);
-		    }
-	    }
-    }
-    for (int k=0; k<Nz; k++){
-	    for (int j=0; j<Ny; j++){
-		    for (int i=0; i<Nx; i++){
-			    double temp = vz(i,j,k);
-			    //fprintf(OUTFILE,"%f\n",vz(i, j, k));
-	            fwrite(&temp,sizeof(double),1,OUTFILE);
-		    }
-	    }
-    }
-    for (int k=0; k<Nz; k++){
-	    for (int j=0; j<Ny; j++){
-		    for (int i=0; i<Nx; i++){
-			    double temp = P(i,j,k);
-			    //fprintf(OUTFILE,"%f\n",P(i, j, k));
-	            fwrite(&temp,sizeof(double),1,OUTFILE);
-		    }
-	    }
-    }
-	fclose(OUTFILE);
-	MPI_Barrier(comm);
+	ScaLBL_Comm->RegularLayout(Map,{&Velocity[0],&Velocity[Np],&Velocity[2*Np],&Pressure[0]},{&vx,&vy,&vz,&P});
+	// each field goes to one global file (ghost layers excluded) written collectively by all ranks
+	auto global_size = Mask->GlobalSize();
+	int gx = global_size[0];
+	int gy = global_size[1];
+	int gz = global_size[2];
+	char GlobalFilename[100];
+	sprintf(GlobalFilename,"rawVisVelP%d/Velx_%d_%d_%d.raw",timestep,gx,gy,gz);
+	writeGlobalArray(comm,Mask->GlobalSize(),Mask->GlobalStart(),vx,1,GlobalFilename);
+	sprintf(GlobalFilename,"rawVisVelP%d/Vely_%d_%d_%d.raw",timestep,gx,gy,gz);
+	writeGlobalArray(comm,Mask->GlobalSize(),Mask->GlobalStart(),vy,1,GlobalFilename);
+	sprintf(GlobalFilename,"rawVisVelP%d/Velz_%d_%d_%d.raw",timestep,gx,gy,gz);
+	writeGlobalArray(comm,Mask->GlobalSize(),Mask->GlobalStart(),vz,1,GlobalFilename);
+	sprintf(GlobalFilename,"rawVisVelP%d/Pressure_%d_%d_%d.raw",timestep,gx,gy,gz);
+	writeGlobalArray(comm,Mask->GlobalSize(),Mask->GlobalStart(),P,1,GlobalFilename);
 }
 
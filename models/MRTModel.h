@@ -27,6 +27,8 @@
 #include "common/ScaLBL.h"
 #include "common/Communication.h"
 #include "common/MPI_Helpers.h"
+#include "analysis/distance.h"
+#include "analysis/Minkowski.h"
 
 //#include "ProfilerApp.h"
 
@@ -69,14 +71,13 @@ public:
     std::shared_ptr<Database> thermal_db;
 
     IntArray Map;
-    DoubleArray Geom;
+    BitMask Geom;       // pore cells (Mask->id > 0)
     int *NeighborList;
     double *fq;
     double *cq; //concentration
     double *Velocity;
     double *Pressure;
     double *Concentration;
-    //Minkowski Morphology;
 	
 	DoubleArray PressureCart;
     DoubleArray Velocity_x;
@@ -0,0 +1,130 @@
+// Compare the global blob ids computed on 8 ranks (2x2x2) with those computed on 1 rank
+// The medium is random (independent cells) and periodic, so many blobs cross the rank boundaries
+// Blobs of equal size may be numbered differently, so the labels must match up to a one-to-one map
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+#include <vector>
+#include "common/Array.h"
+#include "common/Communication.h"
+#include "analysis/analysis.h"
+
+
+// Fill the phase (with one layer of ghosts) for the block (ix,jy,kz) of size n from the global medium
+static void fillPhase( const Array<bool>& medium, int n, int ix, int jy, int kz, DoubleArray& Phase )
+{
+    int N = medium.size(0);
+    Phase.resize(n+2,n+2,n+2);
+    for (int k=0; k<n+2; k++) {
+        for (int j=0; j<n+2; j++) {
+            for (int i=0; i<n+2; i++) {
+                int x = (ix*n+i-1+N)%N;
+                int y = (jy*n+j-1+N)%N;
+                int z = (kz*n+k-1+N)%N;
+                Phase(i,j,k) = medium(x,y,z) ? 1:-1;
+            }
+        }
+    }
+}
+
+
+//***************************************************************************************
+int main(int argc, char **argv)
+{
+    // Initialize MPI
+    int rank, nprocs;
+    MPI_Init(&argc,&argv);
+    MPI_Comm comm = MPI_COMM_WORLD;
+    MPI_Comm_rank(comm,&rank);
+    MPI_Comm_size(comm,&nprocs);
+    if ( nprocs != 8 ) {
+        if ( rank==0 )
+            printf("TestBlobIdentification must be run with 8 processors\n");
+        MPI_Finalize();
+        return 1;
+    }
+    int fail = 0;
+    {
+
+    const int n = 16;       // Local size on 8 ranks
+    const int N = 2*n;      // Global size
+    const double porosity[3] = { 0.25, 0.32, 0.5 };
+    std::mt19937 gen( 42 );
+    std::uniform_real_distribution<double> dist( 0.0, 1.0 );
+    for (int p=0; p<3; p++) {
+        // Every rank generates the same global medium
+        Array<bool> medium(N,N,N);
+        for (size_t i=0; i<medium.length(); i++)
+            medium(i) = dist(gen) < porosity[p];
+
+        // Label the whole domain on rank 0
+        BlobIDArray ID1;
+        int N1 = 0;
+        MPI_Comm comm1;
+        MPI_Comm_split(comm,rank==0 ? 0:MPI_UNDEFINED,rank,&comm1);
+        if ( rank==0 ) {
+            DoubleArray Phase, SignDist(N+2,N+2,N+2);
+            fillPhase( medium, N, 0, 0, 0, Phase );
+            SignDist.fill(1);
+            N1 = ComputeGlobalBlobIDs( N, N, N, RankInfoStruct(0,1,1,1), Phase, SignDist, 0, 0, ID1, comm1 );
+            MPI_Comm_free(&comm1);
+        }
+
+        // Label the domain on 8 ranks
+        RankInfoStruct rank_info(rank,2,2,2);
+        DoubleArray Phase, SignDist(n+2,n+2,n+2);
+        fillPhase( medium, n, rank_info.ix, rank_info.jy, rank_info.kz, Phase );
+        SignDist.fill(1);
+        BlobIDArray ID8;
+        int N8 = ComputeGlobalBlobIDs( n, n, n, rank_info, Phase, SignDist, 0, 0, ID8, comm );
+
+        // Gather the interior ids on rank 0
+        std::vector<int> local(n*n*n), all(rank==0 ? 8*n*n*n:0);
+        for (int k=0; k<n; k++)
+            for (int j=0; j<n; j++)
+                for (int i=0; i<n; i++)
+                    local[i+j*n+k*n*n] = ID8(i+1,j+1,k+1);
+        MPI_Gather(local.data(),n*n*n,MPI_INT,all.data(),n*n*n,MPI_INT,0,comm);
+
+        // Check that the ids map one-to-one
+        if ( rank==0 ) {
+            std::vector<int> map18(N1,-1), map81(N8,-1);
+            int diff = 0;
+            for (int r=0; r<8; r++) {
+                RankInfoStruct info(r,2,2,2);
+                for (int k=0; k<n; k++) {
+                    for (int j=0; j<n; j++) {
+                        for (int i=0; i<n; i++) {
+                            int id1 = ID1(info.ix*n+i+1,info.jy*n+j+1,info.kz*n+k+1);
+                            int id8 = all[r*n*n*n+i+j*n+k*n*n];
+                            if ( id1 < 0 || id8 < 0 ) {
+                                diff += id1 != id8 ? 1:0;
+                            } else if ( id1 >= N1 || id8 >= N8 ) {
+                                diff++;
+                            } else {
+                                if ( map18[id1] == -1 && map81[id8] == -1 ) {
+                                    map18[id1] = id8;
+                                    map81[id8] = id1;
+                                }
+                                diff += map18[id1] != id8 || map81[id8] != id1 ? 1:0;
+                            }
+                        }
+                    }
+                }
+            }
+            printf("%i^3, porosity %0.2f: %i blobs on 1 rank, %i blobs on 8 ranks, %i cells differ\n",
+                N,porosity[p],N1,N8,diff);
+            if ( N1 != N8 || diff > 0 )
+                fail = 1;
+        }
+    }
+    MPI_Bcast(&fail,1,MPI_INT,0,comm);
+    if ( rank==0 )
+        printf(fail==0 ? "The blob ids on 8 ranks match 1 rank\n" : "The blob ids on 8 ranks do not match 1 rank\n");
+
+    }
+    MPI_Barrier(comm);
+    MPI_Finalize();
+    return fail;
+}
@@ -0,0 +1,111 @@
+// Compare the blob labels from ComputeBlob (union-find) with a flood fill
+// The media are random (independent cells) at porosities around the percolation threshold
+// Both number the blobs in the order of their first cell (x fastest)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+#include <vector>
+#include "common/Array.h"
+#include "common/BitMask.h"
+#include "analysis/analysis.h"
+
+
+// Label the face-connected components of isPhase with a breadth-first flood fill
+static int FloodFill( const Array<bool>& isPhase, BlobIDArray& ID, bool periodic, int start_id )
+{
+    int Nx = isPhase.size(0);
+    int Ny = isPhase.size(1);
+    int Nz = isPhase.size(2);
+    const int d[6][3] = {{1,0,0},{-1,0,0},{0,1,0},{0,-1,0},{0,0,1},{0,0,-1}};
+    int id = start_id;
+    std::vector<int> queue;
+    for (int n=0; n<Nx*Ny*Nz; n++) {
+        if ( !isPhase(n) || ID(n) >= start_id )
+            continue;
+        ID(n) = id;
+        queue.assign( 1, n );
+        for (size_t q=0; q<queue.size(); q++) {
+            int x = queue[q]%Nx;
+            int y = (queue[q]/Nx)%Ny;
+            int z = queue[q]/(Nx*Ny);
+            for (int p=0; p<6; p++) {
+                int x2 = x+d[p][0];
+                int y2 = y+d[p][1];
+                int z2 = z+d[p][2];
+                if ( periodic ) {
+                    x2 = (x2+Nx)%Nx;
+                    y2 = (y2+Ny)%Ny;
+                    z2 = (z2+Nz)%Nz;
+                } else if ( x2<0 || x2>=Nx || y2<0 || y2>=Ny || z2<0 || z2>=Nz ) {
+                    continue;
+                }
+                int n2 = x2 + y2*Nx + z2*Nx*Ny;
+                if ( isPhase(n2) && ID(n2) < start_id ) {
+                    ID(n2) = id;
+                    queue.push_back( n2 );
+                }
+            }
+        }
+        id++;
+    }
+    return id - start_id;
+}
+
+
+//***************************************************************************************
+int main(int argc, char **argv)
+{
+    // Initialize MPI
+    int rank;
+    MPI_Init(&argc,&argv);
+    MPI_Comm comm = MPI_COMM_WORLD;
+    MPI_Comm_rank(comm,&rank);
+    int fail = 0;
+    {
+
+    // Sizes that are not multiples of the mask word size (64)
+    const int size[3][3] = { { 70, 33, 41 }, { 130, 17, 9 }, { 1, 50, 50 } };
+    const double porosity[4] = { 0.2, 0.31, 0.5, 0.7 };
+    std::mt19937 gen( 42 );
+    std::uniform_real_distribution<double> dist( 0.0, 1.0 );
+    for (int s=0; s<3; s++) {
+        int Nx = size[s][0];
+        int Ny = size[s][1];
+        int Nz = size[s][2];
+        for (int p=0; p<4; p++) {
+            Array<bool> isPhase(Nx,Ny,Nz);
+            BitMask mask(Nx,Ny,Nz);
+            for (int k=0; k<Nz; k++) {
+                for (int j=0; j<Ny; j++) {
+                    for (int i=0; i<Nx; i++) {
+                        isPhase(i,j,k) = dist(gen) < porosity[p];
+                        mask.set(i,j,k,isPhase(i,j,k));
+                    }
+                }
+            }
+            for (int periodic=0; periodic<2; periodic++) {
+                BlobIDArray ID1(Nx,Ny,Nz), ID2(Nx,Ny,Nz);
+                ID1.fill(-1);
+                ID2.fill(-1);
+                int N1 = ComputeBlob( mask, ID1, periodic==1, 5 );
+                int N2 = FloodFill( isPhase, ID2, periodic==1, 5 );
+                size_t diff = 0;
+                for (size_t n=0; n<ID1.length(); n++)
+                    diff += ID1(n) != ID2(n) ? 1:0;
+                if ( rank==0 )
+                    printf("%i x %i x %i, porosity %0.2f, periodic %i: %i blobs (flood fill %i), %i labels differ\n",
+                        Nx,Ny,Nz,porosity[p],periodic,N1,N2,(int)diff);
+                if ( N1 != N2 || diff > 0 )
+                    fail = 1;
+            }
+        }
+    }
+    if ( rank==0 )
+        printf(fail==0 ? "ComputeBlob matches the flood fill\n" : "ComputeBlob does not match the flood fill\n");
+
+    }
+    MPI_Barrier(comm);
+    MPI_Finalize();
+    return fail;
+}
@@ -0,0 +1,83 @@
+// Compare the Minkowski functionals of a sphere and a torus with their analytic values
+// The field is the signed distance to the surface (positive inside), sampled off the lattice
+//    sphere of radius R:                V = 4/3 pi R^3,    A = 4 pi R^2,      J = 4 pi R,    X = 1
+//    torus of radii Rt (tube center) a: V = 2 pi^2 Rt a^2, A = 4 pi^2 Rt a,   J = 2 pi^2 Rt, X = 0
+// J is the integral of the mean curvature (k1+k2)/2
+
+#include <math.h>
+#include <stdio.h>
+#include <functional>
+#include "common/Array.h"
+#include "analysis/Minkowski.h"
+
+
+// Sample the signed distance on a block (one ghost cell on each side), centered slightly off the lattice
+static DoubleArray sampleField( int nx, int ny, int nz, std::function<double( double, double, double )> dist )
+{
+    DoubleArray Field( nx, ny, nz );
+    double cx = 0.5 * nx + 0.31, cy = 0.5 * ny + 0.17, cz = 0.5 * nz + 0.23;
+    for ( int k = 0; k < nz; k++ )
+        for ( int j = 0; j < ny; j++ )
+            for ( int i = 0; i < nx; i++ )
+                Field( i, j, k ) = dist( i - cx, j - cy, k - cz );
+    return Field;
+}
+
+// Relative error of each functional (absolute for X)
+static bool check( const char *name, const Minkowski &M, double V, double A, double J, double X, int rank )
+{
+    double eV = fabs( M.Vi - V ) / V;
+    double eA = fabs( M.Ai - A ) / A;
+    double eJ = fabs( M.Ji - J ) / J;
+    double eX = fabs( M.Xi - X );
+    if ( rank == 0 ) {
+        printf( "%s: V = %f (%f), A = %f (%f), J = %f (%f), X = %f (%f)\n", name, M.Vi, V, M.Ai, A,
+            M.Ji, J, M.Xi, X );
+        printf( "   relative errors: V %e, A %e, J %e\n", eV, eA, eJ );
+    }
+    return eV < 0.01 && eA < 0.02 && eJ < 0.02 && eX == 0;
+}
+
+
+//***************************************************************************************
+int main(int argc, char **argv)
+{
+    // Initialize MPI
+    int rank;
+    MPI_Init(&argc,&argv);
+    MPI_Comm comm = MPI_COMM_WORLD;
+    MPI_Comm_rank(comm,&rank);
+    int fail = 0;
+    {
+
+    const double pi = 3.14159265358979;
+    Minkowski M( MPI_COMM_SELF );
+
+    // Sphere
+    const double R = 10.0;
+    auto sphere = sampleField( 32, 32, 32, [R]( double x, double y, double z ) {
+        return R - sqrt( x * x + y * y + z * z );
+    } );
+    M.ComputeScalar( sphere, 0.0, 1.5 );
+    if ( !check( "Sphere", M, 4.0 / 3.0 * pi * R * R * R, 4 * pi * R * R, 4 * pi * R, 1, rank ) )
+        fail = 1;
+
+    // Torus
+    const double Rt = 12.0, a = 5.0;
+    auto torus = sampleField( 48, 48, 20, [Rt,a]( double x, double y, double z ) {
+        double r = sqrt( x * x + y * y ) - Rt;
+        return a - sqrt( r * r + z * z );
+    } );
+    M.ComputeScalar( torus, 0.0, 1.5 );
+    if ( !check( "Torus", M, 2 * pi * pi * Rt * a * a, 4 * pi * pi * Rt * a, 2 * pi * pi * Rt, 0, rank ) )
+        fail = 1;
+
+    if ( rank==0 )
+        printf(fail==0 ? "The Minkowski functionals match the analytic values\n" :
+                         "The Minkowski functionals do not match the analytic values\n");
+
+    }
+    MPI_Barrier(comm);
+    MPI_Finalize();
+    return fail;
+}
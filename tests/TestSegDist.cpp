@@ -43,6 +43,7 @@ int main(int argc, char **argv)
     MPI_Comm comm = MPI_COMM_WORLD;
     MPI_Comm_rank(comm,&rank);
     MPI_Comm_size(comm,&nprocs);
+    int fail = 0;
     {
 
 
@@ -120,6 +121,93 @@ int main(int argc, char **argv)
     if (rank==0)
         printf("Mean error %0.4f \n", err);
 
+    // Check the bit-packed mask against the char segmentation
+    BitMask mask(nx,ny,nz);
+    mask.assign( id.data(), []( char c ) { return c != 0; } );
+    DoubleArray Distance2(nx,ny,nz);
+    CalcDist(Distance2,mask,Dm,{false,false,false});
+    double diff = 0.0;
+    for (size_t i=0; i<Distance.length(); i++)
+        diff = std::max( diff, fabs(Distance(i)-Distance2(i)) );
+    diff = maxReduce( Dm.Comm, diff );
+    for (size_t i=0; i<id.length(); i++)
+        Dm.id[i] = id(i);
+    int Npore = 0;
+    for (int k=1; k<nz-1; k++)
+        for (int j=1; j<ny-1; j++)
+            for (int i=1; i<nx-1; i++)
+                Npore += id(i,j,k) > 0 ? 1:0;
+    int Npore2 = Dm.PoreCount();
+    if ( diff > 0.0 || Npore != Npore2 ) {
+        printf("BitMask check failed on rank %i: distance diff %e, pores %i/%i\n",rank,diff,Npore,Npore2);
+        fail = 1;
+    }
+    fail = maxReduce( Dm.Comm, fail );
+    if (rank==0 && fail==0)
+        printf("BitMask distance and pore count match\n");
+
+    // A block without a rank (RankMap) must give the same distance as an all-solid block
+    if ( nprocs == 8 ) {
+        const int n = 24;
+        auto db2 = std::make_shared<Database>( );
+        db2->putScalar<int>( "BC", 0 );
+        db2->putVector<int>( "nproc", { 2, 2, 2 } );
+        db2->putVector<int>( "n", { n, n, n } );
+        db2->putVector<double>( "L", { 1, 1, 1 } );
+        // Solid spheres on a periodic lattice; block 7 is solid
+        auto fillSpheres = [n]( const Domain& D, Array<char>& ID ) {
+            ID.fill( 0 );
+            for (int k=1; k<n+1; k++) {
+                for (int j=1; j<n+1; j++) {
+                    for (int i=1; i<n+1; i++) {
+                        int x = (i-1+D.iproc()*n) % 12 - 6;
+                        int y = (j-1+D.jproc()*n) % 12 - 6;
+                        int z = (k-1+D.kproc()*n) % 12 - 6;
+                        bool solid = x*x+y*y+z*z < 25 || D.rank_info.ix+2*D.rank_info.jy+4*D.rank_info.kz == 7;
+                        ID(i,j,k) = solid ? 0:1;
+                    }
+                }
+            }
+        };
+        Domain Dm8(db2,comm);
+        Array<char> id8(n+2,n+2,n+2);
+        fillSpheres( Dm8, id8 );
+        DoubleArray Dist8(n+2,n+2,n+2);
+        CalcDist(Dist8,id8,Dm8);
+        // Ranks 0-6 own blocks 0-6 and block 7 is skipped
+        if (rank==0) {
+            FILE *fid = fopen("TestSegDist.RankMap","w");
+            fprintf(fid,"0 1 2 3 4 5 6 -1\n");
+            fclose(fid);
+        }
+        MPI_Barrier(comm);
+        MPI_Comm comm7;
+        MPI_Comm_split(comm,rank<7 ? 0:MPI_UNDEFINED,rank,&comm7);
+        double diff7 = 0.0;
+        if ( comm7 != MPI_COMM_NULL ) {
+            db2->putScalar<std::string>( "RankMap", "TestSegDist.RankMap" );
+            Domain Dm7(db2,comm7);
+            Array<char> id7(n+2,n+2,n+2);
+            fillSpheres( Dm7, id7 );
+            DoubleArray Dist7(n+2,n+2,n+2);
+            CalcDist(Dist7,id7,Dm7);
+            for (int k=1; k<n+1; k++)
+                for (int j=1; j<n+1; j++)
+                    for (int i=1; i<n+1; i++)
+                        diff7 = std::max( diff7, fabs(Dist7(i,j,k)-Dist8(i,j,k)) );
+            MPI_Comm_free(&comm7);
+        }
+        diff7 = maxReduce( comm, diff7 );
+        if (rank==0) {
+            remove("TestSegDist.RankMap");
+            printf("Skipped block: max distance difference %e\n",diff7);
+        }
+        if ( diff7 > 1e-12 ) {
+            if (rank==0) printf("Skipped block check failed\n");
+            fail = 1;
+        }
+    }
+
 //    // Write the results
 //    Array<int> ID0(id.size());
 //    ID0.copy( id );
@@ -143,6 +231,6 @@ int main(int argc, char **argv)
     }
     MPI_Barrier(comm);
     MPI_Finalize();
-    return 0;
+    return fail;
 
 }
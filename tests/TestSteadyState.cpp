@@ -0,0 +1,118 @@
+// Test the streaming statistics and the steady-state detector
+// The statistics are compared with a direct computation over the window
+// The detector sees a linear ramp followed by a noisy plateau and must report steady state
+// at the first step whose window meets the drift criterion (never during the ramp)
+
+#include <math.h>
+#include <stdio.h>
+#include <random>
+#include <vector>
+#include "analysis/SteadyState.h"
+#include "common/MPI_Helpers.h"
+
+
+// Direct statistics of the last W samples of y (up to and including sample t)
+struct DirectStats {
+    double mean, variance, slope, error;
+};
+static DirectStats directStats( const std::vector<double> &y, int t, int W )
+{
+    int n0 = std::max( t - W + 1, 0 );
+    double n = t - n0 + 1;
+    DirectStats s = { 0, 0, 0, 0 };
+    for ( int i = n0; i <= t; i++ )
+        s.mean += y[i] / n;
+    double tm = 0.5 * ( n - 1 );
+    double Sxx = 0, Sxy = 0, Syy = 0;
+    for ( int i = n0; i <= t; i++ ) {
+        Sxx += ( i - n0 - tm ) * ( i - n0 - tm );
+        Sxy += ( i - n0 - tm ) * ( y[i] - s.mean );
+        Syy += ( y[i] - s.mean ) * ( y[i] - s.mean );
+    }
+    if ( n >= 2 ) {
+        s.variance = Syy / ( n - 1 );
+        s.slope    = Sxy / Sxx;
+    }
+    if ( n >= 3 )
+        s.error = sqrt( std::max( Syy - Sxy * Sxy / Sxx, 0.0 ) / ( n - 2 ) / Sxx );
+    return s;
+}
+
+
+//***************************************************************************************
+int main(int argc, char **argv)
+{
+    // Initialize MPI
+    int rank;
+    MPI_Init(&argc,&argv);
+    MPI_Comm comm = MPI_COMM_WORLD;
+    MPI_Comm_rank(comm,&rank);
+    int fail = 0;
+    {
+
+    // Ramp (0 to 1 over R samples) followed by a plateau at 1 with a little noise
+    const int R = 100;
+    const int T = 300;
+    const int W = 20;
+    const double tol = 0.01;
+    const double z = 1.959963984540054;     // two-sided 95% quantile
+    std::mt19937 gen( 42 );
+    std::normal_distribution<double> noise( 0.0, 1e-4 );
+    std::vector<double> y( T );
+    for ( int t = 0; t < T; t++ )
+        y[t] = t < R ? (double) t / R : 1.0 + noise( gen );
+
+    // The streaming statistics match a direct computation (across several recomputes of the sums)
+    StreamingStats stats( W );
+    double err = 0;
+    for ( int t = 0; t < T; t++ ) {
+        stats.add( y[t] );
+        auto s = directStats( y, t, W );
+        err = std::max( err, fabs( stats.mean() - s.mean ) );
+        err = std::max( err, fabs( stats.variance() - s.variance ) );
+        err = std::max( err, fabs( stats.slope() - s.slope ) );
+        err = std::max( err, fabs( stats.slopeError() - s.error ) );
+    }
+    if ( rank==0 )
+        printf("Streaming statistics: max error %e\n",err);
+    if ( err > 1e-8 || stats.count() != W || !stats.full() )
+        fail = 1;
+
+    // First step at which the full window meets the drift criterion
+    int expected = -1;
+    for ( int t = W - 1; t < T && expected < 0; t++ ) {
+        auto s = directStats( y, t, W );
+        if ( ( fabs( s.slope ) + z * s.error ) * ( W - 1 ) <= tol )
+            expected = t;
+    }
+
+    // The detector reports steady state at that step, after the ramp and within one window of its end
+    SteadyStateDetector detector( { "y" }, W, tol, 0.95 );
+    int detected = -1;
+    for ( int t = 0; t < T && detected < 0; t++ ) {
+        detector.add( { y[t] }, { 1.0 } );
+        if ( detector.steady() )
+            detected = t;
+    }
+    if ( rank==0 )
+        printf("Ramp ends at step %i: steady state detected at step %i (expected %i)\n",R,detected,expected);
+    if ( detected != expected || detected < R || detected >= R + W )
+        fail = 1;
+
+    // After a reset the detector needs a full window again
+    detector.reset();
+    for ( int i = 0; i < W; i++ ) {
+        if ( detector.steady() )
+            fail = 1;
+        detector.add( { 1.0 }, { 1.0 } );
+    }
+    if ( !detector.steady() )
+        fail = 1;
+    if ( rank==0 )
+        printf(fail==0 ? "Steady-state detection passed\n" : "Steady-state detection failed\n");
+
+    }
+    MPI_Barrier(comm);
+    MPI_Finalize();
+    return fail;
+}
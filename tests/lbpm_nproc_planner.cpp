@@ -0,0 +1,306 @@
+/*
+ * Process grid planner
+ * usage: lbpm_nproc_planner input.db <ranks> [memory per rank (MB)] [MLUPS per rank]
+ * Reads the segmented image named in the Domain database (N, offset, ReadType,
+ * ReadValues/WriteValues) and evaluates every process grid nprocx*nprocy*nprocz = ranks.
+ * Each grid is scored by the predicted time per step of its slowest rank (pore sites
+ * to update plus halo sites to exchange); grids that exceed the memory per rank are
+ * rejected. The best grid is printed as a Domain block with the predicted MLUPS.
+ * The MLUPS per rank should be measured with a short run on one rank (default 10)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include "common/Array.h"
+#include "common/Domain.h"
+#include "common/Utilities.h"
+
+// Halo exchange model: D3Q19 sends 5 distributions per face site in each direction
+static const double HaloBandwidth = 2.0e9;     // bytes/s per rank
+static const double MessageLatency = 5.0e-6;   // s per message (18 sends + 18 receives)
+// Rough memory use of the color model per pore site (distributions, NeighborList)
+// and per lattice site including halo (Phi, Map, id and the analysis arrays)
+static const double BytesPerPore = 450.0;
+static const double BytesPerSite = 200.0;
+// Smallest block edge worth considering (thinner blocks are mostly halo)
+static const int MinBlockSize = 8;
+// Largest number of cells per axis in the pore count table
+static const int MaxCells = 256;
+
+// Uniform split of a length into np blocks
+static std::vector<int> SplitLength(int64_t L, int np)
+{
+	std::vector<int> size(np);
+	for (int p=0; p<np; p++) size[p] = int(L/np + (p < L%np ? 1 : 0));
+	return size;
+}
+
+// All divisors of n (from its prime factors)
+static std::vector<int> Divisors(int n)
+{
+	std::vector<int> primes = Utilities::factor(n);
+	std::vector<int> div(1,1);
+	for (size_t p=0; p<primes.size(); ){
+		size_t q = p;
+		while (q < primes.size() && primes[q]==primes[p]) q++;
+		size_t count = div.size();
+		int power = 1;
+		for (size_t m=p; m<q; m++){
+			power *= primes[p];
+			for (size_t d=0; d<count; d++) div.push_back(div[d]*power);
+		}
+		p = q;
+	}
+	std::sort(div.begin(),div.end());
+	return div;
+}
+
+// Cell boundaries along one axis: every cut plane of every candidate split,
+// or a uniform grid of MaxCells cells if there are too many of them
+static std::vector<int64_t> CellBoundaries(int64_t L, const std::vector<int>& divisors, bool &exact)
+{
+	std::vector<int64_t> bound(1,0);
+	for (size_t d=0; d<divisors.size(); d++){
+		if (L < int64_t(divisors[d])*MinBlockSize) continue;
+		std::vector<int> size = SplitLength(L,divisors[d]);
+		int64_t cut = 0;
+		for (size_t p=0; p<size.size(); p++){
+			cut += size[p];
+			bound.push_back(cut);
+		}
+	}
+	std::sort(bound.begin(),bound.end());
+	bound.erase(std::unique(bound.begin(),bound.end()),bound.end());
+	if (bound.size() > size_t(MaxCells+1)){
+		exact = false;
+		bound.resize(MaxCells+1);
+		for (int c=0; c<=MaxCells; c++) bound[c] = c*L/MaxCells;
+	}
+	return bound;
+}
+
+// Index of the cell boundary closest to a cut plane
+static int NearestBoundary(const std::vector<int64_t>& bound, int64_t cut)
+{
+	size_t c = std::lower_bound(bound.begin(),bound.end(),cut) - bound.begin();
+	if (c == bound.size()) return int(c-1);
+	if (c > 0 && cut-bound[c-1] < bound[c]-cut) return int(c-1);
+	return int(c);
+}
+
+struct Candidate {
+	int np[3];
+	std::vector<int> size[3];
+	int64_t maxPores;
+	double meanPores;
+	int empty;
+	int64_t maxHalo;
+	double memory;
+	double time;
+	bool fits;
+};
+
+int main(int argc, char **argv)
+{
+	// Initialize MPI
+	int rank;
+	MPI_Init(&argc,&argv);
+	MPI_Comm comm = MPI_COMM_WORLD;
+	MPI_Comm_rank(comm,&rank);
+	if (argc < 3){
+		if (rank==0) printf("usage: lbpm_nproc_planner input.db <ranks> [memory per rank (MB)] [MLUPS per rank] \n");
+		ERROR("lbpm_nproc_planner: no input database or rank count provided \n");
+	}
+	std::string filename = argv[1];
+	int nranks = atoi(argv[2]);
+	INSIST(nranks > 0,"lbpm_nproc_planner: rank count must be positive");
+	// by default every core of this node runs one rank
+	double RankMemory = double(Utilities::getSystemMemory()) / std::max(std::thread::hardware_concurrency(),1u);
+	if (argc > 3) RankMemory = atof(argv[3])*1024.0*1024.0;
+	double RankMLUPS = 10.0;
+	if (argc > 4) RankMLUPS = atof(argv[4]);
+	// the plan is computed and printed by rank 0 alone
+	if (rank > 0){
+		MPI_Barrier(comm);
+		MPI_Finalize();
+		return 0;
+	}
+
+	// read the input database
+	auto db = std::make_shared<Database>( filename );
+	auto domain_db = db->getDatabase( "Domain" );
+	auto Filename = domain_db->getScalar<std::string>( "Filename" );
+	auto SIZE = domain_db->getVector<int>( "N" );
+	auto ReadType = domain_db->getScalar<std::string>( "ReadType" );
+	auto ReadValues = domain_db->getVector<char>( "ReadValues" );
+	auto WriteValues = domain_db->getVector<char>( "WriteValues" );
+	int64_t Nx = SIZE[0], Ny = SIZE[1], Nz = SIZE[2];
+	int64_t xStart=0, yStart=0, zStart=0;
+	if (domain_db->keyExists( "offset" )){
+		auto offset = domain_db->getVector<int>( "offset" );
+		xStart = offset[0];
+		yStart = offset[1];
+		zStart = offset[2];
+	}
+	int64_t L[3] = { Nx-xStart, Ny-yStart, Nz-zStart };
+	INSIST(L[0]>0 && L[1]>0 && L[2]>0,"lbpm_nproc_planner: offset lies outside the image");
+	int64_t bytes = (ReadType == "16bit") ? 2 : 1;
+
+	// pore voxels (after relabeling)
+	char PoreLabel[256];
+	for (int c=0; c<256; c++){
+		char value = char(c);
+		for (size_t idx=0; idx<ReadValues.size(); idx++){
+			if (value == ReadValues[idx]){
+				value = WriteValues[idx];
+				break;
+			}
+		}
+		PoreLabel[c] = (value > 0);
+	}
+
+	// pore count of every cell, with the cells bounded by all the candidate cut planes
+	std::vector<int> divisors = Divisors(nranks);
+	std::vector<int64_t> bound[3];
+	std::vector<int> cellOf[3];
+	bool exact = true;
+	for (int d=0; d<3; d++){
+		bound[d] = CellBoundaries(L[d],divisors,exact);
+		cellOf[d].resize(L[d]);
+		for (size_t c=0; c+1<bound[d].size(); c++)
+			for (int64_t i=bound[d][c]; i<bound[d][c+1]; i++) cellOf[d][i] = int(c);
+	}
+	int64_t Cx = bound[0].size()-1, Cy = bound[1].size()-1, Cz = bound[2].size()-1;
+	// summed-area table (one extra layer of zeros in each direction)
+	std::vector<int64_t> sat((Cx+1)*(Cy+1)*(Cz+1),0);
+	auto SAT = [&](int64_t i, int64_t j, int64_t k) -> int64_t& { return sat[(k*(Cy+1)+j)*(Cx+1)+i]; };
+
+	printf("Input media: %s\n",Filename.c_str());
+	printf("Region: %ld x %ld x %ld (offset %ld,%ld,%ld), %i ranks \n",L[0],L[1],L[2],xStart,yStart,zStart,nranks);
+	FILE *SEGDAT = fopen(Filename.c_str(),"rb");
+	if (SEGDAT==NULL) ERROR("lbpm_nproc_planner: Error reading segmented data");
+	std::vector<char> plane(Nx*Ny*bytes);
+	for (int64_t z=zStart; z<Nz; z++){
+		fseek(SEGDAT,z*Nx*Ny*bytes,SEEK_SET);
+		size_t ReadSeg = fread(plane.data(),bytes,Nx*Ny,SEGDAT);
+		if (ReadSeg != size_t(Nx*Ny)) ERROR("lbpm_nproc_planner: Error reading segmented data");
+		int64_t k = cellOf[2][z-zStart]+1;
+		for (int64_t y=yStart; y<Ny; y++){
+			int64_t j = cellOf[1][y-yStart]+1;
+			for (int64_t x=xStart; x<Nx; x++){
+				// 16-bit labels are truncated to char, as in lbpm_serial_decomp
+				char label = (bytes==2) ? char(((short int*)plane.data())[y*Nx+x]) : plane[y*Nx+x];
+				if (PoreLabel[(unsigned char)label]) SAT(cellOf[0][x-xStart]+1,j,k)++;
+			}
+		}
+	}
+	fclose(SEGDAT);
+	for (int64_t k=1; k<=Cz; k++)
+		for (int64_t j=1; j<=Cy; j++)
+			for (int64_t i=1; i<=Cx; i++)
+				SAT(i,j,k) += SAT(i-1,j,k) + SAT(i,j-1,k) + SAT(i,j,k-1)
+					- SAT(i-1,j-1,k) - SAT(i-1,j,k-1) - SAT(i,j-1,k-1) + SAT(i-1,j-1,k-1);
+	int64_t totalPores = SAT(Cx,Cy,Cz);
+	if (totalPores == 0) ERROR("lbpm_nproc_planner: image has no pore voxels");
+
+	/******************* Evaluate every process grid ********************/
+	std::vector<Candidate> candidates;
+	for (size_t a=0; a<divisors.size(); a++){
+		for (size_t b=0; b<divisors.size(); b++){
+			if ((nranks/divisors[a]) % divisors[b] != 0) continue;
+			Candidate c;
+			c.np[0] = divisors[a];
+			c.np[1] = divisors[b];
+			c.np[2] = nranks/divisors[a]/divisors[b];
+			bool valid = true;
+			std::vector<int> lo[3], hi[3];
+			for (int d=0; d<3; d++){
+				valid = valid && (L[d] >= int64_t(c.np[d])*MinBlockSize);
+				c.size[d] = SplitLength(L[d],c.np[d]);
+				int64_t cut = 0;
+				for (int p=0; p<c.np[d]; p++){
+					lo[d].push_back(NearestBoundary(bound[d],cut));
+					cut += c.size[d][p];
+					hi[d].push_back(NearestBoundary(bound[d],cut));
+				}
+			}
+			if (!valid) continue;
+			c.maxPores = 0;
+			c.maxHalo = 0;
+			c.empty = 0;
+			c.memory = 0.0;
+			c.time = 0.0;
+			for (int kp=0; kp<c.np[2]; kp++){
+				for (int jp=0; jp<c.np[1]; jp++){
+					for (int ip=0; ip<c.np[0]; ip++){
+						int i0=lo[0][ip], i1=hi[0][ip], j0=lo[1][jp], j1=hi[1][jp], k0=lo[2][kp], k1=hi[2][kp];
+						int64_t pores = SAT(i1,j1,k1) - SAT(i0,j1,k1) - SAT(i1,j0,k1) - SAT(i1,j1,k0)
+							+ SAT(i0,j0,k1) + SAT(i0,j1,k0) + SAT(i1,j0,k0) - SAT(i0,j0,k0);
+						int64_t nx = c.size[0][ip], ny = c.size[1][jp], nz = c.size[2][kp];
+						// pore sites on the faces shared with other ranks
+						double porosity = double(pores)/double(nx*ny*nz);
+						int64_t faces = 0;
+						if (c.np[0] > 1) faces += 2*ny*nz;
+						if (c.np[1] > 1) faces += 2*nx*nz;
+						if (c.np[2] > 1) faces += 2*nx*ny;
+						int64_t halo = int64_t(porosity*faces + 0.5);
+						double time = pores/(RankMLUPS*1.0e6) + 2.0*5.0*sizeof(double)*halo/HaloBandwidth
+							+ (faces > 0 ? 36.0*MessageLatency : 0.0);
+						double memory = BytesPerPore*pores + BytesPerSite*(nx+2)*(ny+2)*(nz+2);
+						c.maxPores = std::max(c.maxPores,pores);
+						c.maxHalo = std::max(c.maxHalo,halo);
+						c.memory = std::max(c.memory,memory);
+						c.time = std::max(c.time,time);
+						if (pores == 0) c.empty++;
+					}
+				}
+			}
+			c.meanPores = double(totalPores)/nranks;
+			c.fits = (c.memory <= RankMemory);
+			candidates.push_back(c);
+		}
+	}
+	if (candidates.empty()) ERROR("lbpm_nproc_planner: region is too small for this many ranks");
+	// grids that fit in memory first, then by predicted time per step
+	std::sort(candidates.begin(),candidates.end(),[](const Candidate& x, const Candidate& y){
+		if (x.fits != y.fits) return x.fits;
+		if (x.time != y.time) return x.time < y.time;
+		return x.maxHalo < y.maxHalo;
+	});
+
+	printf("Pore voxels: %ld (porosity %.4f) \n",totalPores,double(totalPores)/double(L[0]*L[1]*L[2]));
+	printf("Memory per rank: %.1f MB, update rate per rank: %.2f MLUPS \n",RankMemory/1048576.0,RankMLUPS);
+	if (!exact) printf("Pore counts estimated on a %ld x %ld x %ld grid \n",Cx,Cy,Cz);
+	printf("   nproc          max Np    Np max/mean   halo/rank   MB/rank    MLUPS   empty \n");
+	for (size_t n=0; n<candidates.size() && n<10; n++){
+		const Candidate& c = candidates[n];
+		printf("%4i %4i %4i  %12ld  %12.3f  %10ld  %9.1f  %8.2f  %5i %s\n",c.np[0],c.np[1],c.np[2],
+				c.maxPores,c.maxPores/c.meanPores,c.maxHalo,c.memory/1048576.0,
+				totalPores/c.time*1.0e-6,c.empty,c.fits ? "" : " (exceeds memory)");
+	}
+	const Candidate& best = candidates[0];
+	if (!best.fits){
+		printf("No process grid fits in %.1f MB per rank; use more ranks \n",RankMemory/1048576.0);
+	}
+	else{
+		printf("Predicted performance: %.2f MLUPS \n",totalPores/best.time*1.0e-6);
+		printf("Domain { \n");
+		printf("   nproc = %i, %i, %i \n",best.np[0],best.np[1],best.np[2]);
+		printf("   n = %i, %i, %i \n",best.size[0][0],best.size[1][0],best.size[2][0]);
+		const char *axis[3] = {"X","Y","Z"};
+		for (int d=0; d<3; d++){
+			if (L[d] % best.np[d] == 0) continue;
+			printf("   BlockSize%s = ",axis[d]);
+			for (int p=0; p<best.np[d]; p++) printf(p+1<best.np[d] ? "%i, " : "%i \n",best.size[d][p]);
+		}
+		printf("} \n");
+		if (best.empty > 0)
+			printf("%i subdomains are all solid; set SkipSolidBlocks in lbpm_serial_decomp to run without them \n",best.empty);
+	}
+	MPI_Barrier(comm);
+	MPI_Finalize();
+}
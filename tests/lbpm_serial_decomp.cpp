@@ -2,6 +2,10 @@
  * Pre-processor to generate signed distance function from segmented data
  * segmented data should be stored in a raw binary file as 1-byte integer (type char)
  * will output distance functions for phases
+ * When launched on nprocx*nprocy*nprocz MPI ranks, every rank reads its own block
+ * from the image with MPI-IO and writes its own ID file (parallel mode)
+ * With BalancePorosity the cut planes are placed so every subdomain holds a similar
+ * number of pore voxels; paste the printed BlockSizeX/Y/Z into the Domain database
  */
 
 #include <stdio.h>
@@ -10,13 +14,67 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
 #include "common/Array.h"
 #include "common/Domain.h"
 
+// Read the z-slab [zmin,zmax] of the image (all x,y) into SegData using pread
+static void ReadSlab(int fd, const std::string& ReadType, int64_t Nx, int64_t Ny,
+		int64_t zmin, int64_t zmax, char *SegData, short int *InputData)
+{
+	int64_t bytes = (ReadType == "16bit") ? 2 : 1;
+	char *buffer = (bytes == 2) ? (char*) InputData : SegData;
+	int64_t length = (zmax-zmin+1)*Nx*Ny*bytes;
+	int64_t offset = zmin*Nx*Ny*bytes;
+	int64_t pos = 0;
+	while (pos < length){
+		ssize_t count = pread(fd, &buffer[pos], length-pos, offset+pos);
+		if (count <= 0) ERROR("lbpm_serial_decomp: Error reading segmented data slab");
+		pos += count;
+	}
+	if (bytes == 2){
+		for (int64_t n=0; n<(zmax-zmin+1)*Nx*Ny; n++)
+			SegData[n] = char(InputData[n]);
+	}
+}
+
+// Number of pore (id>0) voxels in the interior of a subdomain
+static int64_t CountPores(const char *loc_id, int nx, int ny, int nz)
+{
+	int64_t count = 0;
+	for (int k=1; k<nz+1; k++){
+		for (int j=1; j<ny+1; j++){
+			for (int i=1; i<nx+1; i++){
+				if (loc_id[k*(nx+2)*(ny+2)+j*(nx+2)+i] > 0) count++;
+			}
+		}
+	}
+	return count;
+}
+
+// Print the min/max/mean pore count of a set of subdomains
+static void PrintPoreBalance(const char *label, const std::vector<int64_t>& count)
+{
+	int64_t minval = *std::min_element(count.begin(),count.end());
+	int64_t maxval = *std::max_element(count.begin(),count.end());
+	double mean = 0.0;
+	for (size_t b=0; b<count.size(); b++) mean += count[b];
+	mean /= count.size();
+	printf("Pore voxels per subdomain (%s): min=%ld, max=%ld, mean=%.1f, max/mean=%.3f \n",
+			label,minval,maxval,mean,mean>0.0 ? maxval/mean : 0.0);
+}
+
 int main(int argc, char **argv)
 {
 
-	int rank=0;
+	// Initialize MPI
+	int rank,nranks;
+	MPI_Init(&argc,&argv);
+	MPI_Comm comm = MPI_COMM_WORLD;
+	MPI_Comm_rank(comm,&rank);
+	MPI_Comm_size(comm,&nranks);
 
 	/*		bool MULTINPUT=false;
 
@@ -83,6 +141,21 @@ int main(int argc, char **argv)
 		printf("INPUT ERROR: Valid ReadType are 8bit, 16bit \n");
 		ReadType = "8bit";
 	}
+	// do not assign ranks to all-solid subdomains (writes a RankMap for the Domain database)
+	bool SkipSolidBlocks = false;
+	if (domain_db->keyExists( "SkipSolidBlocks" )){
+		SkipSolidBlocks = domain_db->getScalar<bool>( "SkipSolidBlocks" );
+	}
+	// stream the image in z-slabs one process layer thick instead of reading it all at once
+	bool Streaming = false;
+	if (domain_db->keyExists( "Streaming" )){
+		Streaming = domain_db->getScalar<bool>( "Streaming" );
+	}
+	// choose the block sizes so that the pore count is balanced (serial mode only)
+	bool BalancePorosity = false;
+	if (domain_db->keyExists( "BalancePorosity" )){
+		BalancePorosity = domain_db->getScalar<bool>( "BalancePorosity" );
+	}
 
 	nx = size[0];
 	ny = size[1];
@@ -94,19 +167,37 @@ int main(int argc, char **argv)
 	Ny = SIZE[1];
 	Nz = SIZE[2];
 
-	printf("Input media: %s\n",Filename.c_str());
-	printf("Relabeling %lu values\n",ReadValues.size());
-	for (int idx=0; idx<ReadValues.size(); idx++){
-		char oldvalue=ReadValues[idx];
-		char newvalue=WriteValues[idx];
-		printf("oldvalue=%d, newvalue =%d \n",oldvalue,newvalue);
+	if (rank==0){
+		printf("Input media: %s\n",Filename.c_str());
+		printf("Relabeling %lu values\n",ReadValues.size());
+		for (int idx=0; idx<ReadValues.size(); idx++){
+			char oldvalue=ReadValues[idx];
+			char newvalue=WriteValues[idx];
+			printf("oldvalue=%d, newvalue =%d \n",oldvalue,newvalue);
+		}
 	}
 
 	nprocs=nprocx*nprocy*nprocz;
+	bool parallel = (nranks > 1);
+	if (parallel && nranks != nprocs){
+		if (rank==0) printf("lbpm_serial_decomp: run on 1 rank or on nprocx*nprocy*nprocz=%i ranks (got %i) \n",nprocs,nranks);
+		ERROR("lbpm_serial_decomp: number of MPI ranks does not match the process grid");
+	}
+	if (BalancePorosity && (parallel || Streaming))
+		ERROR("lbpm_serial_decomp: BalancePorosity requires the serial (non-streaming) mode");
+
+	// Interior size of the blocks along each axis (uniform unless given in the database)
+	std::vector<int> BlockSizeX(nprocx,nx), BlockSizeY(nprocy,ny), BlockSizeZ(nprocz,nz);
+	if (domain_db->keyExists( "BlockSizeX" )) BlockSizeX = domain_db->getVector<int>( "BlockSizeX" );
+	if (domain_db->keyExists( "BlockSizeY" )) BlockSizeY = domain_db->getVector<int>( "BlockSizeY" );
+	if (domain_db->keyExists( "BlockSizeZ" )) BlockSizeZ = domain_db->getVector<int>( "BlockSizeZ" );
+	INSIST(BlockSizeX.size()==size_t(nprocx),"BlockSizeX must have nproc[0] entries");
+	INSIST(BlockSizeY.size()==size_t(nprocy),"BlockSizeY must have nproc[1] entries");
+	INSIST(BlockSizeZ.size()==size_t(nprocz),"BlockSizeZ must have nproc[2] entries");
 
 	char *SegData = NULL;
 	// Rank=0 reads the entire segmented data and distributes to worker processes
-	if (rank==0){
+	if (rank==0 && !parallel && !Streaming){
 		printf("Dimensions of segmented image: %ld x %ld x %ld \n",Nx,Ny,Nz);
 		int64_t SIZE = Nx*Ny*Nz;
 		SegData = new char[SIZE];
@@ -136,31 +227,185 @@ int main(int argc, char **argv)
 		printf("Read segmented data from %s \n",Filename.c_str());
 	}
 
-	// Get the rank info
-	int64_t N = (nx+2)*(ny+2)*(nz+2);
+	// Size of the decomposed region
+	int64_t LX=0, LY=0, LZ=0;
+	for (int ip=0; ip<nprocx; ip++) LX += BlockSizeX[ip];
+	for (int jp=0; jp<nprocy; jp++) LY += BlockSizeY[jp];
+	for (int kp=0; kp<nprocz; kp++) LZ += BlockSizeZ[kp];
 
 	// number of sites to use for periodic boundary condition transition zone
-	int64_t z_transition_size = (nprocz*nz - (Nz - zStart))/2;
+	int64_t z_transition_size = (LZ - (Nz - zStart))/2;
 	if (z_transition_size < 0) z_transition_size=0;
 
+	if (rank==0 && BalancePorosity){
+		// pore voxels in every plane of the decomposed region (after relabeling)
+		char PoreLabel[256];
+		for (int c=0; c<256; c++){
+			char value = char(c);
+			for (int idx=0; idx<ReadValues.size(); idx++){
+				if (value == ReadValues[idx]){
+					value = WriteValues[idx];
+					break;
+				}
+			}
+			PoreLabel[c] = (value > 0);
+		}
+		std::vector<int64_t> histX(LX,0), histY(LY,0), histZ(LZ,0);
+		for (k=0; k<LZ; k++){
+			int64_t z = std::min(std::max(zStart+k-z_transition_size,zStart),Nz-1);
+			for (j=0; j<LY; j++){
+				int64_t y = std::min(yStart+j,Ny-1);
+				for (i=0; i<LX; i++){
+					int64_t x = std::min(xStart+i,Nx-1);
+					if (PoreLabel[(unsigned char)SegData[z*Nx*Ny+y*Nx+x]]){
+						histX[i]++;
+						histY[j]++;
+						histZ[k]++;
+					}
+				}
+			}
+		}
+		std::vector<int> BalancedX = BalanceBlockSizes(std::vector<double>(histX.begin(),histX.end()),nprocx,2);
+		std::vector<int> BalancedY = BalanceBlockSizes(std::vector<double>(histY.begin(),histY.end()),nprocy,2);
+		std::vector<int> BalancedZ = BalanceBlockSizes(std::vector<double>(histZ.begin(),histZ.end()),nprocz,2);
+		// pore count of every block before and after balancing
+		std::vector<int> blockX[2], blockY[2], blockZ[2];
+		const std::vector<int> *sizes[2][3] = { {&BlockSizeX,&BlockSizeY,&BlockSizeZ}, {&BalancedX,&BalancedY,&BalancedZ} };
+		for (int d=0; d<2; d++){
+			for (int ip=0; ip<nprocx; ip++) blockX[d].insert(blockX[d].end(),(*sizes[d][0])[ip],ip);
+			for (int jp=0; jp<nprocy; jp++) blockY[d].insert(blockY[d].end(),(*sizes[d][1])[jp],jp);
+			for (int kp=0; kp<nprocz; kp++) blockZ[d].insert(blockZ[d].end(),(*sizes[d][2])[kp],kp);
+		}
+		std::vector<int64_t> BlockPores[2] = { std::vector<int64_t>(nprocs,0), std::vector<int64_t>(nprocs,0) };
+		for (k=0; k<LZ; k++){
+			int64_t z = std::min(std::max(zStart+k-z_transition_size,zStart),Nz-1);
+			for (j=0; j<LY; j++){
+				int64_t y = std::min(yStart+j,Ny-1);
+				for (i=0; i<LX; i++){
+					int64_t x = std::min(xStart+i,Nx-1);
+					if (PoreLabel[(unsigned char)SegData[z*Nx*Ny+y*Nx+x]]){
+						for (int d=0; d<2; d++)
+							BlockPores[d][blockZ[d][k]*nprocx*nprocy + blockY[d][j]*nprocx + blockX[d][i]]++;
+					}
+				}
+			}
+		}
+		PrintPoreBalance("initial",BlockPores[0]);
+		PrintPoreBalance("balanced",BlockPores[1]);
+		// balancing the projections does not always help (e.g. for homogeneous media)
+		if (*std::max_element(BlockPores[1].begin(),BlockPores[1].end()) <
+				*std::max_element(BlockPores[0].begin(),BlockPores[0].end())){
+			BlockSizeX = BalancedX;
+			BlockSizeY = BalancedY;
+			BlockSizeZ = BalancedZ;
+		}
+		else {
+			printf("Balancing does not reduce the largest subdomain, keeping the initial block sizes \n");
+		}
+		const std::vector<int> *balanced[3] = { &BlockSizeX, &BlockSizeY, &BlockSizeZ };
+		const char *names[3] = { "BlockSizeX", "BlockSizeY", "BlockSizeZ" };
+		printf("Add to the Domain database: \n");
+		for (int d=0; d<3; d++){
+			printf("   %s = ",names[d]);
+			for (size_t b=0; b<balanced[d]->size(); b++) printf(b==0 ? "%i" : ", %i",(*balanced[d])[b]);
+			printf("\n");
+		}
+	}
+
+	int maxnx = *std::max_element(BlockSizeX.begin(),BlockSizeX.end());
+	int maxny = *std::max_element(BlockSizeY.begin(),BlockSizeY.end());
+	int maxnz = *std::max_element(BlockSizeZ.begin(),BlockSizeZ.end());
 	char LocalRankFilename[40];
 	char *loc_id;
-	loc_id = new char [(nx+2)*(ny+2)*(nz+2)];
+	loc_id = new char [(maxnx+2)*(maxny+2)*(maxnz+2)];
 
 	std::vector<int> LabelCount(ReadValues.size(),0);
+	// rank assigned to each block (-1 if the block is skipped)
+	std::vector<int> RankMap(nprocs,-1);
+	int nactive = 0;
+	if (parallel){
+		// Each rank reads and relabels only its own block
+		if (rank==0){
+			printf("Reading subdomains in parallel on %i processors \n",nprocs);
+			printf("Process grid: %i x %i x %i \n",nprocx,nprocy,nprocz);
+			printf("Subdomain size: %i x %i x %i \n",nx,ny,nz);
+			printf("Size of transition region: %ld \n", z_transition_size);
+		}
+		RankInfoStruct rank_info(rank,nprocx,nprocy,nprocz);
+		int start[3] = { 0, 0, 0 };
+		for (int ip=0; ip<rank_info.ix; ip++) start[0] += BlockSizeX[ip];
+		for (int jp=0; jp<rank_info.jy; jp++) start[1] += BlockSizeY[jp];
+		for (int kp=0; kp<rank_info.kz; kp++) start[2] += BlockSizeZ[kp];
+		nx = BlockSizeX[rank_info.ix];
+		ny = BlockSizeY[rank_info.jy];
+		nz = BlockSizeZ[rank_info.kz];
+		int64_t N = (nx+2)*(ny+2)*(nz+2);
+		ReadSubdomainImage(comm,Filename,ReadType,{Nx,Ny,Nz},{xStart,yStart,zStart},
+			{start[0],start[1],start[2]},{nx,ny,nz},z_transition_size,loc_id);
+		for (n=0; n<N; n++){
+			char locval = loc_id[n];
+			for (int idx=0; idx<ReadValues.size(); idx++){
+				if (locval == ReadValues[idx]){
+					loc_id[n] = WriteValues[idx];
+					LabelCount[idx]++;
+					break;
+				}
+			}
+		}
+		int64_t Npores = CountPores(loc_id,nx,ny,nz);
+		std::vector<int64_t> BlockPores(nprocs,0);
+		MPI_Allgather(&Npores,1,MPI_INT64_T,BlockPores.data(),1,MPI_INT64_T,comm);
+		for (int rnk=0; rnk<nprocs; rnk++){
+			if (!SkipSolidBlocks || BlockPores[rnk] > 0) RankMap[rnk] = nactive++;
+		}
+		if (RankMap[rank] >= 0){
+			sprintf(LocalRankFilename,"ID.%05i",RankMap[rank]+rank_offset);
+			FILE *ID = fopen(LocalRankFilename,"wb");
+			fwrite(loc_id,1,N,ID);
+			fclose(ID);
+		}
+		std::vector<int> LabelCountLocal(LabelCount);
+		MPI_Reduce(LabelCountLocal.data(),LabelCount.data(),LabelCount.size(),MPI_INT,MPI_SUM,0,comm);
+	}
 	// Set up the sub-domains
-	if (rank==0){
+	else if (rank==0){
 		printf("Distributing subdomains across %i processors \n",nprocs);
 		printf("Process grid: %i x %i x %i \n",nprocx,nprocy,nprocz);
 		printf("Subdomain size: %i x %i x %i \n",nx,ny,nz);
 		printf("Size of transition region: %ld \n", z_transition_size);
 
+		// streaming mode holds one slab of nz+2 layers (peak memory O(Nx*Ny*nz))
+		int fd = -1;
+		short int *InputData = NULL;
+		if (Streaming){
+			printf("Streaming %s input data in z-slabs from %s \n",ReadType.c_str(),Filename.c_str());
+			fd = open(Filename.c_str(),O_RDONLY);
+			if (fd < 0) ERROR("Error reading segmented data");
+			SegData = new char[Nx*Ny*(maxnz+2)];
+			if (ReadType == "16bit") InputData = new short int[Nx*Ny*(maxnz+2)];
+		}
+		int64_t zoff = 0;
 		for (int kp=0; kp<nprocz; kp++){
    ////cout<<"kp="<<kp<<endl;
+			nz = BlockSizeZ[kp];
+			// first z index held in SegData
+			int64_t zbase = 0;
+			if (Streaming){
+				int64_t zmin = zStart + zoff - 1 - z_transition_size;
+				int64_t zmax = zmin + nz + 1;
+				zmin = std::min(std::max(zmin,zStart),Nz-1);
+				zmax = std::min(std::max(zmax,zStart),Nz-1);
+				ReadSlab(fd,ReadType,Nx,Ny,zmin,zmax,SegData,InputData);
+				zbase = zmin;
+			}
+			int64_t yoff = 0;
 			for (int jp=0; jp<nprocy; jp++){
       ////cout<<"jp="<<jp<<endl;
+				ny = BlockSizeY[jp];
+				int64_t xoff = 0;
 				for (int ip=0; ip<nprocx; ip++){
         ////cout<<"ip="<<ip<<endl;
+					nx = BlockSizeX[ip];
 					// rank of the process that gets this subdomain
 					int rnk = kp*nprocx*nprocy + jp*nprocx + ip;
 					// Pack and send the subdomain for rnk
@@ -173,10 +418,10 @@ int main(int argc, char **argv)
                                              ////cout<<"xs="<<xStart<<endl;
                                              ////cout<<"ys="<<yStart<<endl;
                                              ////cout<<"zs="<<zStart<<endl;
-								int64_t x = xStart + ip*nx + i-1;
-								int64_t y = yStart + jp*ny + j-1;
+								int64_t x = xStart + xoff + i-1;
+								int64_t y = yStart + yoff + j-1;
 								// int64_t z = zStart + kp*nz + k-1;
-								int64_t z = zStart + kp*nz + k-1 - z_transition_size;
+								int64_t z = zStart + zoff + k-1 - z_transition_size;
 								if (x<xStart) 	x=xStart;
 								if (!(x<Nx))	x=Nx-1;
 								if (y<yStart) 	y=yStart;
@@ -184,7 +429,7 @@ int main(int argc, char **argv)
 								if (z<zStart) 	z=zStart;
 								if (!(z<Nz))	z=Nz-1;
   							    int64_t nlocal = k*(nx+2)*(ny+2) + j*(nx+2) + i;
-								int64_t nglobal = z*Nx*Ny+y*Nx+x;
+								int64_t nglobal = (z-zbase)*Nx*Ny+y*Nx+x;
                                   ////cout<<"nloc="<<nlocal<<endl;
                                     ////cout<<"nglob="<<nglobal<<endl;
 								loc_id[nlocal] = SegData[nglobal];
@@ -217,19 +462,41 @@ int main(int argc, char **argv)
 						}
 					}
 
+					xoff += nx;
+					// Skip blocks that contain no pore space
+					if (SkipSolidBlocks && CountPores(loc_id,nx,ny,nz) == 0) continue;
+					RankMap[rnk] = nactive++;
 					// Write the data for this rank data 
-					sprintf(LocalRankFilename,"ID.%05i",rnk+rank_offset);
+					sprintf(LocalRankFilename,"ID.%05i",RankMap[rnk]+rank_offset);
 					FILE *ID = fopen(LocalRankFilename,"wb");
 					fwrite(loc_id,1,(nx+2)*(ny+2)*(nz+2),ID);
 					fclose(ID);
 				}
+				yoff += ny;
 			}
+			zoff += nz;
+		}
+		if (Streaming){
+			close(fd);
+			delete [] InputData;
 		}
 	}
-	for (int idx=0; idx<ReadValues.size(); idx++){
-		char label=ReadValues[idx];
-		int count=LabelCount[idx];
-		printf("Label=%d, Count=%d \n",label,count);
+	if (rank==0){
+		for (int idx=0; idx<ReadValues.size(); idx++){
+			char label=ReadValues[idx];
+			int count=LabelCount[idx];
+			printf("Label=%d, Count=%d \n",label,count);
+		}
+		if (SkipSolidBlocks){
+			FILE *MAPFILE = fopen("RankMap","w");
+			for (int rnk=0; rnk<nprocs; rnk++) fprintf(MAPFILE,"%i\n",RankMap[rnk]);
+			fclose(MAPFILE);
+			printf("Skipped %i all-solid subdomains \n",nprocs-nactive);
+			printf("Run on %i processors with RankMap = \"RankMap\" in the Domain database \n",nactive);
+		}
 	}
-
+	delete [] SegData;
+	delete [] loc_id;
+	MPI_Barrier(comm);
+	MPI_Finalize();
 }
@@ -252,6 +252,61 @@ int testHalo( MPI_Comm comm, int nprocx, int nprocy, int nprocz, int depth )
 }
 
 
+template<class TYPE>
+int testGlobalWrite( MPI_Comm comm, int nprocx, int nprocy, int nprocz )
+{
+    int rank,nprocs;
+    MPI_Comm_rank(comm,&rank);
+    MPI_Comm_size(comm,&nprocs);
+    if ( rank==0 )
+        printf("\nRunning global write test %i %i %i\n",nprocx,nprocy,nprocz);
+
+    const RankInfoStruct rank_info(rank,nprocx,nprocy,nprocz);
+
+    int nx = 6;
+    int ny = 5;
+    int nz = 4;
+    int Nx = nx*nprocx;
+    int Ny = ny*nprocy;
+    int Nz = nz*nprocz;
+    Array<TYPE> array(nx+2,ny+2,nz+2);
+    array.fill(-1);
+    for (int k=0; k<nz; k++) {
+        for (int j=0; j<ny; j++) {
+            for (int i=0; i<nx; i++) {
+                int iglobal = i + rank_info.ix*nx;
+                int jglobal = j + rank_info.jy*ny;
+                int kglobal = k + rank_info.kz*nz;
+                array(i+1,j+1,k+1) = iglobal + jglobal*Nx + kglobal*Nx*Ny;
+            }
+        }
+    }
+    writeGlobalArray(comm,rank_info,array,1,"testGlobalWrite.raw");
+    MPI_Barrier(comm);
+
+    // Check the global file (ghost cells must not appear)
+    int N_errors = 0;
+    if ( rank==0 ) {
+        std::vector<TYPE> global(Nx*Ny*Nz,-1);
+        FILE *fid = fopen("testGlobalWrite.raw","rb");
+        size_t count = fread(global.data(),sizeof(TYPE),global.size(),fid);
+        fclose(fid);
+        bool pass = count==global.size();
+        for (size_t n=0; n<global.size() && pass; n++) {
+            if ( global[n] != static_cast<TYPE>(n) )
+                pass = false;
+        }
+        if ( !pass ) {
+            std::cout << "Failed global write test\n";
+            N_errors++;
+        }
+        remove("testGlobalWrite.raw");
+    }
+    MPI_Barrier(comm);
+    return N_errors;
+}
+
+
 int main(int argc, char **argv)
 {
     // Initialize MPI
@@ -288,6 +343,13 @@ int main(int argc, char **argv)
         N_errors += testHalo<int>( comm, 2, 2, 2, 1 );
     }
 
+    // Run the collective global write tests
+    N_errors += testGlobalWrite<double>( comm, nprocs, 1, 1 );
+    N_errors += testGlobalWrite<double>( comm, 1, 1, nprocs );
+    if ( nprocs==4 ) {
+        N_errors += testGlobalWrite<int>( comm, 2, 1, 2 );
+    }
+
     // Finished
     MPI_Barrier(comm);
     int N_errors_global=0;